@@ -7,6 +7,24 @@
 typedef struct _double_buffered_matrix *doubleBufferedMatrix;
 
 
+/* How values are stored in the files (see dbm_setStorageType) */
+
+#define DBM_STORAGE_DOUBLE 0
+#define DBM_STORAGE_FLOAT 1
+#define DBM_STORAGE_UINT16 2
+#define DBM_STORAGE_INT32 3
+#define DBM_STORAGE_LOGICAL 4
+
+
+/* Which column leaves the column buffer (see dbm_setEvictionPolicy) */
+
+#define DBM_EVICT_LRU 0
+#define DBM_EVICT_FIFO 1
+#define DBM_EVICT_MRU 2
+#define DBM_EVICT_CLOCK 3
+#define DBM_EVICT_ARC 4
+
+
 /* Memory allocation */
 doubleBufferedMatrix dbm_alloc(int max_rows, int max_cols, char *prefix, char *directory);
 int dbm_free(doubleBufferedMatrix Matrix);
@@ -16,6 +34,10 @@ int dbm_free(doubleBufferedMatrix Matrix);
 
 int dbm_setRows(doubleBufferedMatrix Matrix, int Rows);
 int dbm_AddColumn(doubleBufferedMatrix Matrix);
+int dbm_AddColumns(doubleBufferedMatrix Matrix, int n);
+int dbm_AppendColumn(doubleBufferedMatrix Matrix, const double *values);
+int dbm_AdoptFiles(doubleBufferedMatrix Matrix, int cols, const char **filenames, int nfiles);  /* only when there are no columns */
+int dbm_ExportColumns(doubleBufferedMatrix Matrix, const char *filename, int type);
 int dbm_ResizeColBuffer(doubleBufferedMatrix Matrix, int new_maxcol);
 int dbm_ResizeRowBuffer(doubleBufferedMatrix Matrix, int new_maxrow);
 int dbm_ResizeBuffer(doubleBufferedMatrix Matrix, int new_maxrow, int new_maxcol);
@@ -40,6 +62,41 @@ int dbm_getCols(doubleBufferedMatrix Matrix);  /* returns how many cols are curr
 
 int dbm_getBufferCols(doubleBufferedMatrix Matrix);  /* returns how many columns are currently in the column buffer */
 int dbm_getBufferRows(doubleBufferedMatrix Matrix);  /* returns how many rows are currently in the row buffer */
+int dbm_setBufferBytes(doubleBufferedMatrix Matrix, double bytes);  /* size the buffers from a memory budget, 0 for none */
+double dbm_getBufferBytes(doubleBufferedMatrix Matrix);
+int dbm_setSharedBuffer(doubleBufferedMatrix Matrix, int setting);  /* size the column buffer from the shared buffer pool */
+int dbm_isSharedBuffer(doubleBufferedMatrix Matrix);
+int dbm_setSharedBufferBytes(double bytes);  /* memory budget of the shared buffer pool (for all matrices), 0 for none */
+double dbm_getSharedBufferBytes(void);
+double dbm_getSharedBufferInUse(void);
+
+int dbm_setMaxOpenFiles(doubleBufferedMatrix Matrix, int max_open);
+int dbm_getMaxOpenFiles(doubleBufferedMatrix Matrix);  /* returns how many files may be held open at once */
+
+int dbm_setColumnsPerFile(doubleBufferedMatrix Matrix, int cols_per_file);  /* only before any columns are added */
+int dbm_getColumnsPerFile(doubleBufferedMatrix Matrix);  /* returns how many columns are stored in each file */
+int dbm_setMemoryMapped(doubleBufferedMatrix Matrix, int setting);  /* only before any columns are added */
+int dbm_isMemoryMapped(doubleBufferedMatrix Matrix);
+int dbm_setDirectIO(doubleBufferedMatrix Matrix, int setting);
+int dbm_isDirectIO(doubleBufferedMatrix Matrix);  /* returns 1 if the page cache is bypassed */
+int dbm_setPersistent(doubleBufferedMatrix Matrix, int setting);
+int dbm_isPersistent(doubleBufferedMatrix Matrix);  /* returns 1 if the storage files are kept when the matrix is freed */
+int dbm_Flush(doubleBufferedMatrix Matrix);
+int dbm_setTileRows(doubleBufferedMatrix Matrix, int tile_rows);  /* only before any columns are added */
+int dbm_getTileRows(doubleBufferedMatrix Matrix);  /* returns rows per block of the tiled layout, 0 if not tiled */
+int dbm_setStorageType(doubleBufferedMatrix Matrix, int type);  /* only before any columns are added */
+int dbm_getStorageType(doubleBufferedMatrix Matrix);
+int dbm_setPrefetchColumns(doubleBufferedMatrix Matrix, int ncols);
+int dbm_getPrefetchColumns(doubleBufferedMatrix Matrix);  /* returns how many columns may be read ahead of a sequential scan */
+int dbm_setWriteBehindColumns(doubleBufferedMatrix Matrix, int ncols);
+int dbm_getWriteBehindColumns(doubleBufferedMatrix Matrix);  /* returns how many evicted columns may be waiting to be written */
+int dbm_setIOThreads(doubleBufferedMatrix Matrix, int nthreads);
+int dbm_getIOThreads(doubleBufferedMatrix Matrix);  /* returns how many threads load/flush the row buffer */
+int dbm_setEvictionPolicy(doubleBufferedMatrix Matrix, int policy);
+int dbm_getEvictionPolicy(doubleBufferedMatrix Matrix);
+double dbm_getColumnHits(doubleBufferedMatrix Matrix);  /* references to columns found in the column buffer */
+double dbm_getColumnMisses(doubleBufferedMatrix Matrix);  /* references to columns loaded into the column buffer */
+void dbm_resetColumnStats(doubleBufferedMatrix Matrix);
 
 int dbm_getValueColumn(doubleBufferedMatrix Matrix, int *cols, double *value, int ncol);
 int dbm_getValueRow(doubleBufferedMatrix Matrix, int *rows, double *value, int nrows);
@@ -51,6 +108,9 @@ int dbm_setValueRow(doubleBufferedMatrix Matrix, int *rows, double *value, int n
 char *dbm_getPrefix(doubleBufferedMatrix Matrix);
 char *dbm_getDirectory(doubleBufferedMatrix Matrix);
 char *dbm_getFileName(doubleBufferedMatrix Matrix, int col);
+int dbm_setDirectories(doubleBufferedMatrix Matrix, const char **directories, int n);
+int dbm_getNumDirectories(doubleBufferedMatrix Matrix);
+char *dbm_getStripeDirectory(doubleBufferedMatrix Matrix, int which);
 
 int dbm_setDirectory(doubleBufferedMatrix Matrix, char *newdirectory);
 
@@ -82,5 +142,6 @@ void dbm_colRanges(doubleBufferedMatrix Matrix,int naflag, int finite, double *r
 
 double dbm_fileSpaceInUse(doubleBufferedMatrix Matrix);
 int dbm_memoryInUse(doubleBufferedMatrix Matrix);
+double dbm_memoryInUseBytes(doubleBufferedMatrix Matrix);
 
 #endif
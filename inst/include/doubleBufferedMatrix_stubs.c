@@ -25,6 +25,46 @@ int dbm_AddColumn(doubleBufferedMatrix Matrix){
 }
 
 
+int dbm_AddColumns(doubleBufferedMatrix Matrix, int n){
+ static int(*fun)(doubleBufferedMatrix, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, int))R_GetCCallable("BufferedMatrix","dbm_AddColumns");
+  
+  return fun(Matrix,n);
+}
+
+
+int dbm_AppendColumn(doubleBufferedMatrix Matrix, const double *values){
+ static int(*fun)(doubleBufferedMatrix, const double *) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, const double *))R_GetCCallable("BufferedMatrix","dbm_AppendColumn");
+  
+  return fun(Matrix,values);
+}
+
+
+int dbm_AdoptFiles(doubleBufferedMatrix Matrix, int cols, const char **filenames, int nfiles){
+ static int(*fun)(doubleBufferedMatrix, int, const char **, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, int, const char **, int))R_GetCCallable("BufferedMatrix","dbm_AdoptFiles");
+  
+  return fun(Matrix,cols,filenames,nfiles);
+}
+
+
+int dbm_ExportColumns(doubleBufferedMatrix Matrix, const char *filename, int type){
+ static int(*fun)(doubleBufferedMatrix, const char *, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, const char *, int))R_GetCCallable("BufferedMatrix","dbm_ExportColumns");
+  
+  return fun(Matrix,filename,type);
+}
+
+
 
 int dbm_ResizeColBuffer(doubleBufferedMatrix Matrix, int new_maxcol){
 
@@ -258,6 +298,370 @@ int dbm_getBufferRows(doubleBufferedMatrix Matrix){
 }
 
 
+int dbm_setBufferBytes(doubleBufferedMatrix Matrix, double bytes){
+
+  static int(*fun)(doubleBufferedMatrix, double) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, double))R_GetCCallable("BufferedMatrix","dbm_setBufferBytes");
+  
+  return fun(Matrix,bytes);
+}
+
+
+double dbm_getBufferBytes(doubleBufferedMatrix Matrix){
+
+  static double(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (double(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_getBufferBytes");
+  
+  return fun(Matrix);
+}
+
+
+int dbm_setSharedBuffer(doubleBufferedMatrix Matrix, int setting){
+
+  static int(*fun)(doubleBufferedMatrix, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, int))R_GetCCallable("BufferedMatrix","dbm_setSharedBuffer");
+  
+  return fun(Matrix,setting);
+}
+
+
+int dbm_isSharedBuffer(doubleBufferedMatrix Matrix){
+
+  static int(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_isSharedBuffer");
+  
+  return fun(Matrix);
+}
+
+
+int dbm_setSharedBufferBytes(double bytes){
+
+  static int(*fun)(double) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(double))R_GetCCallable("BufferedMatrix","dbm_setSharedBufferBytes");
+  
+  return fun(bytes);
+}
+
+
+double dbm_getSharedBufferBytes(void){
+
+  static double(*fun)(void) = NULL;
+  
+  if (fun == NULL)
+    fun =  (double(*)(void))R_GetCCallable("BufferedMatrix","dbm_getSharedBufferBytes");
+  
+  return fun();
+}
+
+
+double dbm_getSharedBufferInUse(void){
+
+  static double(*fun)(void) = NULL;
+  
+  if (fun == NULL)
+    fun =  (double(*)(void))R_GetCCallable("BufferedMatrix","dbm_getSharedBufferInUse");
+  
+  return fun();
+}
+
+
+
+int dbm_setMaxOpenFiles(doubleBufferedMatrix Matrix, int max_open){
+
+  static int(*fun)(doubleBufferedMatrix, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, int))R_GetCCallable("BufferedMatrix","dbm_setMaxOpenFiles");
+  
+  return fun(Matrix,max_open);
+}
+
+
+int dbm_getMaxOpenFiles(doubleBufferedMatrix Matrix){
+
+  static int(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_getMaxOpenFiles");
+  
+  return fun(Matrix);
+}
+
+
+int dbm_setColumnsPerFile(doubleBufferedMatrix Matrix, int cols_per_file){
+
+  static int(*fun)(doubleBufferedMatrix, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, int))R_GetCCallable("BufferedMatrix","dbm_setColumnsPerFile");
+  
+  return fun(Matrix,cols_per_file);
+}
+
+
+int dbm_getColumnsPerFile(doubleBufferedMatrix Matrix){
+
+  static int(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_getColumnsPerFile");
+  
+  return fun(Matrix);
+}
+
+
+int dbm_setMemoryMapped(doubleBufferedMatrix Matrix, int setting){
+
+  static int(*fun)(doubleBufferedMatrix, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, int))R_GetCCallable("BufferedMatrix","dbm_setMemoryMapped");
+  
+  return fun(Matrix,setting);
+}
+
+
+int dbm_isMemoryMapped(doubleBufferedMatrix Matrix){
+
+  static int(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_isMemoryMapped");
+  
+  return fun(Matrix);
+}
+
+
+int dbm_setDirectIO(doubleBufferedMatrix Matrix, int setting){
+
+  static int(*fun)(doubleBufferedMatrix, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, int))R_GetCCallable("BufferedMatrix","dbm_setDirectIO");
+  
+  return fun(Matrix,setting);
+}
+
+
+int dbm_isDirectIO(doubleBufferedMatrix Matrix){
+
+  static int(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_isDirectIO");
+  
+  return fun(Matrix);
+}
+
+
+int dbm_setPersistent(doubleBufferedMatrix Matrix, int setting){
+
+  static int(*fun)(doubleBufferedMatrix, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, int))R_GetCCallable("BufferedMatrix","dbm_setPersistent");
+  
+  return fun(Matrix,setting);
+}
+
+
+int dbm_isPersistent(doubleBufferedMatrix Matrix){
+
+  static int(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_isPersistent");
+  
+  return fun(Matrix);
+}
+
+
+int dbm_Flush(doubleBufferedMatrix Matrix){
+
+  static int(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_Flush");
+  
+  return fun(Matrix);
+}
+
+
+int dbm_setTileRows(doubleBufferedMatrix Matrix, int tile_rows){
+
+  static int(*fun)(doubleBufferedMatrix, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, int))R_GetCCallable("BufferedMatrix","dbm_setTileRows");
+  
+  return fun(Matrix,tile_rows);
+}
+
+
+int dbm_getTileRows(doubleBufferedMatrix Matrix){
+
+  static int(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_getTileRows");
+  
+  return fun(Matrix);
+}
+
+
+int dbm_setStorageType(doubleBufferedMatrix Matrix, int type){
+
+  static int(*fun)(doubleBufferedMatrix, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, int))R_GetCCallable("BufferedMatrix","dbm_setStorageType");
+  
+  return fun(Matrix,type);
+}
+
+
+int dbm_getStorageType(doubleBufferedMatrix Matrix){
+
+  static int(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_getStorageType");
+  
+  return fun(Matrix);
+}
+
+
+int dbm_setPrefetchColumns(doubleBufferedMatrix Matrix, int ncols){
+
+  static int(*fun)(doubleBufferedMatrix, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, int))R_GetCCallable("BufferedMatrix","dbm_setPrefetchColumns");
+  
+  return fun(Matrix,ncols);
+}
+
+
+int dbm_getPrefetchColumns(doubleBufferedMatrix Matrix){
+
+  static int(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_getPrefetchColumns");
+  
+  return fun(Matrix);
+}
+
+
+int dbm_setWriteBehindColumns(doubleBufferedMatrix Matrix, int ncols){
+
+  static int(*fun)(doubleBufferedMatrix, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, int))R_GetCCallable("BufferedMatrix","dbm_setWriteBehindColumns");
+  
+  return fun(Matrix,ncols);
+}
+
+
+int dbm_getWriteBehindColumns(doubleBufferedMatrix Matrix){
+
+  static int(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_getWriteBehindColumns");
+  
+  return fun(Matrix);
+}
+
+
+int dbm_setIOThreads(doubleBufferedMatrix Matrix, int nthreads){
+
+  static int(*fun)(doubleBufferedMatrix, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, int))R_GetCCallable("BufferedMatrix","dbm_setIOThreads");
+  
+  return fun(Matrix,nthreads);
+}
+
+
+int dbm_getIOThreads(doubleBufferedMatrix Matrix){
+
+  static int(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_getIOThreads");
+  
+  return fun(Matrix);
+}
+
+
+int dbm_setEvictionPolicy(doubleBufferedMatrix Matrix, int policy){
+
+  static int(*fun)(doubleBufferedMatrix, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, int))R_GetCCallable("BufferedMatrix","dbm_setEvictionPolicy");
+  
+  return fun(Matrix,policy);
+}
+
+
+int dbm_getEvictionPolicy(doubleBufferedMatrix Matrix){
+
+  static int(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_getEvictionPolicy");
+  
+  return fun(Matrix);
+}
+
+
+double dbm_getColumnHits(doubleBufferedMatrix Matrix){
+
+  static double(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (double(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_getColumnHits");
+  
+  return fun(Matrix);
+}
+
+
+double dbm_getColumnMisses(doubleBufferedMatrix Matrix){
+
+  static double(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (double(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_getColumnMisses");
+  
+  return fun(Matrix);
+}
+
+
+void dbm_resetColumnStats(doubleBufferedMatrix Matrix){
+
+  static void(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (void(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_resetColumnStats");
+  
+  fun(Matrix);
+}
+
+
 
 int dbm_getValueColumn(doubleBufferedMatrix Matrix, int *cols, double *value, int ncol){
 
@@ -348,6 +752,45 @@ char *dbm_getFileName(doubleBufferedMatrix Matrix, int col){
 }
 
 
+
+int dbm_setDirectories(doubleBufferedMatrix Matrix, const char **directories, int n){
+
+  static int(*fun)(doubleBufferedMatrix, const char **, int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix, const char **, int))R_GetCCallable("BufferedMatrix","dbm_setDirectories");
+  
+  return fun(Matrix,directories,n);
+
+}
+
+
+
+int dbm_getNumDirectories(doubleBufferedMatrix Matrix){
+
+  static int(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_getNumDirectories");
+  
+  return fun(Matrix);
+
+}
+
+
+
+char *dbm_getStripeDirectory(doubleBufferedMatrix Matrix, int which){
+
+  static char *(*fun)(doubleBufferedMatrix,int) = NULL;
+  
+  if (fun == NULL)
+    fun =  (char *(*)(doubleBufferedMatrix, int))R_GetCCallable("BufferedMatrix","dbm_getStripeDirectory");
+  
+  return fun(Matrix,which);
+
+}
+
+
 int dbm_copyValues(doubleBufferedMatrix Matrix_target,doubleBufferedMatrix Matrix_source){
 
  static int(*fun)(doubleBufferedMatrix,doubleBufferedMatrix) = NULL;
@@ -600,6 +1043,16 @@ int dbm_memoryInUse(doubleBufferedMatrix Matrix){
     fun =  (int(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_memoryInUse");
   
   return fun(Matrix);
+}
+
+
+double dbm_memoryInUseBytes(doubleBufferedMatrix Matrix){
+ static double(*fun)(doubleBufferedMatrix) = NULL;
+  
+  if (fun == NULL)
+    fun =  (double(*)(doubleBufferedMatrix))R_GetCCallable("BufferedMatrix","dbm_memoryInUseBytes");
+  
+  return fun(Matrix);
 
 
 
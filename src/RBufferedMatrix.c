@@ -27,6 +27,33 @@
  **  Nov 18, 2006 - Increase speed of R_bm_MakeSubmatrix
  **  Sep  9, 2006 - add R_bm_rowMedians
  ** Jan 15, 2009 - fix VECTOR_ELT/STRING_ELT issues
+ ** Oct 16, 2026 - add R_bm_setMaxOpenFiles, R_bm_getMaxOpenFiles
+ ** Oct 16, 2026 - add R_bm_setColumnsPerFile, R_bm_getColumnsPerFile. Matrices created
+ **                from an existing BufferedMatrix use the same number of columns per file
+ ** Oct 16, 2026 - add R_bm_setMemoryMapped, R_bm_isMemoryMapped
+ ** Oct 16, 2026 - add R_bm_setPrefetchColumns, R_bm_getPrefetchColumns
+ ** Oct 16, 2026 - add R_bm_setIOThreads, R_bm_getIOThreads
+ ** Oct 16, 2026 - add R_bm_setTileRows, R_bm_getTileRows. Matrices created from an existing
+ **                BufferedMatrix use the same layout
+ ** Oct 16, 2026 - add R_bm_setStorageType, R_bm_getStorageType. Matrices created from an existing
+ **                BufferedMatrix use the same storage type
+ ** Oct 16, 2026 - add R_bm_AddColumns. R_bm_colApply, R_bm_MakeSubmatrix add all their columns at once
+ ** Oct 16, 2026 - add R_bm_appendColumns
+ ** Oct 16, 2026 - values of integer and logical BufferedMatrices are returned as
+ **                integers and logicals. R_bm_as_matrix, R_bm_as_BufferedMatrix convert
+ **                these types a column at a time
+ ** Oct 16, 2026 - add R_bm_Flush, R_bm_setPersistent, R_bm_isPersistent, R_bm_AdoptFiles
+ ** Oct 16, 2026 - add R_bm_ExportColumns
+ ** Oct 16, 2026 - add R_bm_setDirectIO, R_bm_isDirectIO
+ ** Oct 16, 2026 - add R_bm_setWriteBehindColumns, R_bm_getWriteBehindColumns
+ ** Oct 16, 2026 - R_bm_Create accepts several directories to stripe the storage files over,
+ **                R_bm_getDirectory returns all of them
+ ** Oct 16, 2026 - R_bm_setNewDirectory reports an error if the files could not be moved
+ **                and can report progress while files are copied
+ ** Oct 16, 2026 - add R_bm_setEvictionPolicy, R_bm_getEvictionPolicy, R_bm_getColumnStats
+ ** Oct 16, 2026 - add R_bm_setBufferBytes, R_bm_getBufferBytes. R_bm_memoryInUse returns a double
+ ** Oct 16, 2026 - add R_bm_setSharedBuffer, R_bm_isSharedBuffer, R_bm_setSharedBufferBytes, R_bm_getSharedBufferBytes
+ ** Oct 16, 2026 - R_bm_memoryInUse uses dbm_memoryInUseBytes
  **
  *****************************************************/
 
@@ -51,7 +78,7 @@ SEXP R_bm_Destroy(SEXP R_BufferedMatrix);
  ** This is the Finalizer function that is called 
  ** when the object is deleted on gc() or when R quits.
  ** It deallocates everything and deletes all the 
- ** temporary files etc
+ ** temporary files etc (unless the matrix is persistent)
  **
  *****************************************************/
 
@@ -100,12 +127,65 @@ static int checkBufferedMatrix(SEXP R_BufferedMatrix){
 }
 
 
+/*****************************************************
+ **
+ ** Integer and logical BufferedMatrices
+ **
+ ** The buffers always hold doubles. For a matrix stored
+ ** as integers or logicals (see dbm_setStorageType) values 
+ ** are given back to R as that type.
+ **
+ *****************************************************/
+
+/* the R type of the values of the matrix */
+
+static SEXPTYPE R_bm_ValueType(doubleBufferedMatrix Matrix){
+
+  switch (dbm_getStorageType(Matrix)){
+  case DBM_STORAGE_INT32:
+    return INTSXP;
+  case DBM_STORAGE_LOGICAL:
+    return LGLSXP;
+  }
+  return REALSXP;
+}
+
+/* converts a double from the buffers as as.integer() or as.logical() would */
+
+static int R_bm_DoubleToInteger(double value, SEXPTYPE type){
+
+  if (ISNAN(value)){
+    return NA_INTEGER;
+  }
+  if (type == LGLSXP){
+    return (value != 0.0);
+  }
+  if (value >= 2147483648.0 || value <= -2147483648.0){
+    return NA_INTEGER;
+  }
+  return (int)value;
+}
+
+/* converts a REALSXP result to the type of the matrix. Should be called while values is protected */
+
+static SEXP R_bm_AsValueType(doubleBufferedMatrix Matrix, SEXP values){
+
+  SEXPTYPE type = R_bm_ValueType(Matrix);
+
+  if (type == REALSXP){
+    return values;
+  }
+  return coerceVector(values,type);
+}
+
+
 /*****************************************************
  **
  ** SEXP R_bm_Create(SEXP R_prefix, SEXP R_directory, SEXP R_max_rows, SEXP R_max_cols)
  **
  ** SEXP R_prefix - a character string to be used for start of any temporary files created
  ** SEXP R_directory - a character string giving the path where temporary files should be stored
+ **                    (or several, to spread the files over them, see dbm_setDirectories)
  ** SEXP R_max_rows, R_max_cols - buffer size 
  **
  ** Creates a Buffered Matrix object and returns a pointer to
@@ -122,6 +202,7 @@ SEXP R_bm_Create(SEXP R_prefix, SEXP R_directory, SEXP R_max_rows, SEXP R_max_co
 
   const char *prefix = CHAR(STRING_ELT(R_prefix,0));
   const char *directory = CHAR(STRING_ELT(R_directory,0));
+  const char **directories;
 
   double max_rows = asReal(R_max_rows);
   double max_cols = asReal(R_max_cols);
@@ -129,11 +210,21 @@ SEXP R_bm_Create(SEXP R_prefix, SEXP R_directory, SEXP R_max_rows, SEXP R_max_co
   SEXP val;
   SEXP tag;
 
+  int i;
 
   doubleBufferedMatrix Matrix;
 
   Matrix = dbm_alloc(max_rows,max_cols,prefix,directory);
 
+  if (length(R_directory) > 1){
+    directories = Calloc(length(R_directory),const char *);
+    for (i=0; i < length(R_directory); i++){
+      directories[i] = CHAR(STRING_ELT(R_directory,i));
+    }
+    dbm_setDirectories(Matrix,directories,length(R_directory));
+    Free(directories);
+  }
+
   PROTECT(tag = allocVector(STRSXP,1));
 
   SET_STRING_ELT(tag,0,mkChar("RBufferedMatrix"));
@@ -355,33 +446,1214 @@ SEXP R_bm_AddColumn(SEXP R_BufferedMatrix){
   }
 
   
-  dbm_AddColumn(Matrix);
+  dbm_AddColumn(Matrix);
+
+  return R_BufferedMatrix;
+  
+
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_AddColumns(SEXP R_BufferedMatrix, SEXP R_n)
+ ** 
+ ** SEXP R_BufferedMatrix
+ ** SEXP R_n - number of columns to add
+ **
+ ** Adds R_n additional columns (of zeros) to the matrix
+ **
+ ** RETURNS pointer to the BufferedMatrix
+ ** 
+ **
+ *****************************************************/
+
+SEXP R_bm_AddColumns(SEXP R_BufferedMatrix, SEXP R_n){
+
+
+  doubleBufferedMatrix Matrix;
+  
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_AddColumns");
+  }
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  if (dbm_AddColumns(Matrix,asInteger(R_n))){
+    error("Could not add columns to the BufferedMatrix");
+  }
+
+  return R_BufferedMatrix;
+  
+
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_appendColumns(SEXP R_BufferedMatrix, SEXP values)
+ ** 
+ ** SEXP R_BufferedMatrix
+ ** SEXP values - a numeric, integer or logical matrix (or vector) 
+ **               with as many rows as the BufferedMatrix
+ **
+ ** Adds the columns of values to the matrix, each written
+ ** once (see dbm_AppendColumn)
+ **
+ ** RETURNS pointer to the BufferedMatrix
+ ** 
+ **
+ *****************************************************/
+
+SEXP R_bm_appendColumns(SEXP R_BufferedMatrix, SEXP values){
+
+  doubleBufferedMatrix Matrix;
+  int rows, ncols;
+  int i, j;
+  double *column;
+  
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_appendColumns");
+  }
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  rows = dbm_getRows(Matrix);
+  if (rows == 0 || length(values) % rows != 0){
+    error("Number of values must be a multiple of the number of rows");
+  }
+  ncols = length(values)/rows;
+
+  if (isReal(values)){
+    for (j=0; j < ncols; j++){
+      if (dbm_AppendColumn(Matrix,&REAL(values)[(R_xlen_t)j*rows])){
+	error("Could not append column to the BufferedMatrix");
+      }
+    }
+  } else if (isInteger(values) || isLogical(values)){
+    /* NA_INTEGER is NA_LOGICAL */
+    column = Calloc(rows,double);
+    for (j=0; j < ncols; j++){
+      for (i=0; i < rows; i++){
+	column[i] = (INTEGER(values)[(R_xlen_t)j*rows + i] == NA_INTEGER) ? R_NaReal : (double)INTEGER(values)[(R_xlen_t)j*rows + i];
+      }
+      if (dbm_AppendColumn(Matrix,column)){
+	Free(column);
+	error("Could not append column to the BufferedMatrix");
+      }
+    }
+    Free(column);
+  } else {
+    error("Can only append numeric or logical values");
+  }
+
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_ResizeBuffer(SEXP R_BufferedMatrix, SEXP R_new_maxrow, SEXP R_new_maxcol)
+ ** 
+ ** SEXP R_BufferedMatrix
+ ** SEXP R_new_maxrow,R_new_maxcol - buffer dimensions
+ **
+ ** Resizes the buffers
+ **
+ ** RETURNS a pointer to the BufferedMatrix
+ **
+ *****************************************************/
+
+SEXP R_bm_ResizeBuffer(SEXP R_BufferedMatrix, SEXP R_new_maxrow, SEXP R_new_maxcol){
+  
+  doubleBufferedMatrix Matrix;
+  int new_maxrow, new_maxcol;
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_ResizeBuffer");
+  }
+  
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  new_maxrow = asInteger(R_new_maxrow);
+  new_maxcol = asInteger(R_new_maxcol);
+
+  dbm_ResizeBuffer(Matrix, new_maxrow, new_maxcol);
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_setBufferBytes(SEXP R_BufferedMatrix, SEXP R_bytes)
+ ** 
+ ** SEXP R_BufferedMatrix
+ ** SEXP R_bytes - memory budget for the buffers, 0 for none
+ **
+ ** Sizes the buffers to fit the memory budget
+ **
+ ** RETURNS a pointer to the BufferedMatrix
+ **
+ *****************************************************/
+
+SEXP R_bm_setBufferBytes(SEXP R_BufferedMatrix, SEXP R_bytes){
+  
+  doubleBufferedMatrix Matrix;
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_setBufferBytes");
+  }
+  
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  if (dbm_setBufferBytes(Matrix, asReal(R_bytes))){
+    error("Problem changing the memory budget of the buffers (it should be non-negative)");
+  }
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_getBufferBytes(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** RETURNS the memory budget for the buffers, 0 if there is none
+ **
+ *****************************************************/
+
+SEXP R_bm_getBufferBytes(SEXP R_BufferedMatrix){
+
+  SEXP returnvalue;
+  doubleBufferedMatrix Matrix;
+  
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_getBufferBytes");
+  }
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  PROTECT(returnvalue=allocVector(REALSXP,1));
+
+  if (Matrix == NULL){ 
+    NUMERIC_POINTER(returnvalue)[0] = 0.0;
+    UNPROTECT(1);
+    return returnvalue;
+  }
+  
+  NUMERIC_POINTER(returnvalue)[0] = dbm_getBufferBytes(Matrix);
+  UNPROTECT(1);
+  return returnvalue;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_setSharedBuffer(SEXP R_BufferedMatrix, SEXP R_setting)
+ ** 
+ ** SEXP R_BufferedMatrix
+ ** SEXP R_setting - if TRUE the column buffer is sized from the shared buffer pool
+ **
+ *****************************************************/
+
+SEXP R_bm_setSharedBuffer(SEXP R_BufferedMatrix, SEXP R_setting){
+  
+  doubleBufferedMatrix Matrix;
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_setSharedBuffer");
+  }
+  
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  dbm_setSharedBuffer(Matrix, asLogical(R_setting));
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_isSharedBuffer(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** returns TRUE if the matrix uses the shared buffer pool, FALSE otherwise
+ **
+ *****************************************************/
+
+SEXP R_bm_isSharedBuffer(SEXP R_BufferedMatrix){
+
+  SEXP returnvalue;
+  doubleBufferedMatrix Matrix;
+  
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_isSharedBuffer");
+  }
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  PROTECT(returnvalue=allocVector(LGLSXP,1));
+
+  if (Matrix == NULL){ 
+    LOGICAL(returnvalue)[0] = 0;
+    UNPROTECT(1);
+    return returnvalue;
+  }
+  
+  LOGICAL(returnvalue)[0] = dbm_isSharedBuffer(Matrix);
+  UNPROTECT(1);
+  return returnvalue;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_setSharedBufferBytes(SEXP R_bytes)
+ ** 
+ ** SEXP R_bytes - memory budget for the shared buffer pool, 0 for none
+ **
+ ** RETURNS the budget
+ **
+ *****************************************************/
+
+SEXP R_bm_setSharedBufferBytes(SEXP R_bytes){
+
+  if (dbm_setSharedBufferBytes(asReal(R_bytes))){
+    error("Problem changing the memory budget of the shared buffer pool (it should be non-negative)");
+  }
+  return R_bytes;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_getSharedBufferBytes(void)
+ **
+ ** RETURNS the memory budget of the shared buffer pool and
+ ** the memory used by the buffers of the matrices using it
+ **
+ *****************************************************/
+
+SEXP R_bm_getSharedBufferBytes(void){
+
+  SEXP returnvalue;
+
+  PROTECT(returnvalue=allocVector(REALSXP,2));
+
+  NUMERIC_POINTER(returnvalue)[0] = dbm_getSharedBufferBytes();
+  NUMERIC_POINTER(returnvalue)[1] = dbm_getSharedBufferInUse();
+  UNPROTECT(1);
+  return returnvalue;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_RowMode(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** turns the row buffer on
+ **
+ ** RETURNS a pointer to the BufferedMatrix
+ **
+ *****************************************************/
+
+SEXP R_bm_RowMode(SEXP R_BufferedMatrix){
+  
+  doubleBufferedMatrix Matrix;  
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_RowMode");
+  }
+ 
+    
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+  dbm_RowMode(Matrix);
+  
+  return R_BufferedMatrix;
+
+}
+
+
+/*****************************************************
+ **
+ ** SEXP R_bm_ColMode(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** turns the row buffer off
+ **
+ ** RETURNS a pointer to the BufferedMatrix
+ **
+ *****************************************************/
+
+SEXP R_bm_ColMode(SEXP R_BufferedMatrix){
+  
+  doubleBufferedMatrix Matrix;  
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_ColMode");
+  }
+ 
+    
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+  dbm_ColMode(Matrix);
+  
+  return R_BufferedMatrix;
+
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_SetPrefix(SEXP R_BufferedMatrix, SEXP R_Prefix)
+ **
+ ** SEXP R_BufferedMatrix
+ ** SEXP R_Prefix - string to use for the prefix
+ **
+ ** Sets the prefix (ie string at the beginning) of any temporary 
+ ** files created. Note that changing the prefix has no effect on
+ ** temporary files already created
+ **
+ ** RETURNS a pointer to the BufferedMatrix
+ **
+ *****************************************************/
+
+
+SEXP R_bm_SetPrefix(SEXP R_BufferedMatrix, SEXP R_Prefix){
+
+  
+  doubleBufferedMatrix Matrix;
+  const char *prefix = CHAR(STRING_ELT(R_Prefix,0));
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_SetPrefix");
+  }
+ 
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+  
+  dbm_SetPrefix(Matrix,prefix);
+  
+
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_ReadOnlyModeToggle(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** Changes the Mode from or to ReadOnly mode.
+ ** It flips the state from one to the other
+ **
+ ** RETURNS a pointer to the BufferedMatrix
+ **
+ **
+ *****************************************************/
+
+SEXP R_bm_ReadOnlyModeToggle(SEXP R_BufferedMatrix){
+
+
+  doubleBufferedMatrix Matrix;
+  int current_mode;
+  
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_ReadOnlyModeToggle");
+  }
+ 
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+  
+  current_mode = dbm_isReadOnlyMode(Matrix);
+
+  dbm_ReadOnlyMode(Matrix,!current_mode);
+    
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_isReadOnlyMode(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** RETURNS TRUE if in ReadOnlyMode (ie can't set values)
+ **         FALSE otherwise
+ **
+ **
+ *****************************************************/
+
+
+
+SEXP R_bm_isReadOnlyMode(SEXP R_BufferedMatrix){
+
+  SEXP returnvalue;
+
+  doubleBufferedMatrix Matrix;
+  int current_mode=0;
+ 
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_isReadOnlyMode");
+  }
+
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    PROTECT(returnvalue=allocVector(LGLSXP,1));
+    LOGICAL(returnvalue)[0] = current_mode;
+    UNPROTECT(1);
+    return returnvalue;
+  }
+  
+  current_mode = dbm_isReadOnlyMode(Matrix);
+  
+  
+
+  PROTECT(returnvalue=allocVector(LGLSXP,1));
+
+  LOGICAL(returnvalue)[0] = current_mode;
+  UNPROTECT(1);
+  return returnvalue;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_isRowMode(SEXP R_BufferedMatrix)
+ ** 
+ ** SEXP R_BufferedMatrix
+ ** 
+ ** RETURNS TRUE if in RowMode (ie RowBuffer has been activated)
+ **         FALSE otherwise
+ **
+ *****************************************************/
+
+SEXP R_bm_isRowMode(SEXP R_BufferedMatrix){
+
+  SEXP returnvalue;
+
+  doubleBufferedMatrix Matrix;
+  int current_mode;
+ 
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_isRowMode");
+  }
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    PROTECT(returnvalue=allocVector(LGLSXP,1));
+    LOGICAL(returnvalue)[0] = FALSE;
+    UNPROTECT(1);
+    return returnvalue;
+  }
+  
+  current_mode = dbm_isRowMode(Matrix);
+  
+  
+
+  PROTECT(returnvalue=allocVector(LGLSXP,1));
+
+  LOGICAL(returnvalue)[0] = current_mode;
+  UNPROTECT(1);
+  return returnvalue;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_getSize(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** RETURNS the matrix dimensions as a vector of integers first
+ **         element is rows, second element is columns
+ **
+ *****************************************************/
+
+SEXP R_bm_getSize(SEXP R_BufferedMatrix){
+
+  SEXP returnvalue;
+  doubleBufferedMatrix Matrix; 
+  
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_getSize");
+  }
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  
+  PROTECT(returnvalue=allocVector(INTSXP,2));
+
+  if (Matrix == NULL){ 
+
+    INTEGER(returnvalue)[0] = 0;
+    INTEGER(returnvalue)[1] = 0;
+    UNPROTECT(1);
+    return returnvalue;
+  }
+  
+  INTEGER(returnvalue)[0] = dbm_getRows(Matrix);
+  INTEGER(returnvalue)[1] = dbm_getCols(Matrix);
+  UNPROTECT(1);
+  return returnvalue;
+
+
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_getBufferSize(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** RETURNS the buffer dimensions as a vector of integers first
+ **         element is rows, second element is columns
+ **
+ *****************************************************/
+
+SEXP R_bm_getBufferSize(SEXP R_BufferedMatrix){
+
+  SEXP returnvalue;
+  doubleBufferedMatrix Matrix;
+  
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_getBufferSize");
+  }
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  
+  PROTECT(returnvalue=allocVector(INTSXP,2));
+
+  if (Matrix == NULL){ 
+
+    INTEGER(returnvalue)[0] = 0;
+    INTEGER(returnvalue)[1] = 0;
+    UNPROTECT(1);
+    return returnvalue;
+  }
+  
+  INTEGER(returnvalue)[0] = dbm_getBufferRows(Matrix);
+  INTEGER(returnvalue)[1] = dbm_getBufferCols(Matrix);
+  UNPROTECT(1);
+  return returnvalue;
+
+
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_setMaxOpenFiles(SEXP R_BufferedMatrix, SEXP R_max_open)
+ ** 
+ ** SEXP R_BufferedMatrix
+ ** SEXP R_max_open - maximum number of files to hold open at once
+ **
+ ** Sets the limit on the number of open files
+ **
+ ** RETURNS a pointer to the BufferedMatrix
+ **
+ *****************************************************/
+
+SEXP R_bm_setMaxOpenFiles(SEXP R_BufferedMatrix, SEXP R_max_open){
+  
+  doubleBufferedMatrix Matrix;
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_setMaxOpenFiles");
+  }
+  
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  if (dbm_setMaxOpenFiles(Matrix, asInteger(R_max_open))){
+    error("Maximum number of open files should be at least 1");
+  }
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_getMaxOpenFiles(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** RETURNS the maximum number of files that may be held open at once
+ **
+ *****************************************************/
+
+SEXP R_bm_getMaxOpenFiles(SEXP R_BufferedMatrix){
+
+  SEXP returnvalue;
+  doubleBufferedMatrix Matrix;
+  
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_getMaxOpenFiles");
+  }
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  PROTECT(returnvalue=allocVector(INTSXP,1));
+
+  if (Matrix == NULL){ 
+    INTEGER(returnvalue)[0] = 0;
+    UNPROTECT(1);
+    return returnvalue;
+  }
+  
+  INTEGER(returnvalue)[0] = dbm_getMaxOpenFiles(Matrix);
+  UNPROTECT(1);
+  return returnvalue;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_setColumnsPerFile(SEXP R_BufferedMatrix, SEXP R_cols_per_file)
+ ** 
+ ** SEXP R_BufferedMatrix
+ ** SEXP R_cols_per_file - number of columns to store in each file
+ **
+ ** Sets the number of columns stored in each file. Must be 
+ ** called before any columns are added.
+ **
+ ** RETURNS a pointer to the BufferedMatrix
+ **
+ *****************************************************/
+
+SEXP R_bm_setColumnsPerFile(SEXP R_BufferedMatrix, SEXP R_cols_per_file){
+  
+  doubleBufferedMatrix Matrix;
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_setColumnsPerFile");
+  }
+  
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  if (dbm_setColumnsPerFile(Matrix, asInteger(R_cols_per_file))){
+    error("Columns per file should be at least 1 and can only be set before columns are added");
+  }
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_getColumnsPerFile(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** RETURNS the number of columns stored in each file
+ **
+ *****************************************************/
+
+SEXP R_bm_getColumnsPerFile(SEXP R_BufferedMatrix){
+
+  SEXP returnvalue;
+  doubleBufferedMatrix Matrix;
+  
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_getColumnsPerFile");
+  }
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  PROTECT(returnvalue=allocVector(INTSXP,1));
+
+  if (Matrix == NULL){ 
+    INTEGER(returnvalue)[0] = 0;
+    UNPROTECT(1);
+    return returnvalue;
+  }
+  
+  INTEGER(returnvalue)[0] = dbm_getColumnsPerFile(Matrix);
+  UNPROTECT(1);
+  return returnvalue;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_setMemoryMapped(SEXP R_BufferedMatrix, SEXP R_setting)
+ ** 
+ ** SEXP R_BufferedMatrix
+ ** SEXP R_setting - TRUE to memory map the storage files
+ **
+ ** Turns memory mapped storage on or off. Must be 
+ ** called before any columns are added.
+ **
+ ** RETURNS a pointer to the BufferedMatrix
+ **
+ *****************************************************/
+
+SEXP R_bm_setMemoryMapped(SEXP R_BufferedMatrix, SEXP R_setting){
+  
+  doubleBufferedMatrix Matrix;
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_setMemoryMapped");
+  }
+  
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  if (dbm_setMemoryMapped(Matrix, asLogical(R_setting))){
+    error("Memory mapping can only be set before columns are added and is not available on this platform");
+  }
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_isMemoryMapped(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** RETURNS TRUE if the storage files are memory mapped
+ **         FALSE otherwise
+ **
+ *****************************************************/
+
+SEXP R_bm_isMemoryMapped(SEXP R_BufferedMatrix){
+
+  SEXP returnvalue;
+  doubleBufferedMatrix Matrix;
+  
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_isMemoryMapped");
+  }
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  PROTECT(returnvalue=allocVector(LGLSXP,1));
+
+  if (Matrix == NULL){ 
+    LOGICAL(returnvalue)[0] = 0;
+    UNPROTECT(1);
+    return returnvalue;
+  }
+  
+  LOGICAL(returnvalue)[0] = dbm_isMemoryMapped(Matrix);
+  UNPROTECT(1);
+  return returnvalue;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_setDirectIO(SEXP R_BufferedMatrix, SEXP R_setting)
+ ** 
+ ** SEXP R_BufferedMatrix
+ ** SEXP R_setting - if TRUE bypass the page cache
+ **
+ *****************************************************/
+
+SEXP R_bm_setDirectIO(SEXP R_BufferedMatrix, SEXP R_setting){
+  
+  doubleBufferedMatrix Matrix;
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_setDirectIO");
+  }
+  
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  if (dbm_setDirectIO(Matrix, asLogical(R_setting))){
+    error("Direct I/O can not be used with memory mapping");
+  }
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_isDirectIO(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** returns TRUE if direct I/O is on, FALSE otherwise
+ **
+ *****************************************************/
+
+SEXP R_bm_isDirectIO(SEXP R_BufferedMatrix){
+
+  SEXP returnvalue;
+  doubleBufferedMatrix Matrix;
+  
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_isDirectIO");
+  }
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  PROTECT(returnvalue=allocVector(LGLSXP,1));
+
+  if (Matrix == NULL){ 
+    LOGICAL(returnvalue)[0] = 0;
+    UNPROTECT(1);
+    return returnvalue;
+  }
+  
+  LOGICAL(returnvalue)[0] = dbm_isDirectIO(Matrix);
+  UNPROTECT(1);
+  return returnvalue;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_setPersistent(SEXP R_BufferedMatrix, SEXP R_setting)
+ ** 
+ ** SEXP R_BufferedMatrix
+ ** SEXP R_setting - if TRUE the storage files are kept when the matrix is freed
+ **
+ *****************************************************/
+
+SEXP R_bm_setPersistent(SEXP R_BufferedMatrix, SEXP R_setting){
+  
+  doubleBufferedMatrix Matrix;
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_setPersistent");
+  }
+  
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  dbm_setPersistent(Matrix, asLogical(R_setting));
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_isPersistent(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** returns TRUE if the storage files are kept when the
+ ** matrix is freed, FALSE otherwise
+ **
+ *****************************************************/
+
+SEXP R_bm_isPersistent(SEXP R_BufferedMatrix){
+
+  SEXP returnvalue;
+  doubleBufferedMatrix Matrix;
+  
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_isPersistent");
+  }
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  PROTECT(returnvalue=allocVector(LGLSXP,1));
+
+  if (Matrix == NULL){ 
+    LOGICAL(returnvalue)[0] = 0;
+    UNPROTECT(1);
+    return returnvalue;
+  }
+  
+  LOGICAL(returnvalue)[0] = dbm_isPersistent(Matrix);
+  UNPROTECT(1);
+  return returnvalue;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_Flush(SEXP R_BufferedMatrix)
+ ** 
+ ** SEXP R_BufferedMatrix
+ **
+ ** Writes any modified buffered values to the storage files
+ **
+ *****************************************************/
+
+SEXP R_bm_Flush(SEXP R_BufferedMatrix){
+  
+  doubleBufferedMatrix Matrix;
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_Flush");
+  }
+  
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  if (dbm_Flush(Matrix)){
+    error("Could not write the buffered values to the storage files");
+  }
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_AdoptFiles(SEXP R_BufferedMatrix, SEXP R_cols, SEXP R_filenames)
+ ** 
+ ** SEXP R_BufferedMatrix - a matrix with no columns whose rows, layout and
+ **                         storage type have been set to match the files
+ ** SEXP R_cols - number of columns held in the files
+ ** SEXP R_filenames - the storage files (character vector), in order
+ **
+ *****************************************************/
+
+SEXP R_bm_AdoptFiles(SEXP R_BufferedMatrix, SEXP R_cols, SEXP R_filenames){
+  
+  doubleBufferedMatrix Matrix;
+  const char **filenames;
+  int i, nfiles, result;
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_AdoptFiles");
+  }
+  
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  nfiles = length(R_filenames);
+  filenames = Calloc(nfiles > 0 ? nfiles : 1,const char *);
+  for (i=0; i < nfiles; i++){
+    filenames[i] = CHAR(STRING_ELT(R_filenames,i));
+  }
+  result = dbm_AdoptFiles(Matrix, asInteger(R_cols), filenames, nfiles);
+  Free(filenames);
+
+  if (result){
+    error("Could not use the storage files. They may be missing, too short or not match the dimensions and layout");
+  }
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_ExportColumns(SEXP R_BufferedMatrix, SEXP R_filename, SEXP R_type)
+ ** 
+ ** SEXP R_BufferedMatrix
+ ** SEXP R_filename - the raw file to write
+ ** SEXP R_type - how values are to be stored, as for R_bm_setStorageType
+ **
+ *****************************************************/
+
+SEXP R_bm_ExportColumns(SEXP R_BufferedMatrix, SEXP R_filename, SEXP R_type){
+  
+  doubleBufferedMatrix Matrix;
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_ExportColumns");
+  }
+  
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  if (dbm_ExportColumns(Matrix, CHAR(STRING_ELT(R_filename,0)), asInteger(R_type))){
+    error("Could not write the BufferedMatrix to %s", CHAR(STRING_ELT(R_filename,0)));
+  }
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_setTileRows(SEXP R_BufferedMatrix, SEXP R_tile_rows)
+ ** 
+ ** SEXP R_BufferedMatrix
+ ** SEXP R_tile_rows - rows in each block of the tiled layout (0 for none)
+ **
+ ** Selects the layout of the storage files. Only
+ ** before any columns have been added
+ **
+ ** RETURNS a pointer to the BufferedMatrix
+ **
+ *****************************************************/
+
+SEXP R_bm_setTileRows(SEXP R_BufferedMatrix, SEXP R_tile_rows){
+  
+  doubleBufferedMatrix Matrix;
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_setTileRows");
+  }
+  
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  if (dbm_setTileRows(Matrix, asInteger(R_tile_rows))){
+    error("Tile rows should be non-negative, can only be set before columns are added and can not be used with memory mapping");
+  }
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_getTileRows(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** RETURNS the number of rows in each block of the tiled layout
+ **
+ *****************************************************/
+
+SEXP R_bm_getTileRows(SEXP R_BufferedMatrix){
+
+  SEXP returnvalue;
+  doubleBufferedMatrix Matrix;
+  
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_getTileRows");
+  }
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  PROTECT(returnvalue=allocVector(INTSXP,1));
+
+  if (Matrix == NULL){ 
+    INTEGER(returnvalue)[0] = 0;
+    UNPROTECT(1);
+    return returnvalue;
+  }
+  
+  INTEGER(returnvalue)[0] = dbm_getTileRows(Matrix);
+  UNPROTECT(1);
+  return returnvalue;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_setStorageType(SEXP R_BufferedMatrix, SEXP R_type)
+ ** 
+ ** SEXP R_BufferedMatrix
+ ** SEXP R_type - how values are stored in the files (see DBM_STORAGE_*)
+ **
+ ** Only before any columns have been added
+ **
+ ** RETURNS a pointer to the BufferedMatrix
+ **
+ *****************************************************/
+
+SEXP R_bm_setStorageType(SEXP R_BufferedMatrix, SEXP R_type){
+  
+  doubleBufferedMatrix Matrix;
+
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_setStorageType");
+  }
+  
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  if (Matrix == NULL){
+    return R_BufferedMatrix;
+  }
+
+  if (dbm_setStorageType(Matrix, asInteger(R_type))){
+    error("Storage type can only be set before columns are added and only double storage can be memory mapped");
+  }
+  return R_BufferedMatrix;
+}
+
+/*****************************************************
+ **
+ ** SEXP R_bm_getStorageType(SEXP R_BufferedMatrix)
+ **
+ ** SEXP R_BufferedMatrix
+ **
+ ** RETURNS how values are stored in the files (see DBM_STORAGE_*)
+ **
+ *****************************************************/
+
+SEXP R_bm_getStorageType(SEXP R_BufferedMatrix){
+
+  SEXP returnvalue;
+  doubleBufferedMatrix Matrix;
+  
+  if(!checkBufferedMatrix(R_BufferedMatrix)){
+    error("Invalid ExternalPointer supplied to R_bm_getStorageType");
+  }
+
+  Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
+  
+  PROTECT(returnvalue=allocVector(INTSXP,1));
 
-  return R_BufferedMatrix;
+  if (Matrix == NULL){ 
+    INTEGER(returnvalue)[0] = 0;
+    UNPROTECT(1);
+    return returnvalue;
+  }
   
-
+  INTEGER(returnvalue)[0] = dbm_getStorageType(Matrix);
+  UNPROTECT(1);
+  return returnvalue;
 }
 
 /*****************************************************
  **
- ** SEXP R_bm_ResizeBuffer(SEXP R_BufferedMatrix, SEXP R_new_maxrow, SEXP R_new_maxcol)
+ ** SEXP R_bm_setPrefetchColumns(SEXP R_BufferedMatrix, SEXP R_ncols)
  ** 
  ** SEXP R_BufferedMatrix
- ** SEXP R_new_maxrow,R_new_maxcol - buffer dimensions
+ ** SEXP R_ncols - number of columns to read ahead
  **
- ** Resizes the buffers
+ ** Sets how many columns are read in the background when
+ ** columns are accessed in order
  **
  ** RETURNS a pointer to the BufferedMatrix
  **
  *****************************************************/
 
-SEXP R_bm_ResizeBuffer(SEXP R_BufferedMatrix, SEXP R_new_maxrow, SEXP R_new_maxcol){
+SEXP R_bm_setPrefetchColumns(SEXP R_BufferedMatrix, SEXP R_ncols){
   
   doubleBufferedMatrix Matrix;
-  int new_maxrow, new_maxcol;
 
   if(!checkBufferedMatrix(R_BufferedMatrix)){
-    error("Invalid ExternalPointer supplied to R_bm_ResizeBuffer");
+    error("Invalid ExternalPointer supplied to R_bm_setPrefetchColumns");
   }
   
   Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
@@ -390,322 +1662,289 @@ SEXP R_bm_ResizeBuffer(SEXP R_BufferedMatrix, SEXP R_new_maxrow, SEXP R_new_maxc
     return R_BufferedMatrix;
   }
 
-  new_maxrow = asInteger(R_new_maxrow);
-  new_maxcol = asInteger(R_new_maxcol);
-
-  dbm_ResizeBuffer(Matrix, new_maxrow, new_maxcol);
+  if (dbm_setPrefetchColumns(Matrix, asInteger(R_ncols))){
+    error("Number of columns to prefetch should be non-negative");
+  }
   return R_BufferedMatrix;
 }
 
 /*****************************************************
  **
- ** SEXP R_bm_RowMode(SEXP R_BufferedMatrix)
+ ** SEXP R_bm_getPrefetchColumns(SEXP R_BufferedMatrix)
  **
  ** SEXP R_BufferedMatrix
  **
- ** turns the row buffer on
- **
- ** RETURNS a pointer to the BufferedMatrix
+ ** RETURNS the number of columns that may be read ahead
  **
  *****************************************************/
 
-SEXP R_bm_RowMode(SEXP R_BufferedMatrix){
-  
-  doubleBufferedMatrix Matrix;  
+SEXP R_bm_getPrefetchColumns(SEXP R_BufferedMatrix){
 
+  SEXP returnvalue;
+  doubleBufferedMatrix Matrix;
+  
   if(!checkBufferedMatrix(R_BufferedMatrix)){
-    error("Invalid ExternalPointer supplied to R_bm_RowMode");
+    error("Invalid ExternalPointer supplied to R_bm_getPrefetchColumns");
   }
- 
-    
+
   Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
   
-  if (Matrix == NULL){
-    return R_BufferedMatrix;
+  PROTECT(returnvalue=allocVector(INTSXP,1));
+
+  if (Matrix == NULL){ 
+    INTEGER(returnvalue)[0] = 0;
+    UNPROTECT(1);
+    return returnvalue;
   }
-  dbm_RowMode(Matrix);
   
-  return R_BufferedMatrix;
-
+  INTEGER(returnvalue)[0] = dbm_getPrefetchColumns(Matrix);
+  UNPROTECT(1);
+  return returnvalue;
 }
 
-
 /*****************************************************
  **
- ** SEXP R_bm_ColMode(SEXP R_BufferedMatrix)
- **
+ ** SEXP R_bm_setWriteBehindColumns(SEXP R_BufferedMatrix, SEXP R_ncols)
+ ** 
  ** SEXP R_BufferedMatrix
+ ** SEXP R_ncols - number of columns that may wait to be written
  **
- ** turns the row buffer off
+ ** Sets how many modified columns leaving the column buffer
+ ** may be waiting to be written in the background
  **
  ** RETURNS a pointer to the BufferedMatrix
  **
  *****************************************************/
 
-SEXP R_bm_ColMode(SEXP R_BufferedMatrix){
+SEXP R_bm_setWriteBehindColumns(SEXP R_BufferedMatrix, SEXP R_ncols){
   
-  doubleBufferedMatrix Matrix;  
+  doubleBufferedMatrix Matrix;
 
   if(!checkBufferedMatrix(R_BufferedMatrix)){
-    error("Invalid ExternalPointer supplied to R_bm_ColMode");
+    error("Invalid ExternalPointer supplied to R_bm_setWriteBehindColumns");
   }
- 
-    
+  
   Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
   
   if (Matrix == NULL){
     return R_BufferedMatrix;
   }
-  dbm_ColMode(Matrix);
-  
-  return R_BufferedMatrix;
 
+  if (dbm_setWriteBehindColumns(Matrix, asInteger(R_ncols))){
+    error("Problem changing the number of write-behind columns (it should be non-negative)");
+  }
+  return R_BufferedMatrix;
 }
 
 /*****************************************************
  **
- ** SEXP R_bm_SetPrefix(SEXP R_BufferedMatrix, SEXP R_Prefix)
+ ** SEXP R_bm_getWriteBehindColumns(SEXP R_BufferedMatrix)
  **
  ** SEXP R_BufferedMatrix
- ** SEXP R_Prefix - string to use for the prefix
- **
- ** Sets the prefix (ie string at the beginning) of any temporary 
- ** files created. Note that changing the prefix has no effect on
- ** temporary files already created
  **
- ** RETURNS a pointer to the BufferedMatrix
+ ** RETURNS the number of columns that may be waiting to be written
  **
  *****************************************************/
 
+SEXP R_bm_getWriteBehindColumns(SEXP R_BufferedMatrix){
 
-SEXP R_bm_SetPrefix(SEXP R_BufferedMatrix, SEXP R_Prefix){
-
-  
+  SEXP returnvalue;
   doubleBufferedMatrix Matrix;
-  const char *prefix = CHAR(STRING_ELT(R_Prefix,0));
-
+  
   if(!checkBufferedMatrix(R_BufferedMatrix)){
-    error("Invalid ExternalPointer supplied to R_bm_SetPrefix");
+    error("Invalid ExternalPointer supplied to R_bm_getWriteBehindColumns");
   }
- 
+
   Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
   
-  if (Matrix == NULL){
-    return R_BufferedMatrix;
+  PROTECT(returnvalue=allocVector(INTSXP,1));
+
+  if (Matrix == NULL){ 
+    INTEGER(returnvalue)[0] = 0;
+    UNPROTECT(1);
+    return returnvalue;
   }
   
-  dbm_SetPrefix(Matrix,prefix);
-  
-
-  return R_BufferedMatrix;
+  INTEGER(returnvalue)[0] = dbm_getWriteBehindColumns(Matrix);
+  UNPROTECT(1);
+  return returnvalue;
 }
 
 /*****************************************************
  **
- ** SEXP R_bm_ReadOnlyModeToggle(SEXP R_BufferedMatrix)
- **
+ ** SEXP R_bm_setIOThreads(SEXP R_BufferedMatrix, SEXP R_nthreads)
+ ** 
  ** SEXP R_BufferedMatrix
+ ** SEXP R_nthreads - number of threads
  **
- ** Changes the Mode from or to ReadOnly mode.
- ** It flips the state from one to the other
+ ** Sets how many threads are used when loading or 
+ ** flushing the row buffer
  **
  ** RETURNS a pointer to the BufferedMatrix
  **
- **
  *****************************************************/
 
-SEXP R_bm_ReadOnlyModeToggle(SEXP R_BufferedMatrix){
-
-
-  doubleBufferedMatrix Matrix;
-  int current_mode;
+SEXP R_bm_setIOThreads(SEXP R_BufferedMatrix, SEXP R_nthreads){
   
+  doubleBufferedMatrix Matrix;
+
   if(!checkBufferedMatrix(R_BufferedMatrix)){
-    error("Invalid ExternalPointer supplied to R_bm_ReadOnlyModeToggle");
+    error("Invalid ExternalPointer supplied to R_bm_setIOThreads");
   }
- 
-
+  
   Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
   
   if (Matrix == NULL){
     return R_BufferedMatrix;
   }
-  
-  current_mode = dbm_isReadOnlyMode(Matrix);
 
-  dbm_ReadOnlyMode(Matrix,!current_mode);
-    
+  if (dbm_setIOThreads(Matrix, asInteger(R_nthreads))){
+    error("Number of I/O threads should be at least 1");
+  }
   return R_BufferedMatrix;
 }
 
 /*****************************************************
  **
- ** SEXP R_bm_isReadOnlyMode(SEXP R_BufferedMatrix)
+ ** SEXP R_bm_getIOThreads(SEXP R_BufferedMatrix)
  **
  ** SEXP R_BufferedMatrix
  **
- ** RETURNS TRUE if in ReadOnlyMode (ie can't set values)
- **         FALSE otherwise
- **
+ ** RETURNS the number of threads used for row buffer I/O
  **
  *****************************************************/
 
-
-
-SEXP R_bm_isReadOnlyMode(SEXP R_BufferedMatrix){
+SEXP R_bm_getIOThreads(SEXP R_BufferedMatrix){
 
   SEXP returnvalue;
-
   doubleBufferedMatrix Matrix;
-  int current_mode=0;
- 
+  
   if(!checkBufferedMatrix(R_BufferedMatrix)){
-    error("Invalid ExternalPointer supplied to R_bm_isReadOnlyMode");
+    error("Invalid ExternalPointer supplied to R_bm_getIOThreads");
   }
 
-
   Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
   
-  if (Matrix == NULL){
-    PROTECT(returnvalue=allocVector(LGLSXP,1));
-    LOGICAL(returnvalue)[0] = current_mode;
+  PROTECT(returnvalue=allocVector(INTSXP,1));
+
+  if (Matrix == NULL){ 
+    INTEGER(returnvalue)[0] = 0;
     UNPROTECT(1);
     return returnvalue;
   }
   
-  current_mode = dbm_isReadOnlyMode(Matrix);
-  
-  
-
-  PROTECT(returnvalue=allocVector(LGLSXP,1));
-
-  LOGICAL(returnvalue)[0] = current_mode;
+  INTEGER(returnvalue)[0] = dbm_getIOThreads(Matrix);
   UNPROTECT(1);
   return returnvalue;
 }
 
 /*****************************************************
  **
- ** SEXP R_bm_isRowMode(SEXP R_BufferedMatrix)
+ ** SEXP R_bm_setEvictionPolicy(SEXP R_BufferedMatrix, SEXP R_policy)
  ** 
  ** SEXP R_BufferedMatrix
- ** 
- ** RETURNS TRUE if in RowMode (ie RowBuffer has been activated)
- **         FALSE otherwise
+ ** SEXP R_policy - one of DBM_EVICT_*
+ **
+ ** Sets which column leaves the column buffer when
+ ** another column is needed
+ **
+ ** RETURNS a pointer to the BufferedMatrix
  **
  *****************************************************/
 
-SEXP R_bm_isRowMode(SEXP R_BufferedMatrix){
-
-  SEXP returnvalue;
-
+SEXP R_bm_setEvictionPolicy(SEXP R_BufferedMatrix, SEXP R_policy){
+  
   doubleBufferedMatrix Matrix;
-  int current_mode;
- 
+
   if(!checkBufferedMatrix(R_BufferedMatrix)){
-    error("Invalid ExternalPointer supplied to R_bm_isRowMode");
+    error("Invalid ExternalPointer supplied to R_bm_setEvictionPolicy");
   }
-
+  
   Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
   
   if (Matrix == NULL){
-    PROTECT(returnvalue=allocVector(LGLSXP,1));
-    LOGICAL(returnvalue)[0] = FALSE;
-    UNPROTECT(1);
-    return returnvalue;
+    return R_BufferedMatrix;
   }
-  
-  current_mode = dbm_isRowMode(Matrix);
-  
-  
-
-  PROTECT(returnvalue=allocVector(LGLSXP,1));
 
-  LOGICAL(returnvalue)[0] = current_mode;
-  UNPROTECT(1);
-  return returnvalue;
+  if (dbm_setEvictionPolicy(Matrix, asInteger(R_policy))){
+    error("Problem changing the eviction policy");
+  }
+  return R_BufferedMatrix;
 }
 
 /*****************************************************
  **
- ** SEXP R_bm_getSize(SEXP R_BufferedMatrix)
+ ** SEXP R_bm_getEvictionPolicy(SEXP R_BufferedMatrix)
  **
  ** SEXP R_BufferedMatrix
  **
- ** RETURNS the matrix dimensions as a vector of integers first
- **         element is rows, second element is columns
+ ** RETURNS the eviction policy of the column buffer
  **
  *****************************************************/
 
-SEXP R_bm_getSize(SEXP R_BufferedMatrix){
+SEXP R_bm_getEvictionPolicy(SEXP R_BufferedMatrix){
 
   SEXP returnvalue;
-  doubleBufferedMatrix Matrix; 
+  doubleBufferedMatrix Matrix;
   
   if(!checkBufferedMatrix(R_BufferedMatrix)){
-    error("Invalid ExternalPointer supplied to R_bm_getSize");
+    error("Invalid ExternalPointer supplied to R_bm_getEvictionPolicy");
   }
 
   Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
   
-  
-  PROTECT(returnvalue=allocVector(INTSXP,2));
+  PROTECT(returnvalue=allocVector(INTSXP,1));
 
   if (Matrix == NULL){ 
-
-    INTEGER(returnvalue)[0] = 0;
-    INTEGER(returnvalue)[1] = 0;
+    INTEGER(returnvalue)[0] = DBM_EVICT_LRU;
     UNPROTECT(1);
     return returnvalue;
   }
   
-  INTEGER(returnvalue)[0] = dbm_getRows(Matrix);
-  INTEGER(returnvalue)[1] = dbm_getCols(Matrix);
+  INTEGER(returnvalue)[0] = dbm_getEvictionPolicy(Matrix);
   UNPROTECT(1);
   return returnvalue;
-
-
 }
 
 /*****************************************************
  **
- ** SEXP R_bm_getBufferSize(SEXP R_BufferedMatrix)
+ ** SEXP R_bm_getColumnStats(SEXP R_BufferedMatrix, SEXP R_reset)
  **
  ** SEXP R_BufferedMatrix
+ ** SEXP R_reset - if true the counts start again from zero
  **
- ** RETURNS the buffer dimensions as a vector of integers first
- **         element is rows, second element is columns
+ ** RETURNS the number of hits and misses of the column 
+ **         buffer as a vector of two doubles
  **
  *****************************************************/
 
-SEXP R_bm_getBufferSize(SEXP R_BufferedMatrix){
+SEXP R_bm_getColumnStats(SEXP R_BufferedMatrix, SEXP R_reset){
 
   SEXP returnvalue;
   doubleBufferedMatrix Matrix;
   
   if(!checkBufferedMatrix(R_BufferedMatrix)){
-    error("Invalid ExternalPointer supplied to R_bm_getBufferSize");
+    error("Invalid ExternalPointer supplied to R_bm_getColumnStats");
   }
 
   Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
   
-  
-  PROTECT(returnvalue=allocVector(INTSXP,2));
+  PROTECT(returnvalue=allocVector(REALSXP,2));
 
   if (Matrix == NULL){ 
-
-    INTEGER(returnvalue)[0] = 0;
-    INTEGER(returnvalue)[1] = 0;
+    NUMERIC_POINTER(returnvalue)[0] = 0.0;
+    NUMERIC_POINTER(returnvalue)[1] = 0.0;
     UNPROTECT(1);
     return returnvalue;
   }
   
-  INTEGER(returnvalue)[0] = dbm_getBufferRows(Matrix);
-  INTEGER(returnvalue)[1] = dbm_getBufferCols(Matrix);
+  NUMERIC_POINTER(returnvalue)[0] = dbm_getColumnHits(Matrix);
+  NUMERIC_POINTER(returnvalue)[1] = dbm_getColumnMisses(Matrix);
+  if (asLogical(R_reset)){
+    dbm_resetColumnStats(Matrix);
+  }
   UNPROTECT(1);
   return returnvalue;
-
-
 }
 
 /*****************************************************
@@ -744,6 +1983,7 @@ SEXP R_bm_getValue(SEXP R_BufferedMatrix, SEXP R_row, SEXP R_col){
     REAL(returnvalue)[0] = R_NaReal;
   }
 
+  returnvalue = R_bm_AsValueType(Matrix,returnvalue);
   UNPROTECT(1);
   return returnvalue;
 
@@ -849,6 +2089,7 @@ SEXP R_bm_getValueColumn(SEXP R_BufferedMatrix, SEXP R_col){
     }
   }
   
+  returnvalue = R_bm_AsValueType(Matrix,returnvalue);
   UNPROTECT(1);
   return returnvalue;
 
@@ -904,6 +2145,7 @@ SEXP R_bm_getValueRow(SEXP R_BufferedMatrix, SEXP R_row){
   }
 
 
+  returnvalue = R_bm_AsValueType(Matrix,returnvalue);
   UNPROTECT(1);
   return returnvalue;
 
@@ -962,6 +2204,7 @@ SEXP R_bm_getValueSubmatrix(SEXP R_BufferedMatrix, SEXP R_row, SEXP R_col){
       }
     }
   }
+  returnvalue = R_bm_AsValueType(Matrix,returnvalue);
   UNPROTECT(1); 
   return returnvalue;
 
@@ -1161,7 +2404,7 @@ SEXP R_bm_getDirectory(SEXP R_BufferedMatrix){
   doubleBufferedMatrix Matrix;
 
   char *directory;
-
+  int i;
   
   Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
   
@@ -1169,17 +2412,15 @@ SEXP R_bm_getDirectory(SEXP R_BufferedMatrix){
     return R_BufferedMatrix;
   }
 
+  /* all the directories when the files are striped over several */
+  PROTECT(returnvalue = allocVector(STRSXP,dbm_getNumDirectories(Matrix)));
 
-  directory = dbm_getDirectory(Matrix);
-
-  PROTECT(returnvalue = allocVector(STRSXP,1));
-
-  SET_STRING_ELT(returnvalue,0,mkChar(directory));
-
-  
-
+  for (i=0; i < dbm_getNumDirectories(Matrix); i++){
+    directory = dbm_getStripeDirectory(Matrix,i);
+    SET_STRING_ELT(returnvalue,i,mkChar(directory));
+    Free(directory);
+  }
 
-  Free(directory);
   UNPROTECT(1);
   return returnvalue;
 
@@ -1989,12 +3230,14 @@ SEXP R_bm_colApply(SEXP R_BufferedMatrix, SEXP return_dim, SEXP Rfn, SEXP rho){
 				 buffsize,
 				 buffsize
 				 ));
+    dbm_setColumnsPerFile(R_ExternalPtrAddr(result),dbm_getColumnsPerFile(Matrix));
+    dbm_setMemoryMapped(R_ExternalPtrAddr(result),dbm_isMemoryMapped(Matrix));
+    dbm_setTileRows(R_ExternalPtrAddr(result),dbm_getTileRows(Matrix));
+    dbm_setStorageType(R_ExternalPtrAddr(result),dbm_getStorageType(Matrix));
 
     R_bm_setRows(result,return_dim);
 
-    for (j=0; j < dbm_getCols(Matrix); j++){
-      R_bm_AddColumn(result);
-    }
+    dbm_AddColumns(R_ExternalPtrAddr(result),dbm_getCols(Matrix));
 
 
   }
@@ -2091,6 +3334,10 @@ SEXP R_bm_rowApply(SEXP R_BufferedMatrix, SEXP return_dim, SEXP Rfn, SEXP rho){
 				 buffsize,
 				 buffsize
 				 ));
+    dbm_setColumnsPerFile(R_ExternalPtrAddr(result),dbm_getColumnsPerFile(Matrix));
+    dbm_setMemoryMapped(R_ExternalPtrAddr(result),dbm_isMemoryMapped(Matrix));
+    dbm_setTileRows(R_ExternalPtrAddr(result),dbm_getTileRows(Matrix));
+    dbm_setStorageType(R_ExternalPtrAddr(result),dbm_getStorageType(Matrix));
 
     R_bm_setRows(result,return_dim);
 
@@ -2150,7 +3397,9 @@ SEXP R_bm_as_matrix(SEXP R_BufferedMatrix){
   doubleBufferedMatrix Matrix;
 
   int rows, cols;
-  int j;
+  int i, j;
+  double *column;
+  SEXPTYPE type;
 
   SEXP RMatrix;
 
@@ -2166,10 +3415,23 @@ SEXP R_bm_as_matrix(SEXP R_BufferedMatrix){
   cols = dbm_getCols(Matrix);
 
 
-  PROTECT(RMatrix = allocMatrix(REALSXP,rows,cols));
+  type = R_bm_ValueType(Matrix);
 
-  for (j=0; j < cols; j++){
-    dbm_getValueColumn(Matrix, &j, &REAL(RMatrix)[j*rows],1);
+  PROTECT(RMatrix = allocMatrix(type,rows,cols));
+
+  if (type == REALSXP){
+    for (j=0; j < cols; j++){
+      dbm_getValueColumn(Matrix, &j, &REAL(RMatrix)[j*rows],1);
+    }
+  } else {
+    column = Calloc(rows,double);
+    for (j=0; j < cols; j++){
+      dbm_getValueColumn(Matrix, &j, column,1);
+      for (i=0; i < rows; i++){
+	INTEGER(RMatrix)[(R_xlen_t)j*rows + i] = R_bm_DoubleToInteger(column[i],type);
+      }
+    }
+    Free(column);
   }
 
 
@@ -2271,6 +3533,12 @@ SEXP R_bm_MakeSubmatrix(SEXP R_BufferedMatrix, SEXP R_row, SEXP R_col){
   PROTECT(returnvalue=R_bm_Create(R_bm_getPrefix(R_BufferedMatrix),
 				  R_bm_getDirectory(R_BufferedMatrix),
 				  temp2,temp2));
+  if (Matrix != NULL){
+    dbm_setColumnsPerFile(R_ExternalPtrAddr(returnvalue),dbm_getColumnsPerFile(Matrix));
+    dbm_setMemoryMapped(R_ExternalPtrAddr(returnvalue),dbm_isMemoryMapped(Matrix));
+    dbm_setTileRows(R_ExternalPtrAddr(returnvalue),dbm_getTileRows(Matrix));
+    dbm_setStorageType(R_ExternalPtrAddr(returnvalue),dbm_getStorageType(Matrix));
+  }
 
   
   PROTECT(temp = allocVector(INTSXP,1));
@@ -2288,8 +3556,9 @@ SEXP R_bm_MakeSubmatrix(SEXP R_BufferedMatrix, SEXP R_row, SEXP R_col){
     }
   }
 
+  dbm_AddColumns(destMatrix,ncols);
+
   for (j = 0; j < ncols; j++){
-    dbm_AddColumn(destMatrix);  
     if (Matrix == NULL){ 
       for (i = 0; i < nrows; i++){
 	tempbuffer = R_NaReal;
@@ -2329,7 +3598,8 @@ SEXP R_bm_as_BufferedMatrix(SEXP R_BufferedMatrix, SEXP RMatrix){
   doubleBufferedMatrix Matrix;
   
   int rows, cols;
-  int j;
+  int i, j;
+  double *column;
 
   /*  int rows_RMatrix;
       int cols_RMatrix; */
@@ -2347,8 +3617,20 @@ SEXP R_bm_as_BufferedMatrix(SEXP R_BufferedMatrix, SEXP RMatrix){
   cols = dbm_getCols(Matrix);
 
 
-  for (j=0; j < cols; j++){
-    dbm_setValueColumn(Matrix, &j, &REAL(RMatrix)[j*rows],1);
+  if (isReal(RMatrix)){
+    for (j=0; j < cols; j++){
+      dbm_setValueColumn(Matrix, &j, &REAL(RMatrix)[j*rows],1);
+    }
+  } else {
+    /* integer or logical, NA_INTEGER is NA_LOGICAL */
+    column = Calloc(rows,double);
+    for (j=0; j < cols; j++){
+      for (i=0; i < rows; i++){
+	column[i] = (INTEGER(RMatrix)[(R_xlen_t)j*rows + i] == NA_INTEGER) ? R_NaReal : (double)INTEGER(RMatrix)[(R_xlen_t)j*rows + i];
+      }
+      dbm_setValueColumn(Matrix, &j, column,1);
+    }
+    Free(column);
   }
   
 
@@ -2413,16 +3695,16 @@ SEXP R_bm_memoryInUse(SEXP R_BufferedMatrix){
   Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
   
   
-  PROTECT(returnvalue=allocVector(INTSXP,1));
+  PROTECT(returnvalue=allocVector(REALSXP,1));
 
   if (Matrix == NULL){ 
 
-    INTEGER(returnvalue)[0] = 0;
+    NUMERIC_POINTER(returnvalue)[0] = 0.0;
     UNPROTECT(1);
     return returnvalue;
   }
   
-  INTEGER(returnvalue)[0] = dbm_memoryInUse(Matrix);
+  NUMERIC_POINTER(returnvalue)[0] = dbm_memoryInUseBytes(Matrix);
   UNPROTECT(1);
   return returnvalue;
 
@@ -2466,11 +3748,31 @@ SEXP R_bm_fileSpaceInUse(SEXP R_BufferedMatrix){
 
 
 
-SEXP R_bm_setNewDirectory(SEXP R_BufferedMatrix, SEXP R_new_directory){
+/* prints how much of the storage has been copied, on a single line that is rewritten */
+
+static void R_bm_MoveProgress(double done, double total, void *arg){
+
+  int *percent = (int *)arg;
+  int now = (total > 0) ? (int)(100.0*done/total) : 100;
+
+  if (now == *percent){
+    return;
+  }
+  *percent = now;
+  Rprintf("\rCopying storage files: %3d%% of %.0f MB",now,total/1048576.0);
+  if (done >= total){
+    Rprintf("\n");
+  }
+  R_FlushConsole();
+}
+
+
+SEXP R_bm_setNewDirectory(SEXP R_BufferedMatrix, SEXP R_new_directory, SEXP R_progress){
 
   SEXP returnvalue= R_BufferedMatrix;
   doubleBufferedMatrix Matrix; 
   const char *newdirectory = CHAR(STRING_ELT(R_new_directory,0));
+  int percent = -1;
   
   
   if(!checkBufferedMatrix(R_BufferedMatrix)){
@@ -2479,8 +3781,9 @@ SEXP R_bm_setNewDirectory(SEXP R_BufferedMatrix, SEXP R_new_directory){
 
   Matrix =  R_ExternalPtrAddr(R_BufferedMatrix);
   
-  dbm_setNewDirectory(Matrix, newdirectory);
-
+  if (dbm_setNewDirectoryProgress(Matrix, newdirectory, LOGICAL(R_progress)[0] ? R_bm_MoveProgress : NULL, &percent)){
+    error("Could not move the storage files to %s, they have been left where they were",newdirectory);
+  }
 
 
 
@@ -33,14 +33,164 @@
  ** Nov 13, 2006 - optimized colMedians
  ** Jun 16, 2007 -  rename dbm_setDirectory to dbm_setNewDirectory
  ** Sep 9,  2007 - add dbm_rowMedians (only good in rowMode
+ ** Oct 16, 2026 - keep a cache of open file descriptors rather than fopen/fclose on
+ **                every buffer miss. All file access is now positional (pread/pwrite)
+ **                and goes through dbm_ReadColumnData/dbm_WriteColumnData
+ ** Oct 16, 2026 - columns may now be grouped into segment files, several columns
+ **                per file (dbm_setColumnsPerFile). The default remains one file per column
+ ** Oct 16, 2026 - add a memory mapped storage mode (dbm_setMemoryMapped). Column buffer
+ **                slots become views into the mapped files rather than private copies
+ ** Oct 16, 2026 - keep a dirty flag for each column buffer slot. Only columns that have
+ **                been modified are written back when they leave the buffer. Writes now go
+ **                through dbm_internalsetValue rather than dbm_internalgetValue
+ ** Oct 16, 2026 - track which rows of each column of the row buffer have been modified
+ **                so that dbm_FlushRowBuffer only writes those back
+ ** Oct 16, 2026 - sequential column prefetch. When columns are being loaded in order
+ **                a background thread reads the next few into spare buffers
+ ** Oct 16, 2026 - batch the per column reads and writes of the row buffer over a pool of I/O threads
+ ** Oct 16, 2026 - optional tiled layout within the storage files (dbm_setTileRows)
+ ** Oct 16, 2026 - values may be stored on disk as single precision (dbm_setStorageType).
+ **                Conversion happens as data moves between the buffers and the files
+ ** Oct 16, 2026 - add unsigned 16 bit integer storage (DBM_STORAGE_UINT16) for intensity data
+ ** Oct 16, 2026 - add integer (DBM_STORAGE_INT32) and logical (DBM_STORAGE_LOGICAL) storage
+ ** Oct 16, 2026 - dbm_AddColumn no longer writes zeros. Storage files are extended (sparsely)
+ **                when created and columns never written are zeroed in memory rather than read
+ ** Oct 16, 2026 - add dbm_AddColumns. Per column and per file arrays grow geometrically and
+ **                new columns no longer push older ones out of the column buffer
+ ** Oct 16, 2026 - add dbm_AppendColumn
+ ** Oct 16, 2026 - persistent matrices. dbm_AdoptFiles builds a matrix on existing storage
+ **                files and dbm_setPersistent keeps the files (flushed) when it is freed
+ ** Oct 16, 2026 - add dbm_ExportColumns, writes the matrix as a single column major raw file
+ ** Oct 16, 2026 - optional direct I/O (dbm_setDirectIO). Files are opened with O_DIRECT where
+ **                supported, unaligned transfers go through an aligned bounce buffer, and
+ **                the page cache is told to drop columns once they have been read or written
+ ** Oct 16, 2026 - write-behind. Modified columns leaving the column buffer are written by a
+ **                background thread (dbm_setWriteBehindColumns)
+ ** Oct 16, 2026 - storage files may be striped over several directories (dbm_setDirectories).
+ **                dbm_ReadAdjacentColumns reads from several files at once using the I/O threads
+ **                and there is a thread reading ahead for each directory
+ ** Oct 16, 2026 - dbm_setNewDirectory checks that each file was moved. Files that can not be
+ **                renamed (eg the new directory is on another file system) are copied, several
+ **                at once, verified and then removed. Progress may be reported as they are copied
+ **                (dbm_setNewDirectoryProgress). If anything fails the files are left where they were
+ ** Oct 16, 2026 - keep the slot of the column buffer holding each column (col_slot) so that
+ **                dbm_InColBuffer no longer searches which_cols
+ ** Oct 16, 2026 - the column buffer is now least recently used rather than first in first out.
+ **                Slots are kept on a linked list in order of use and columns no longer move
+ **                between slots
+ ** Oct 16, 2026 - the eviction policy of the column buffer may be chosen (dbm_setEvictionPolicy),
+ **                one of least recently used, first in first out, most recently used, CLOCK
+ **                or ARC. Hits and misses of the column buffer are counted
+ ** Oct 16, 2026 - the buffers may be sized from a memory budget (dbm_setBufferBytes) and are then
+ **                rebalanced when the shape or mode of the matrix changes. dbm_memoryInUse
+ **                returns a double so large buffers are reported correctly
+ ** Oct 16, 2026 - a shared buffer pool (dbm_setSharedBufferBytes). The column buffers of the
+ **                matrices using it (dbm_setSharedBuffer) grow and shrink within a single memory
+ **                budget, columns being taken from the least recently active matrices first
+ ** Oct 16, 2026 - values are rounded to the storage type as they enter the buffers (dbm_StorageValue)
+ **                rather than only when written to the files, so a value reads back the same
+ **                whether or not its column has been reloaded. Integer values are truncated and
+ **                logical ones made 0/1 in the same way
+ ** Oct 16, 2026 - type specialized reductions. With the integer storage types the column
+ **                sums, means, maxima, minima, ranges and medians (and the sum, mean, max and
+ **                min) read unbuffered columns as narrow values straight from the files
+ **                (dbm_NarrowSummary, dbm_NarrowMedian) rather than loading them as doubles
+ ** Oct 16, 2026 - dbm_memoryInUse is an int again (limited to INT_MAX) so code calling it
+ **                through R_GetCCallable keeps working. dbm_memoryInUseBytes gives the double
  **
  *****************************************************/
 
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
+/* for O_DIRECT */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "doubleBufferedMatrix.h"
 
 
 #include <Rdefines.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#define DBM_HAVE_THREADS 1
+#include <pthread.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#define DBM_HAVE_SENDFILE 1
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define DBM_HAVE_COPY_FILE_RANGE 1
+#endif
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Default for the number of column files a single matrix will hold open at once */
+#define DBM_DEFAULT_MAX_OPEN_FILES 512
+
+/* Largest amount of data (in bytes) read in a single call when reading several adjacent columns at once */
+#define DBM_MAX_READ_CHUNK 8388608
+
+/* Largest amount of data (in bytes) copied in a single call when moving storage files between file systems */
+#define DBM_COPY_CHUNK 67108864
+
+/* Largest column buffer derived from a memory budget (many more columns than most matrices have) */
+#define DBM_MAX_BUFFER_COLS 1073741824
+
+/* Alignment (in bytes) of the file offsets, lengths and memory used for direct I/O */
+#define DBM_DIRECT_ALIGN 4096
+
+/* Largest amount of data (in bytes) moved through the aligned buffer in one call for direct I/O */
+#define DBM_DIRECT_CHUNK 4194304
+
+/* Size (in bytes) of the buffer used to convert values to the storage type before writing */
+#define DBM_CONVERT_CHUNK 65536
+
+/* bit pattern used to store NA when values are stored as single precision (a NaN, as with NA_real_) */
+#define DBM_FLOAT_NA 0x7FC007A2U
+
+/* stored for NA (or NaN) when values are stored as unsigned 16 bit integers, so 0 to 65534 can be stored exactly */
+#define DBM_UINT16_NA 65535
+
+/* stored for NA when values are stored as logicals, one byte each */
+#define DBM_LOGICAL_NA 255
+
+/* Default for the number of columns read ahead when columns are accessed in sequence */
+#ifdef DBM_HAVE_THREADS
+#define DBM_DEFAULT_PREFETCH 2
+#else
+#define DBM_DEFAULT_PREFETCH 0
+#endif
+
+/* Default for the number of evicted columns that may be waiting to be written by the background thread */
+#ifdef DBM_HAVE_THREADS
+#define DBM_DEFAULT_WRITEBEHIND 2
+#else
+#define DBM_DEFAULT_WRITEBEHIND 0
+#endif
+
+/* Default for the number of threads (including the calling thread) used for batches of row buffer reads/writes */
+#ifdef DBM_HAVE_THREADS
+#define DBM_DEFAULT_IO_THREADS 4
+#else
+#define DBM_DEFAULT_IO_THREADS 1
+#endif
+
 
 /*****************************************************
  *****************************************************
@@ -120,9 +270,88 @@
  **              finally return value
  **
  **           
+ **            Storage files:
+ **              Columns are stored in segment files each holding up to
+ **              cols_per_file columns, one after another. So column j is in 
+ **              file j/cols_per_file starting (j % cols_per_file)*rows doubles
+ **              into that file. By default cols_per_file is 1, ie one file per column.
+ **              Grouping columns keeps the number of files (and open file 
+ **              descriptors) small for matrices with very many columns.
+ **
+ **            Storage type:
+ **              The buffers always hold doubles. The files may instead hold
+ **              single precision values (storage_type DBM_STORAGE_FLOAT), halving 
+ **              the space and I/O needed. Values are converted when read into 
+ **              or written from the buffers (dbm_ToStorage/dbm_FromStorage) so 
+ **              dbm_ColumnOffset etc work in units of dbm_ElementSize bytes. 
+ **              DBM_STORAGE_UINT16 uses two bytes per value and suits integer
+ **              data such as probe intensities: values are rounded and limited 
+ **              to 0 - 65534 when converted, with 65535 reserved for NA.
+ **              DBM_STORAGE_INT32 and DBM_STORAGE_LOGICAL hold R integers and 
+ **              logicals, converted as by as.integer() and as.logical(). 
+ **              Set before any columns are added. Not used with memory mapping.
+ **
+ **            Tiled layout:
+ **              If tile_rows is non zero the columns of a segment file are 
+ **              instead stored in blocks of tile_rows rows. Each block holds 
+ **              that range of rows for all the columns of the file, column 
+ **              after column (the last block may be shorter). So a block of rows 
+ **              of neighbouring columns is contiguous in the file, at the cost 
+ **              of reading a whole column taking one read per block. Reading the 
+ **              row buffer then needs far fewer (larger) reads when cols_per_file > 1.
+ **              Set before any columns are added. Not used with memory mapping.
+ **
+ **            Memory mapped mode:
+ **              If selected (before any columns are added) each storage file
+ **              is created at its full size and mapped into memory. The column
+ **              buffer then does not hold copies of columns, instead each slot
+ **              is a view into the mapping. So loading a column just changes a
+ **              pointer and flushing a column is not needed. max_cols still 
+ **              determines how many columns are considered "in the buffer", when
+ **              a column leaves the buffer the OS is told (via madvise) that its
+ **              pages are no longer needed. The row buffer is still a private
+ **              copy which is filled from and flushed to the mapping. 
+ **              Not available on Windows.
+ **
+ **            Batched I/O:
+ **              Loading or flushing the row buffer needs one read or write
+ **              per column. These are collected into a batch which is 
+ **              carried out by io_threads threads (the calling thread and a 
+ **              small pool) so that several are in progress at once.
+ **
+ **            Prefetching:
+ **              When columns are being loaded into the column buffer in
+ **              increasing order (as happens in colSums, colMedians etc) a
+ **              background thread reads the next prefetch_depth columns into
+ **              spare buffers. When one of these is then needed its buffer
+ **              is swapped into the column buffer rather than reading from file.
+ **              The background thread only ever calls pread() on a
+ **              duplicate of a file descriptor, everything else (including 
+ **              all allocation) happens on the calling thread. Any write to
+ **              a column discards a prefetched copy of it.
+ **
+ **            Write-behind:
+ **              When a modified column is pushed out of the column buffer its
+ **              buffer is handed to a second background thread to be written,
+ **              and a spare buffer takes its place, so the calling thread does
+ **              not wait for the write. At most writebehind_depth columns are
+ **              waiting at once. A column that is needed again before (or 
+ **              after) it has been written is taken back from memory. Any 
+ **              other read or write of the column's file first waits for a 
+ **              pending write of it. Not used in row mode (apart from when the
+ **              column buffer shrinks), with memory mapping or with direct I/O.
+ **
+ **            Striping:
+ **              The storage files may be spread over several directories
+ **              (file k in directory k % ndirectories), each ideally on its own
+ **              device. Batches of reads and writes are spread over the files
+ **              by the I/O threads, and there is a prefetching thread for each
+ **              directory, so all the devices are kept busy during a scan.
+ **
  **            Add will work like this:
- **              Create a new temporary file name
- **              Open this temporary file and write # of row zeros
+ **              If the last segment file is full, create a new temporary file name
+ **              Open this temporary file and write # of row zeros at the
+ **              location of the new column
  **              Then increase the rowdata buffer
  **              Remove oldest row data from buffer
  **              Add new column to end of column buffer
@@ -130,6 +359,71 @@
  *****************************************************/
 
 
+/* One spare buffer used by the prefetching thread (or the write-behind thread) */
+
+#define DBM_PF_EMPTY 0    /* not in use */
+#define DBM_PF_QUEUED 1   /* waiting for the background thread */
+#define DBM_PF_READING 2  /* background thread is reading it */
+#define DBM_PF_READY 3    /* data is available */
+#define DBM_PF_FAILED 4   /* read did not succeed */
+
+typedef struct
+{
+  int col;        /* column of the matrix, -1 if empty */
+  int state;      /* one of DBM_PF_* above */
+  int fd;         /* duplicate descriptor for the file, owned by this entry while queued */
+  long seq;       /* order in which requests were made */
+  double *data;   /* rows long */
+} dbm_prefetch_entry;
+
+/* states of the entries used by the write-behind thread */
+
+#define DBM_WB_EMPTY 0    /* not in use */
+#define DBM_WB_QUEUED 1   /* waiting for the background thread */
+#define DBM_WB_WRITING 2  /* background thread is writing it */
+#define DBM_WB_WRITTEN 3  /* written, data is still a current copy of the column */
+#define DBM_WB_FAILED 4   /* write did not succeed, data has not been written */
+
+
+/* One read or write in a batch carried out by the I/O threads */
+
+typedef struct
+{
+  int fd;
+  int write;      /* true for a write, false for a read */
+  int col;        /* column of the matrix, or -1 for a plain range of bytes of the file */
+  int first_row;  /* when col >= 0, the rows of the column to transfer */
+  int nrows;
+  long long offset; /* when col < 0, the range of the file to transfer */
+  size_t nbytes;
+  double *buf;
+  int result;     /* 0 if successful */
+} dbm_io_request;
+
+
+/* Several columns of the row buffer read with one request */
+
+typedef struct
+{
+  double *scratch;  /* NULL unless the request reads several columns at once */
+  int col;          /* first column */
+  int ncols;
+  int stride;       /* distance between columns in scratch */
+  int first;        /* rows (relative to first_rowdata) for each column */
+  int nrows;
+} dbm_row_span;
+
+
+/* A doubly linked list whose links are kept in a pair of arrays (prev and next) indexed by node */
+
+typedef struct
+{
+  int head;       /* -1 if the list is empty */
+  int tail;
+  int size;
+} dbm_list;
+
+
 /*****************************************************
  *****************************************************
  *****************************************************
@@ -158,6 +452,14 @@ struct _double_buffered_matrix
   int max_rows; /* Maximum number of rows kept in RAM
 		   in row buffered data  the maximum 
 		   value that this should be is 1000 */
+
+  double buffer_bytes; /* if positive, a memory budget for the buffers. max_cols and max_rows
+                          are then derived from it (see dbm_BalanceBuffers) */
+
+  int shared;          /* If true the column buffer is sized by the shared buffer pool 
+                          (see dbm_SharedBorrow) rather than max_cols or buffer_bytes */
+  doubleBufferedMatrix shared_prev; /* the matrices using the pool are kept on a doubly linked */
+  doubleBufferedMatrix shared_next; /* list, most recently active at the head */
   
   double **coldata; /* RAM buffer containing stored data
                        its maximum size should be no more 
@@ -171,19 +473,137 @@ struct _double_buffered_matrix
   double **rowdata; /* RAM buffer containing stored data it size will always
 		       be max_rows*cols */
 
+  int *row_dirty_first; /* for each column of the row buffer, the range of rows (relative to */
+  int *row_dirty_last;  /* first_rowdata) modified since the buffer was loaded or flushed. 
+			   If row_dirty_first > row_dirty_last nothing has been modified */
+
   
   int first_rowdata; /* matrix index of first row stored in rowdata  should be from 0 to rows */
 
-  int *which_cols; /* vector containing indices of columns currently in col data. The 
-                      "oldest" indice is first indice. Newest indice is last indice. 
-                       Note that the length this will be is min(cols, max_cols) */
-
-
-  char **filenames; /* contains names of temporary files where data is stored  */
+  int *which_cols; /* vector containing indices of columns currently in col data, one per 
+                      slot of the column buffer. Note that the length this will be is 
+                      min(cols, max_cols) */
+
+  int *col_dirty;  /* parallel to which_cols. True if the column in that slot of the column 
+                      buffer has been modified since it was read from (or written to) file */
+
+  int *col_slot;   /* one per column, the inverse of which_cols. The slot of the column buffer
+                      holding the column, -1 if it is not in the column buffer */
+
+  int *col_list_prev; /* parallel to which_cols. The links of the lists (col_list) holding the slots */
+  int *col_list_next;
+  dbm_list col_list[2]; /* Every slot is on col_list[0], in the order of use or of loading that the 
+                           eviction policy needs. Under ARC col_list[0] only holds the columns used 
+                           once recently (T1) and col_list[1] holds those used more than once (T2) */
+  char *col_ref;     /* parallel to which_cols. The reference bit under CLOCK, the list holding 
+                        the slot under ARC */
+  int eviction_policy; /* which slot of the column buffer is replaced, one of DBM_EVICT_* */
+
+  char *col_ghost;   /* only under ARC, one per column. 1 or 2 if the column recently left the
+                        buffer from T1 or T2 (it is on ghost_list[0] or ghost_list[1]) otherwise 0 */
+  int *ghost_prev;   /* one per column, the links of the ghost lists */
+  int *ghost_next;
+  dbm_list ghost_list[2];
+  int arc_target;    /* the size ARC is aiming for T1 to be */
+
+  double col_hits;   /* number of references to a column found in the column buffer */
+  double col_misses; /* and not found in it. Repeated references to one column count once */
+  int col_last_ref;  /* the column last referenced, -1 if none */
+
+  char *col_zero;  /* one per column. True if nothing has been written to the column in its file 
+                      since it was added, so it is known to be zero without reading it. 
+                      Never set when memory mapped */
+
+  int col_capacity; /* allocated length of col_zero, col_slot, and of rowdata, row_dirty_first and 
+                       row_dirty_last in row mode. Grows geometrically as columns are added */
+
+
+  char **filenames; /* contains names of temporary files where data is stored. There are 
+                       ceiling(cols/cols_per_file) of these */
+
+  int cols_per_file; /* number of columns stored in each file. Can only be changed before 
+                        any columns are added */
+
+  int storage_type;  /* how values are stored in the files, DBM_STORAGE_DOUBLE, DBM_STORAGE_FLOAT
+                        DBM_STORAGE_UINT16,
+                        DBM_STORAGE_INT32 or DBM_STORAGE_LOGICAL. Can only be changed before any columns are added */
+
+  int tile_rows;     /* 0 if each column is stored contiguously, otherwise the number of rows 
+                        in each block of the tiled layout. Can only be changed before any
+                        columns are added */
+
+  int memory_mapped; /* If true then the files are memory mapped and the column buffer
+                        contains views into the mappings rather than copies. Can only be 
+                        changed before any columns are added */
+  char **file_map;   /* when memory mapped, the address each file is mapped at */
+
+  int persistent;    /* If true the buffers are flushed and the storage files kept (rather
+                        than deleted) when the matrix is freed */
+
+  int direct_io;     /* If true the files are opened for direct I/O (bypassing the page 
+                        cache) where possible, otherwise columns are dropped from the page 
+                        cache after they are read or written */
+
+  int prefetch_depth;     /* number of columns to read ahead, 0 for none */
+  int prefetch_last_col;  /* last column loaded into the column buffer from file */
+  dbm_prefetch_entry *prefetch; /* prefetch_depth spare buffers, allocated when first needed */
+#ifdef DBM_HAVE_THREADS
+  int prefetch_running;   /* true if the background thread has been started */
+  int prefetch_shutdown;  /* tells the background thread to finish */
+  long prefetch_seq;
+  pid_t prefetch_pid;     /* process that started the thread (it does not survive a fork) */
+  int prefetch_nthreads;  /* number of background threads, one per directory when striped */
+  pthread_t *prefetch_threads;
+  pthread_mutex_t prefetch_lock;  /* protects the prefetch entries */
+  pthread_cond_t prefetch_work;   /* signalled when a request is queued or on shutdown */
+  pthread_cond_t prefetch_done;   /* signalled when a request completes */
+#endif
+
+  int writebehind_depth;  /* number of evicted columns that may be waiting to be written, 0 for none */
+  dbm_prefetch_entry *writebehind; /* writebehind_depth spare buffers, allocated when first needed */
+#ifdef DBM_HAVE_THREADS
+  int writebehind_running;   /* true if the background thread has been started */
+  int writebehind_shutdown;  /* tells the background thread to finish */
+  long writebehind_seq;
+  pid_t writebehind_pid;     /* process that started the thread */
+  pthread_t writebehind_thread;
+  pthread_mutex_t writebehind_lock;  /* protects the write-behind entries */
+  pthread_cond_t writebehind_work;   /* signalled when a column is queued or on shutdown */
+  pthread_cond_t writebehind_done;   /* signalled when a write completes */
+#endif
+
+  int io_threads;         /* number of threads used for batches of I/O (including the calling thread) */
+#ifdef DBM_HAVE_THREADS
+  int io_running;         /* number of I/O threads started, 0 if none */
+  int io_shutdown;
+  pid_t io_pid;
+  pthread_t *io_thread;
+  pthread_mutex_t io_lock;  /* protects the fields below */
+  pthread_cond_t io_work;   /* signalled when a batch is submitted or on shutdown */
+  pthread_cond_t io_done;   /* signalled when the last request of a batch completes */
+  dbm_io_request *io_batch; /* batch currently being carried out, NULL if none */
+  int io_batch_size;
+  int io_next;              /* next request in batch to be started */
+  int io_pending;           /* requests in batch not yet completed */
+#endif
+
+  int file_capacity; /* allocated length of filenames, file_fd, file_lru_prev, file_lru_next
+                        and file_map */
+  int *file_fd;      /* open file descriptor for each file in filenames, -1 if it is not currently open */
+  int *file_lru_prev; /* open files are kept on a doubly linked list, most recently used at the head */
+  int *file_lru_next; /* and least recently used at the tail. -1 marks either end of the list */
+  int file_lru_head;
+  int file_lru_tail;
+  int n_open_files;   /* number of files currently held open */
+  int max_open_files; /* maximum number of files that may be held open at once. When this would be 
+                         exceeded the least recently used file is closed */
 
   
   char *fileprefix; /* temporary filenames will begin with this string */
   char *filedirectory; /* path for where directory where temporary files be stored */
+  char **directories;  /* when striped, the directories the storage files are spread over 
+                          in turn (file k is in directories[k % ndirectories]) */
+  int ndirectories;    /* number of directories, 0 if all the files are in filedirectory */
 
   int rowcolclash;  /* referenced a cell location that is both in column and row buffer */
   int clash_row;     /* contains row index of potential clash */
@@ -214,23 +634,77 @@ struct _double_buffered_matrix
  *****************************************************
  *****************************************************/
 
+/* position within a storage file */
+
+#ifdef _WIN32
+typedef __int64 dbm_offset;
+#else
+typedef off_t dbm_offset;
+#endif
+
 static void dbm_SetClash(doubleBufferedMatrix Matrix,int row, int col);
 static void dbm_ClearClash(doubleBufferedMatrix Matrix);
 static int dbm_InRowBuffer(doubleBufferedMatrix Matrix,int row, int col);
 static int dbm_InColBuffer(doubleBufferedMatrix Matrix,int row, int col,int *which_col_index);
 
 static int dbm_FlushRowBuffer(doubleBufferedMatrix Matrix);
+static void dbm_ClearRowDirty(doubleBufferedMatrix Matrix, int col);
 static int dbm_FlushOldestColumn(doubleBufferedMatrix Matrix);
+static int dbm_EvictOldestColumn(doubleBufferedMatrix Matrix);
+static void dbm_FreeDirectories(doubleBufferedMatrix Matrix);
 static int dbm_FlushAllColumns(doubleBufferedMatrix Matrix);
 
 static int dbm_LoadNewColumn(doubleBufferedMatrix Matrix,int col);
 static int dbm_LoadRowBuffer(doubleBufferedMatrix Matrix,int row);
 
 static int dbm_LoadAdditionalColumn(doubleBufferedMatrix Matrix,int col, int where);
+static int dbm_SetColBufferSize(doubleBufferedMatrix Matrix, int new_maxcol);
+static int dbm_SetRowBufferSize(doubleBufferedMatrix Matrix, int new_maxrow);
+static int dbm_BalanceBuffers(doubleBufferedMatrix Matrix, int rowmode);
+static void dbm_SharedActive(doubleBufferedMatrix Matrix);
+static void dbm_SharedBorrow(doubleBufferedMatrix Matrix);
+static int dbm_SharedTrim(doubleBufferedMatrix except, double needed);
 
 static double *dbm_internalgetValue(doubleBufferedMatrix Matrix,int row, int col);
+static double *dbm_internalsetValue(doubleBufferedMatrix Matrix,int row, int col);
 static int *dbm_whatsInColumnBuffer(doubleBufferedMatrix Matrix);
 
+static int dbm_OpenFile(doubleBufferedMatrix Matrix, int which);
+static int dbm_CreateFile(doubleBufferedMatrix Matrix, int which);
+static void dbm_CloseFile(doubleBufferedMatrix Matrix, int which);
+static void dbm_CloseAllFiles(doubleBufferedMatrix Matrix);
+static int dbm_ReadColumnData(doubleBufferedMatrix Matrix, int col, int first_row, int nrows, double *dest);
+static int dbm_ColumnIO(doubleBufferedMatrix Matrix, int fd, int col, int first_row, int nrows, double *buf, int write);
+static size_t dbm_ElementSize(doubleBufferedMatrix Matrix);
+static void dbm_ToStorage(doubleBufferedMatrix Matrix, const double *src, void *dest, int n);
+static void dbm_FromStorage(doubleBufferedMatrix Matrix, const void *src, double *dest, int n);
+static int dbm_pwriteConverted(doubleBufferedMatrix Matrix, int fd, const double *src, int n, dbm_offset offset);
+static void dbm_TileBlock(doubleBufferedMatrix Matrix, int row, int *block_start, int *block_rows);
+static int dbm_WriteColumnData(doubleBufferedMatrix Matrix, int col, int first_row, int nrows, const double *src);
+static int dbm_ReadAdjacentColumns(doubleBufferedMatrix Matrix, int first_col, int ncols, double **dest);
+
+static int dbm_MapFile(doubleBufferedMatrix Matrix, int which);
+static void dbm_UnmapAllFiles(doubleBufferedMatrix Matrix);
+static double *dbm_ColumnView(doubleBufferedMatrix Matrix, int col);
+static double *dbm_NewColumnSlot(doubleBufferedMatrix Matrix, int col);
+static void dbm_ReleaseColumnSlot(doubleBufferedMatrix Matrix, double *slot);
+
+static int dbm_PrefetchTake(doubleBufferedMatrix Matrix, int col, double **slot);
+static void dbm_PrefetchInvalidate(doubleBufferedMatrix Matrix, int col);
+static void dbm_PrefetchIssue(doubleBufferedMatrix Matrix, int col);
+static void dbm_PrefetchStop(doubleBufferedMatrix Matrix);
+static int dbm_WriteBehindQueue(doubleBufferedMatrix Matrix, int col, double **slot);
+static int dbm_WriteBehindTake(doubleBufferedMatrix Matrix, int col, double **slot);
+static int dbm_WriteBehindSync(doubleBufferedMatrix Matrix, int col);
+static int dbm_WriteBehindHas(doubleBufferedMatrix Matrix, int col);
+static void dbm_WriteBehindStop(doubleBufferedMatrix Matrix);
+
+static int dbm_RunIOBatch(doubleBufferedMatrix Matrix, dbm_io_request *requests, int n);
+static int dbm_RowBlockIO(doubleBufferedMatrix Matrix, int *cols, int *first, int *nrows, int ncols, int write);
+#ifdef DBM_HAVE_THREADS
+static void dbm_IOPoolStop(doubleBufferedMatrix Matrix);
+#endif
+
 /*****************************************************
  *****************************************************
  *****************************************************
@@ -245,1599 +719,6211 @@ static int *dbm_whatsInColumnBuffer(doubleBufferedMatrix Matrix);
  *****************************************************/
 
 /*****************************************************
- ** 
- ** void dbm_SetClash(doubleBufferedMatrix Matrix,int row, int col)
- **
- ** doubleBufferedMatrix Matrix - a buffered Matrix object
- ** int row, col - location in matrix for potential clash
- **
- ** This function sets a flag that says whether or not there is
- ** a potential clash between the row buffer and the column buffer
- ** and the location in the matrix of this clash.
  **
- ** A clash means that the values might not agree. When in colmode there
- ** is no chance of a clash because the row buffer does not exist.
- **
- ** in rowmode the rowbuffer is assumed to be the updated one.
- **
- **
- *****************************************************/
-
-static void dbm_SetClash(doubleBufferedMatrix Matrix,int row, int col){
-  Matrix->rowcolclash = 1;
-  Matrix->clash_row = row;
-  Matrix->clash_col = col;
-}
-
-/*****************************************************
- ** 
- ** void dbm_ClearClash(doubleBufferedMatrix Matrix)
+ ** Direct I/O
  **
- ** doubleBufferedMatrix Matrix - a buffered Matrix object
+ ** With O_DIRECT the memory, file offset and length of each
+ ** transfer must all be aligned. Requests that are not (most
+ ** are not, as columns rarely start on a block boundary) are
+ ** carried out a chunk at a time through an aligned buffer by
+ ** dbm_preadDirect/dbm_pwriteDirect. A write that only covers
+ ** part of a block must first read the rest of the block, so
+ ** two such writes must never run at the same time. Writing
+ ** the last block of a file writes it whole, so the file is
+ ** then cut back to where a plain write would have left it.
  **
- ** Clears potential clashes by resyncing the column and row buffers.
+ ** Like dbm_pread/dbm_pwrite these only use their arguments
+ ** and may be called from the I/O threads.
  **
  *****************************************************/
 
+#ifdef O_DIRECT
 
-static void dbm_ClearClash(doubleBufferedMatrix Matrix){
+/* reads up to nbytes, stopping early only at the end of the file. Returns the number read, -1 if problem */
 
-    // Should mean that row buffer is up to date and column buffer is potentially not
-  int curcol,lastcol;
+static long long dbm_preadAll(int fd, char *buf, size_t nbytes, dbm_offset offset){
 
+  long long nread, total = 0;
 
-  
-  curcol = 0;
-  if (Matrix->cols < Matrix->max_cols){
-    lastcol = Matrix->cols;
-  } else {
-    lastcol = Matrix->max_cols;
-  }
-  
-  while (curcol < lastcol){
-    if (Matrix->which_cols[curcol] == Matrix->clash_col){
+  while ((size_t)total < nbytes){
+    nread = pread(fd,buf + total,nbytes - total,offset + total);
+    if (nread < 0){
+      if (errno == EINTR)
+	continue;
+      return -1;
+    }
+    if (nread == 0){
       break;
     }
-    curcol++;
+    total+= nread;
   }
+  return total;
+}
 
 
+static int dbm_preadDirect(int fd, void *buf, size_t nbytes, dbm_offset offset){
 
-  if (Matrix->rowdata[Matrix->clash_col][Matrix->clash_row - Matrix->first_rowdata] != Matrix->coldata[curcol][Matrix->clash_row]){
-    /* there is a clash, update coldata with current version in rowdata */
-    Matrix->coldata[curcol][Matrix->clash_row] = Matrix->rowdata[Matrix->clash_col][Matrix->clash_row - Matrix->first_rowdata];
-  } 
+  char *aligned, *pos = (char *)buf;
+  dbm_offset start, end;
+  size_t span, skip, n;
+  long long nread;
 
-  Matrix->rowcolclash=0;
-  
+  end = (offset + nbytes + DBM_DIRECT_ALIGN - 1)/DBM_DIRECT_ALIGN*DBM_DIRECT_ALIGN;
+  span = (end - offset/DBM_DIRECT_ALIGN*DBM_DIRECT_ALIGN < DBM_DIRECT_CHUNK) ? (size_t)(end - offset/DBM_DIRECT_ALIGN*DBM_DIRECT_ALIGN) : DBM_DIRECT_CHUNK;
+  if (posix_memalign((void **)&aligned,DBM_DIRECT_ALIGN,span)){
+    return 1;
+  }
+
+  while (nbytes > 0){
+    start = offset/DBM_DIRECT_ALIGN*DBM_DIRECT_ALIGN;
+    skip = offset - start;
+    n = (skip + nbytes < span) ? skip + nbytes : span;
+    nread = dbm_preadAll(fd,aligned,(n + DBM_DIRECT_ALIGN - 1)/DBM_DIRECT_ALIGN*DBM_DIRECT_ALIGN,start);
+    if (nread < (long long)n){
+      free(aligned);
+      return 1;  /* problem, or the file is shorter than it should be */
+    }
+    memcpy(pos,aligned + skip,n - skip);
+    pos+= n - skip;
+    nbytes-= n - skip;
+    offset+= n - skip;
+  }
+
+  free(aligned);
+  return 0;
 }
 
 
+static int dbm_pwriteDirect(int fd, const void *buf, size_t nbytes, dbm_offset offset){
 
-/*****************************************************
- ** 
- ** int dbm_InRowBuffer(doubleBufferedMatrix Matrix,int row, int col)
- **
- ** doubleBufferedMatrix Matrix
- ** int row, int col - location in Matrix
- **
- ** Returns 1 if the specified element is the Row Buffer
- ** otherwise returns 0 
- **
- *****************************************************/
+  char *aligned;
+  const char *pos = (const char *)buf;
+  dbm_offset start, end, file_end;
+  size_t span, skip, n, len;
+  long long nread, nwritten, total;
+  int past_end = 0;
 
-static int dbm_InRowBuffer(doubleBufferedMatrix Matrix,int row, int col){
-  if ((Matrix->first_rowdata <= row) && (row < Matrix->first_rowdata +  Matrix->max_rows)){
+  /* the size the file should be afterwards */
+  file_end = lseek(fd,0,SEEK_END);
+  if (file_end < 0){
     return 1;
-  } else {
-    return 0;
+  }
+  if (file_end < offset + (dbm_offset)nbytes){
+    file_end = offset + (dbm_offset)nbytes;
   }
 
+  end = (offset + nbytes + DBM_DIRECT_ALIGN - 1)/DBM_DIRECT_ALIGN*DBM_DIRECT_ALIGN;
+  span = (end - offset/DBM_DIRECT_ALIGN*DBM_DIRECT_ALIGN < DBM_DIRECT_CHUNK) ? (size_t)(end - offset/DBM_DIRECT_ALIGN*DBM_DIRECT_ALIGN) : DBM_DIRECT_CHUNK;
+  if (posix_memalign((void **)&aligned,DBM_DIRECT_ALIGN,span)){
+    return 1;
+  }
 
+  while (nbytes > 0){
+    start = offset/DBM_DIRECT_ALIGN*DBM_DIRECT_ALIGN;
+    skip = offset - start;
+    n = (skip + nbytes < span) ? skip + nbytes : span;
+    len = (n + DBM_DIRECT_ALIGN - 1)/DBM_DIRECT_ALIGN*DBM_DIRECT_ALIGN;
+    if (skip > 0 || n < len){
+      /* keep what is already in the partly covered blocks (zeros beyond the end of the file) */
+      nread = dbm_preadAll(fd,aligned,len,start);
+      if (nread < 0){
+	free(aligned);
+	return 1;
+      }
+      memset(aligned + nread,0,len - nread);
+    }
+    memcpy(aligned + skip,pos,n - skip);
+    if (start + (dbm_offset)len > file_end){
+      past_end = 1;
+    }
+    total = 0;
+    while ((size_t)total < len){
+      nwritten = pwrite(fd,aligned + total,len - total,start + total);
+      if (nwritten < 0){
+	if (errno == EINTR)
+	  continue;
+	free(aligned);
+	return 1;
+      }
+      total+= nwritten;
+    }
+    pos+= n - skip;
+    nbytes-= n - skip;
+    offset+= n - skip;
+  }
 
+  free(aligned);
+  /* the zeros written beyond the end of the file are not part of it */
+  if (past_end && ftruncate(fd,file_end)){
+    return 1;
+  }
+  return 0;
 }
 
-/*****************************************************
- ** 
- ** int dbm_InColBuffer(doubleBufferedMatrix Matrix,int row, int col)
- **
- ** doubleBufferedMatrix Matrix
- ** int row, int col - location in Matrix
- **
- ** Returns 1 if the specified element is the Col Buffer
- ** otherwise returns 0 
- **
- *****************************************************/
-
-static int dbm_InColBuffer(doubleBufferedMatrix Matrix,int row, int col, int *which_col_index){
-  int curcol, lastcol;
+#endif
 
-  if (Matrix->cols < Matrix->max_cols){
-    lastcol = Matrix->cols;
-  } else {
-    lastcol = Matrix->max_cols;
-  }
-    
-    
-  curcol = lastcol-1;
-  while (curcol >= 0){
-    if (Matrix->which_cols[curcol] == col){
-      *which_col_index = curcol;
-      return 1;  /* Found it */
-    }
-    curcol--;
-  } 
-  
-  return 0; /* Not found */
-}
 
 /*****************************************************
- ** 
- ** int dbm_FlushRowBuffer(doubleBufferedMatrix Matrix)
- **
- ** doubleBufferedMatrix Matrix
  **
- ** Writes entire contents of Row Buffer back out to file
+ ** Positional read/write. Loops until all requested bytes
+ ** are transferred (or an error/end of file occurs).
  **
- ** Returns 0 if successful, Returns 1 if problem
+ ** Returns 0 if successful, 1 if problem
  **
  *****************************************************/
 
+static int dbm_pread(int fd, void *buf, size_t nbytes, dbm_offset offset){
 
-static int dbm_FlushRowBuffer(doubleBufferedMatrix Matrix){
+  char *pos = (char *)buf;
+  long long nread;
+
+  while (nbytes > 0){
+#ifdef _WIN32
+    if (_lseeki64(fd,offset,SEEK_SET) < 0){
+      return 1;
+    }
+    nread = _read(fd,pos,(unsigned int)nbytes);
+#else
+    nread = pread(fd,pos,nbytes,offset);
+#endif
+    if (nread < 0){
+      if (errno == EINTR)
+	continue;
+#ifdef O_DIRECT
+      if (errno == EINVAL){
+	return dbm_preadDirect(fd,pos,nbytes,offset);  /* not aligned for direct I/O */
+      }
+#endif
+      return 1;
+    }
+    if (nread == 0){
+      return 1;  /* file is shorter than it should be */
+    }
+    pos+= nread;
+    nbytes-= nread;
+    offset+= nread;
+  }
+  return 0;
+}
 
 
-  int j;
-  
-  int blocks_written;
+static int dbm_pwrite(int fd, const void *buf, size_t nbytes, dbm_offset offset){
 
-  const char *mode2 ="rb+";
-  FILE *myfile;
+  const char *pos = (const char *)buf;
+  long long nwritten;
 
-  for (j =0; j < Matrix->cols; j++){
-    myfile = fopen(Matrix->filenames[j],mode2);
-    if (myfile == NULL){
+  while (nbytes > 0){
+#ifdef _WIN32
+    if (_lseeki64(fd,offset,SEEK_SET) < 0){
       return 1;
     }
-    fseek(myfile,Matrix->first_rowdata*sizeof(double),SEEK_SET);
-    blocks_written = fwrite(&(Matrix->rowdata)[j][0],sizeof(double),Matrix->max_rows,myfile);
-    fclose(myfile);
-    if (blocks_written != Matrix->max_rows){
+    nwritten = _write(fd,pos,(unsigned int)nbytes);
+#else
+    nwritten = pwrite(fd,pos,nbytes,offset);
+#endif
+    if (nwritten < 0){
+      if (errno == EINTR)
+	continue;
+#ifdef O_DIRECT
+      if (errno == EINVAL){
+	return dbm_pwriteDirect(fd,pos,nbytes,offset);  /* not aligned for direct I/O */
+      }
+#endif
       return 1;
     }
-  } 
+    pos+= nwritten;
+    nbytes-= nwritten;
+    offset+= nwritten;
+  }
   return 0;
 }
 
+
 /*****************************************************
- ** 
- ** int dbm_FlushOldestColumn(doubleBufferedMatrix Matrix)
- **
- ** doubleBufferedMatrix Matrix
  **
- ** Writes what is stored in the oldest column (the first  in the
- ** buffer) to file.
+ ** Handling for the cache of open file descriptors.
  **
- ** Return 1 if problem, 0 if fine.
+ ** Rather than opening and closing a file on every
+ ** read or write, files are left open after use. The 
+ ** open files are kept on a list in order of use and 
+ ** once more than max_open_files are open the least
+ ** recently used one is closed.
  **
  *****************************************************/
 
+static void dbm_FileListRemove(doubleBufferedMatrix Matrix, int which){
 
-static int dbm_FlushOldestColumn(doubleBufferedMatrix Matrix){
+  int prev = Matrix->file_lru_prev[which];
+  int next = Matrix->file_lru_next[which];
 
-  int blocks_written;
-  
-  const char *mode2 ="rb+";
-  FILE *myfile;
-  
-  myfile = fopen(Matrix->filenames[Matrix->which_cols[0]],mode2);
-  
-  if (myfile == NULL){
-    return 1;
+  if (prev >= 0){
+    Matrix->file_lru_next[prev] = next;
+  } else {
+    Matrix->file_lru_head = next;
   }
-
-  fseek(myfile,0,SEEK_SET); 
-  blocks_written = fwrite(Matrix->coldata[0],sizeof(double),Matrix->rows,myfile);
-  fclose(myfile);  
-  if (blocks_written != Matrix->rows){
-      return 1;
+  if (next >= 0){
+    Matrix->file_lru_prev[next] = prev;
+  } else {
+    Matrix->file_lru_tail = prev;
   }
-  
-  return 0;
+  Matrix->file_lru_prev[which] = -1;
+  Matrix->file_lru_next[which] = -1;
+}
 
+
+static void dbm_FileListPushFront(doubleBufferedMatrix Matrix, int which){
+
+  Matrix->file_lru_prev[which] = -1;
+  Matrix->file_lru_next[which] = Matrix->file_lru_head;
+  if (Matrix->file_lru_head >= 0){
+    Matrix->file_lru_prev[Matrix->file_lru_head] = which;
+  } else {
+    Matrix->file_lru_tail = which;
+  }
+  Matrix->file_lru_head = which;
 }
 
 
 /*****************************************************
- ** 
- ** int dbm_FlushOldestColumn(doubleBufferedMatrix Matrix)
  **
- ** doubleBufferedMatrix Matrix
+ ** static void dbm_CloseFile(doubleBufferedMatrix Matrix, int which)
  **
- ** Writes what is stored in all the columns in the column buffer to
- ** file
+ ** closes the specified file if it is currently open
  **
- ** Return 1 if problem, 0 if fine.
+ *****************************************************/
+
+static void dbm_CloseFile(doubleBufferedMatrix Matrix, int which){
+
+  if (Matrix->file_fd[which] < 0){
+    return;
+  }
+  close(Matrix->file_fd[which]);
+  Matrix->file_fd[which] = -1;
+  dbm_FileListRemove(Matrix,which);
+  Matrix->n_open_files--;
+}
+
+
+/*****************************************************
  **
+ ** static void dbm_CloseAllFiles(doubleBufferedMatrix Matrix)
  **
- ****************************************************/
+ ** closes every file currently held open. This should be 
+ ** done before files are renamed or deleted.
+ **
+ *****************************************************/
 
+static void dbm_CloseAllFiles(doubleBufferedMatrix Matrix){
 
+  while (Matrix->file_lru_head >= 0){
+    dbm_CloseFile(Matrix,Matrix->file_lru_head);
+  }
+}
 
-static int dbm_FlushAllColumns(doubleBufferedMatrix Matrix){
 
+/* opens the file, for direct I/O when that is set and supported */
 
+static int dbm_OpenDescriptor(doubleBufferedMatrix Matrix, int which, int flags){
 
-  int k,lastcol;  
+#ifdef O_DIRECT
+  int fd;
 
-  int blocks_written;
-  
-  const char *mode2 ="rb+";
-  FILE *myfile;
- 
-  if (Matrix->cols < Matrix->max_cols){
-    lastcol = Matrix->cols;
-  } else {
-    lastcol = Matrix->max_cols;
-  }
-    
-  
-  for (k=0; k < lastcol; k++){
-    myfile = fopen(Matrix->filenames[Matrix->which_cols[k]],mode2);
-    if (myfile == NULL){
-      return 1;
+  if (Matrix->direct_io){
+    fd = open(Matrix->filenames[which], O_RDWR | O_BINARY | O_DIRECT | flags, 0666);
+    if (fd < 0 && errno == EINVAL){
+      /* the file system does not support direct I/O, fall back to dropping pages from the cache */
+      fd = open(Matrix->filenames[which], O_RDWR | O_BINARY | flags, 0666);
     }
-    fseek(myfile,0,SEEK_SET); 
-    blocks_written = fwrite(Matrix->coldata[k],sizeof(double),Matrix->rows,myfile);
-    fclose(myfile);  
-    if (blocks_written != Matrix->rows){
-      return 1;
-    }
- 
+    return fd;
   }
-
-  return 0;
-
+#endif
+  return open(Matrix->filenames[which], O_RDWR | O_BINARY | flags, 0666);
 }
 
 
 /*****************************************************
- ** 
- ** void dbm_LoadNewColumn(doubleBufferedMatrix Matrix,int col);
  **
- ** doubleBufferedMatrix Matrix
- ** int col - column of the matrix to load into the buffer
+ ** static int dbm_OpenFileFlags(doubleBufferedMatrix Matrix, int which, int flags)
  **
- ** Read the specified column into the column buffer (at the end of the buffer)
+ ** int which - index into filenames
+ ** int flags - flags for open() in addition to O_RDWR
  **
- ** Works by moving the oldest column from the  column buffer (at the beginning of the buffer)
- ** to the newest (at end) and then overwriting by reading in new data from file 
- **
- ** Returns 0 if successful, returns 1 if problem
+ ** Returns a file descriptor (opened for reading and writing)
+ ** for the specified file, opening it if it is not already open.
+ ** Returns -1 if there is a problem.
  **
- ****************************************************/
+ *****************************************************/
 
-static int dbm_LoadNewColumn(doubleBufferedMatrix Matrix,int col){
-  
-  const char *mode = "rb";
-  FILE *myfile;
-  double *tmpptr;
-  int lastcol;
-  int j;
-  int blocks_read;
+static int dbm_OpenFileFlags(doubleBufferedMatrix Matrix, int which, int flags){
 
-  if (Matrix->cols < Matrix->max_cols){
-    lastcol = Matrix->cols;
-  } else {
-    lastcol = Matrix->max_cols;
+  int fd;
+
+  if (Matrix->file_fd[which] >= 0){
+    if (Matrix->file_lru_head != which){
+      dbm_FileListRemove(Matrix,which);
+      dbm_FileListPushFront(Matrix,which);
+    }
+    return Matrix->file_fd[which];
   }
-  
-  tmpptr = Matrix->coldata[0];
 
-  for (j=1; j < lastcol; j++){
-    Matrix->coldata[j-1] = Matrix->coldata[j];
-    Matrix->which_cols[j-1] = Matrix->which_cols[j];
+  while (Matrix->n_open_files >= Matrix->max_open_files && Matrix->file_lru_tail >= 0){
+    dbm_CloseFile(Matrix,Matrix->file_lru_tail);
   }
-  
-  Matrix->which_cols[lastcol -1] = col;
-  Matrix->coldata[lastcol -1] = tmpptr;
-  
-  //printf("loading column %d \n",whichcol);
-  myfile = fopen(Matrix->filenames[col],mode);
-  if (myfile == NULL){
-    return 1;
-  }
-  fseek(myfile,0,SEEK_SET);
-  blocks_read = fread(Matrix->coldata[lastcol -1],sizeof(double),Matrix->rows,myfile);
-  fclose(myfile);
 
-  if (blocks_read != Matrix->rows){
-    return 1;
+  fd = dbm_OpenDescriptor(Matrix,which,flags);
+  if (fd < 0 && (errno == EMFILE || errno == ENFILE) && Matrix->n_open_files > 0){
+    /* the process has run out of descriptors. Give back half of ours and try again */
+    int nclose = (Matrix->n_open_files+1)/2;
+    while (nclose > 0){
+      dbm_CloseFile(Matrix,Matrix->file_lru_tail);
+      nclose--;
+    }
+    fd = dbm_OpenDescriptor(Matrix,which,flags);
   }
+  if (fd < 0){
+    return -1;
+  }
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+  if (Matrix->direct_io){
+    fcntl(fd,F_NOCACHE,1);
+  }
+#endif
 
-
-  return 0;
+  Matrix->file_fd[which] = fd;
+  dbm_FileListPushFront(Matrix,which);
+  Matrix->n_open_files++;
   
+  return fd;
 }
 
-/*****************************************************
- ** 
- ** void dbm_LoadNewColumn_nofill(doubleBufferedMatrix Matrix,int col);
- **
- ** doubleBufferedMatrix Matrix
- ** int col - column of the matrix to load into the buffer
- **
- ** Read the specified column into the column buffer (at the end of the buffer)
- **
- ** Works by moving the oldest column from the  column buffer (at the beginning of the buffer)
- ** to the newest (at end). Does not fill it with new data. The calling function should appropriately
- ** handle this.
- **
- ** WARNING: If you don't no why this function exists you should probably
- **          be calling dbm_LoadNewColumn instead
- **
- ** Returns 0 if successful, returns 1 if problem
- **
- ****************************************************/
 
-static int dbm_LoadNewColumn_nofill(doubleBufferedMatrix Matrix,int col){
-  
-  double *tmpptr;
-  int lastcol;
-  int j;
+static int dbm_OpenFile(doubleBufferedMatrix Matrix, int which){
 
+  return dbm_OpenFileFlags(Matrix,which,0);
+}
 
-  if (Matrix->cols < Matrix->max_cols){
-    lastcol = Matrix->cols;
-  } else {
-    lastcol = Matrix->max_cols;
-  }
-  
-  tmpptr = Matrix->coldata[0];
 
-  for (j=1; j < lastcol; j++){
-    Matrix->coldata[j-1] = Matrix->coldata[j];
-    Matrix->which_cols[j-1] = Matrix->which_cols[j];
-  }
-  
-  Matrix->which_cols[lastcol -1] = col;
-  Matrix->coldata[lastcol -1] = tmpptr;
-  
-  //printf("loading column %d \n",whichcol);
-  return 0;
-  
-}
+/* creates (or truncates) the file and leaves it open in the cache */
+
+static int dbm_CreateFile(doubleBufferedMatrix Matrix, int which){
 
+  dbm_CloseFile(Matrix,which);
+  return dbm_OpenFileFlags(Matrix,which,O_CREAT | O_TRUNC);
+}
 
 
 /*****************************************************
- ** 
- ** int dbm_LoadRowBuffer(doubleBufferedMatrix Matrix,int row)
  **
- ** doubleBufferedMatrix Matrix
- ** int row  - row to read into row buffer
+ ** Converting between the doubles in the buffers and the
+ ** type values are stored as in the files. dbm_ConvertToType
+ ** does the same for any storage type (used when exporting).
  **
- ** Reads the specified row and adjacent rows into the 
- ** row buffer.
- ** 
- ** Returns 0 if successful, returns 1 if problem
+ ** dbm_FromStorage converts in increasing order and reads
+ ** each value before writing the result, so src may be the
+ ** last n*dbm_ElementSize bytes of dest. Both are pure functions
+ ** of their arguments, so may be used from the I/O threads.
  **
  *****************************************************/
 
+static size_t dbm_TypeSize(int type){
+
+  switch (type){
+  case DBM_STORAGE_FLOAT:
+    return sizeof(float);
+  case DBM_STORAGE_UINT16:
+    return sizeof(unsigned short);
+  case DBM_STORAGE_INT32:
+    return sizeof(int);
+  case DBM_STORAGE_LOGICAL:
+    return sizeof(unsigned char);
+  }
+  return sizeof(double);
+}
 
+static size_t dbm_ElementSize(doubleBufferedMatrix Matrix){
 
+  return dbm_TypeSize(Matrix->storage_type);
+}
 
-static int dbm_LoadRowBuffer(doubleBufferedMatrix Matrix,int row){
+static void dbm_ConvertToType(int type, const double *src, void *dest, int n){
 
+  int i;
+  float *fdest;
+  unsigned short *udest;
+  int *idest;
+  unsigned char *ldest;
+  unsigned int na = DBM_FLOAT_NA;
+
+  switch (type){
+  case DBM_STORAGE_FLOAT:
+    fdest = (float *)dest;
+    for (i=0; i < n; i++){
+      if (ISNA(src[i])){
+	memcpy(&fdest[i],&na,sizeof(float));
+      } else {
+	fdest[i] = (float)src[i];
+      }
+    }
+    break;
+  case DBM_STORAGE_UINT16:
+    udest = (unsigned short *)dest;
+    for (i=0; i < n; i++){
+      if (ISNAN(src[i])){
+	udest[i] = DBM_UINT16_NA;
+      } else if (src[i] <= 0.0){
+	udest[i] = 0;
+      } else if (src[i] >= DBM_UINT16_NA - 1){
+	udest[i] = DBM_UINT16_NA - 1;
+      } else {
+	udest[i] = (unsigned short)(src[i] + 0.5);
+      }
+    }
+    break;
+  case DBM_STORAGE_INT32:
+    idest = (int *)dest;
+    for (i=0; i < n; i++){
+      /* truncated, as.integer() also gives NA when out of range */
+      if (ISNAN(src[i]) || src[i] >= 2147483648.0 || src[i] <= -2147483648.0){
+	idest[i] = NA_INTEGER;
+      } else {
+	idest[i] = (int)src[i];
+      }
+    }
+    break;
+  case DBM_STORAGE_LOGICAL:
+    ldest = (unsigned char *)dest;
+    for (i=0; i < n; i++){
+      if (ISNAN(src[i])){
+	ldest[i] = DBM_LOGICAL_NA;
+      } else {
+	ldest[i] = (src[i] != 0.0);
+      }
+    }
+    break;
+  default:
+    memcpy(dest,src,(size_t)n*sizeof(double));
+  }
+}
 
-  const char *mode = "rb";
-  FILE *myfile;
-  int j,k;
-  int lastcol;
-  int curcol;
-  int blocks_read;
+static void dbm_ToStorage(doubleBufferedMatrix Matrix, const double *src, void *dest, int n){
 
+  dbm_ConvertToType(Matrix->storage_type,src,dest,n);
+}
 
+static void dbm_FromStorage(doubleBufferedMatrix Matrix, const void *src, double *dest, int n){
 
-  if (Matrix->cols < Matrix->max_cols){
-    lastcol = Matrix->cols;
-  } else {
-    lastcol = Matrix->max_cols;
-  }
-  
-  if (row > Matrix->rows - Matrix->max_rows){
-    Matrix->first_rowdata = Matrix->rows - Matrix->max_rows;
-  } else {
-    Matrix->first_rowdata = row;
+  int i;
+  float value;
+  unsigned short ivalue;
+  int value32;
+  unsigned char lvalue;
+  unsigned int bits;
+  const char *pos = (const char *)src;
+
+  switch (Matrix->storage_type){
+  case DBM_STORAGE_FLOAT:
+    for (i=0; i < n; i++){
+      memcpy(&value,pos + i*sizeof(float),sizeof(float));
+      memcpy(&bits,&value,sizeof(float));
+      dest[i] = (bits == DBM_FLOAT_NA) ? NA_REAL : (double)value;
+    }
+    break;
+  case DBM_STORAGE_UINT16:
+    for (i=0; i < n; i++){
+      memcpy(&ivalue,pos + i*sizeof(unsigned short),sizeof(unsigned short));
+      dest[i] = (ivalue == DBM_UINT16_NA) ? NA_REAL : (double)ivalue;
+    }
+    break;
+  case DBM_STORAGE_INT32:
+    for (i=0; i < n; i++){
+      memcpy(&value32,pos + i*sizeof(int),sizeof(int));
+      dest[i] = (value32 == NA_INTEGER) ? NA_REAL : (double)value32;
+    }
+    break;
+  case DBM_STORAGE_LOGICAL:
+    for (i=0; i < n; i++){
+      lvalue = (unsigned char)pos[i];
+      dest[i] = (lvalue == DBM_LOGICAL_NA) ? NA_REAL : (double)lvalue;
+    }
+    break;
+  default:
+    memmove(dest,src,(size_t)n*sizeof(double));
   }
-    
-  for (j =0; j < Matrix->cols; j++){
-    
-    myfile = fopen(Matrix->filenames[j],mode);
-
-    if (myfile == NULL)
-      return 1;
-
+}
 
-    fseek(myfile,Matrix->first_rowdata*sizeof(double),SEEK_SET);
-    blocks_read = fread(&(Matrix->rowdata)[j][0],sizeof(double),Matrix->max_rows,myfile);
 
-    fclose(myfile);  
+/*****************************************************
+ **
+ ** Values entering the buffers.
+ **
+ ** dbm_StorageValue gives the value that would be read back
+ ** after value has been written to the storage files, ie
+ ** rounded, clamped or narrowed as dbm_ToStorage does. Every
+ ** value stored in the buffers goes through it (or through
+ ** dbm_StorageValues, in place on n values), so what is in 
+ ** memory always matches what is, or will be, on disk.
+ **
+ *****************************************************/
 
-    if (blocks_read != Matrix->max_rows){
-      return 1;
+static double dbm_StorageValue(doubleBufferedMatrix Matrix, double value){
+
+  switch (Matrix->storage_type){
+  case DBM_STORAGE_FLOAT:
+    return ISNA(value) ? NA_REAL : (double)(float)value;
+  case DBM_STORAGE_UINT16:
+    if (ISNAN(value)){
+      return NA_REAL;
+    } else if (value <= 0.0){
+      return 0.0;
+    } else if (value >= DBM_UINT16_NA - 1){
+      return (double)(DBM_UINT16_NA - 1);
     }
-
-  }
-  
-  for (j =0; j < Matrix->cols; j++){
-    curcol =0;
-    while (curcol < lastcol){
-      if (Matrix->which_cols[curcol] == j){
-	for (k= Matrix->first_rowdata; k < Matrix->first_rowdata + Matrix->max_rows; k++){
-	  Matrix->rowdata[j][k- Matrix->first_rowdata] = Matrix->coldata[curcol][k];
-	}	
-      }
-      curcol++;
+    return (double)(unsigned short)(value + 0.5);
+  case DBM_STORAGE_INT32:
+    if (ISNAN(value) || value >= 2147483648.0 || value <= -2147483648.0){
+      return NA_REAL;
     }
+    return (double)(int)value;
+  case DBM_STORAGE_LOGICAL:
+    return ISNAN(value) ? NA_REAL : (double)(value != 0.0);
   }
+  return value;
+}
 
-  return 0;
+static void dbm_StorageValues(doubleBufferedMatrix Matrix, double *values, int n){
+
+  int i;
 
+  if (Matrix->storage_type == DBM_STORAGE_DOUBLE){
+    return;
+  }
+  for (i=0; i < n; i++){
+    values[i] = dbm_StorageValue(Matrix,values[i]);
+  }
 }
 
 
+/* writes n values to the file at offset, converting them to the storage type a piece at a time */
 
+static int dbm_pwriteConverted(doubleBufferedMatrix Matrix, int fd, const double *src, int n, dbm_offset offset){
 
+  char converted[DBM_CONVERT_CHUNK];
+  size_t size = dbm_ElementSize(Matrix);
+  int chunk = (int)(DBM_CONVERT_CHUNK/size);
+  int m;
+
+  while (n > 0){
+    m = (n < chunk) ? n : chunk;
+    dbm_ToStorage(Matrix,src,converted,m);
+    if (dbm_pwrite(fd,converted,(size_t)m*size,offset)){
+      return 1;
+    }
+    src+= m;
+    n-= m;
+    offset+= (dbm_offset)m*size;
+  }
+  return 0;
+}
 
 
 /*****************************************************
- ** 
- ** int dbm_LoadAdditionalColumn(doubleBufferedMatrix Matrix,int col, int where)
  **
- ** doubleBufferedMatrix Matrix
- ** int col - column to read into buffer
- ** int where - which column of the buffer do we read it into.
+ ** Locating a column in the storage files. 
  **
- ** Allocates space and reads in a new column of data.
- ** 
- ** Returns 0 if successful, returns 1 if problem
+ ** dbm_FileOfColumn gives the index (into filenames) of the file
+ ** holding the column, dbm_ColumnOffset the byte offset of
+ ** the specified row of the column within that file.
  **
  *****************************************************/
 
+static int dbm_FileOfColumn(doubleBufferedMatrix Matrix, int col){
 
-static int dbm_LoadAdditionalColumn(doubleBufferedMatrix Matrix,int col, int where){
-  const char *mode = "rb";
-  FILE *myfile;
-  int blocks_read;
+  return col/Matrix->cols_per_file;
+}
 
-  Matrix->coldata[where] = Calloc(Matrix->rows,double);
-  Matrix->which_cols[where] = col;
-  myfile = fopen(Matrix->filenames[col],mode);
-  if (myfile == NULL)
-    return 1;
-  fseek(myfile,0,SEEK_SET);
-  blocks_read = fread(Matrix->coldata[where],sizeof(double),Matrix->rows,myfile);
-  fclose(myfile);
+static dbm_offset dbm_ColumnOffset(doubleBufferedMatrix Matrix, int col, int row){
 
-  if (blocks_read != Matrix->rows)
-    return 1;
+  int block_start, block_rows;
 
+  if (Matrix->tile_rows == 0){
+    return ((dbm_offset)(col % Matrix->cols_per_file)*Matrix->rows + row)*(dbm_offset)dbm_ElementSize(Matrix);
+  }
+  dbm_TileBlock(Matrix,row,&block_start,&block_rows);
+  return ((dbm_offset)block_start*Matrix->cols_per_file + (dbm_offset)(col % Matrix->cols_per_file)*block_rows + (row - block_start))*(dbm_offset)dbm_ElementSize(Matrix);
+}
 
-  return 0;
+/* in the tiled layout, the first row and number of rows of the block containing row */
+
+static void dbm_TileBlock(doubleBufferedMatrix Matrix, int row, int *block_start, int *block_rows){
+
+  *block_start = row - row % Matrix->tile_rows;
+  *block_rows = Matrix->rows - *block_start;
+  if (*block_rows > Matrix->tile_rows){
+    *block_rows = Matrix->tile_rows;
+  }
 }
 
+
 /*****************************************************
- ** 
- ** double *dbm_internalgetValue(doubleBufferedMatrix Matrix,int row, int col)
  **
+ ** static int dbm_ColumnIO(doubleBufferedMatrix Matrix, int fd, int col, int first_row, int nrows, double *buf, int write)
  **
- ** this function returns a pointer to a location containing current value
- ** of element located at (row,col) in the matrix. Carries out all the necessary
- ** mechanics of loading it into the buffer if it is not there currently.
+ ** int fd - open descriptor for the file holding col
+ ** int col - column of the matrix
+ ** int first_row, nrows - the rows to transfer
+ ** double *buf - nrows values
+ ** int write - if true write buf to file, otherwise read into buf
+ **
+ ** Transfers a contiguous section of a column, a piece at a time 
+ ** in the tiled layout. Touches nothing in Matrix other than
+ ** the layout so may be called from the I/O threads.
+ **
+ ** Returns 0 if successful, 1 if problem
  **
  *****************************************************/
 
-static double *dbm_internalgetValue(doubleBufferedMatrix Matrix,int row, int col){
-  
-  
-  int whichcol = col;
-  int whichrow = row;
- 
-  int curcol;
- 
+static int dbm_ColumnIO(doubleBufferedMatrix Matrix, int fd, int col, int first_row, int nrows, double *buf, int write){
 
-  if (!(Matrix->colmode)){
-    /* Fix up any potential clashes */
-    if ((Matrix->rowcolclash)){
-      dbm_ClearClash(Matrix);
+  int n, block_start, block_rows;
+  int result;
+  size_t size = dbm_ElementSize(Matrix);
+
+  while (nrows > 0){
+    n = nrows;
+    if (Matrix->tile_rows){
+      dbm_TileBlock(Matrix,first_row,&block_start,&block_rows);
+      if (n > block_start + block_rows - first_row){
+	n = block_start + block_rows - first_row;
+      }
     }
-    
-    /* check to see if this cell is in row buffer, then column buffer, then read from files */
-    
-    if (dbm_InRowBuffer(Matrix,whichrow,whichcol)){
-      /* In row buffer so return */
-      if (dbm_InColBuffer(Matrix,whichrow,whichcol,&curcol)){
-	dbm_SetClash(Matrix, whichrow,whichcol);
+    if (size == sizeof(double)){
+      if (write){
+	result = dbm_pwrite(fd,buf,(size_t)n*sizeof(double),dbm_ColumnOffset(Matrix,col,first_row));
+      } else {
+	result = dbm_pread(fd,buf,(size_t)n*sizeof(double),dbm_ColumnOffset(Matrix,col,first_row));
       }
-      
-      return &(Matrix->rowdata[whichcol][whichrow - Matrix->first_rowdata]);
-    } else if (dbm_InColBuffer(Matrix,whichrow,whichcol,&curcol)){
-      return &(Matrix->coldata[curcol][whichrow]);
+    } else if (write){
+      result = dbm_pwriteConverted(Matrix,fd,buf,n,dbm_ColumnOffset(Matrix,col,first_row));
     } else {
-      
-      /* looks like we are going to have to go to files */
-      //printf("Couldn't find in buffers\n");
-
-      if (!(Matrix->readonly)){
-	/* Flush buffers */ 
-	/* First row buffer */
-	dbm_FlushRowBuffer(Matrix);
-      
-	/* Now flush the column buffer (for oldest column) */
-	dbm_FlushOldestColumn(Matrix);
+      /* read into the end of buf then expand in place */
+      result = dbm_pread(fd,(char *)buf + (sizeof(double) - size)*n,(size_t)n*size,dbm_ColumnOffset(Matrix,col,first_row));
+      if (!result){
+	dbm_FromStorage(Matrix,(char *)buf + (sizeof(double) - size)*n,buf,n);
       }
-      
-      /* Now fill up the buffer */
-      /* read in this row and surrounding rows into row buffer */
-      dbm_LoadRowBuffer(Matrix,whichrow);
-      
-      /* read in this column into column buffer */
-      dbm_LoadNewColumn(Matrix,whichcol);
-      
-      
-      dbm_SetClash(Matrix,whichrow,whichcol);
-      return &(Matrix->rowdata[whichcol][whichrow - Matrix->first_rowdata]);
-    
     }
-  } else {
-    if (dbm_InColBuffer(Matrix,whichrow,whichcol,&curcol)){
-      return &(Matrix->coldata[curcol][whichrow]);
-    } else {
-      if (!(Matrix->readonly))
-	dbm_FlushOldestColumn(Matrix); 
-      dbm_LoadNewColumn(Matrix,whichcol);
-      return &(Matrix->coldata[Matrix->max_cols -1][whichrow]);
+    if (result){
+      return 1;
     }
-
+    buf+= n;
+    first_row+= n;
+    nrows-= n;
   }
+  return 0;
+}
 
-   
+/* number of storage files currently in use */
+
+static int dbm_NumFiles(doubleBufferedMatrix Matrix){
+
+  return (Matrix->cols + Matrix->cols_per_file - 1)/Matrix->cols_per_file;
+}
+
+
+/* in direct I/O mode, tells the OS the part of the file holding column col is not needed in the page cache */
+
+static void dbm_DropCache(doubleBufferedMatrix Matrix, int fd, int col){
+
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+  dbm_offset start, end;
+
+  if (!Matrix->direct_io || Matrix->rows == 0){
+    return;
+  }
+  start = dbm_ColumnOffset(Matrix,col,0);
+  end = dbm_ColumnOffset(Matrix,col,Matrix->rows - 1) + dbm_ElementSize(Matrix);
+  posix_fadvise(fd,start,end - start,POSIX_FADV_DONTNEED);
+#endif
 }
 
 
 /*****************************************************
- ** 
- ** static int *dbm_whatsInColumnBuffer(doubleBufferedMatrix Matrix)
  **
- ** Returns a pointer to a vector containing column indices 
+ ** static int dbm_ReadColumnData(doubleBufferedMatrix Matrix, int col, int first_row, int nrows, double *dest)
+ **
+ ** int col - column of the matrix
+ ** int first_row - first row to read
+ ** int nrows - number of consecutive rows to read
+ ** double *dest - location to store values (at least nrows long)
+ **
+ ** Reads a contiguous section of a column from its file
+ ** (or zeros it if it has never been written).
  **
+ ** Returns 0 if successful, 1 if problem
  **
  *****************************************************/
 
+static int dbm_ReadColumnData(doubleBufferedMatrix Matrix, int col, int first_row, int nrows, double *dest){
 
-static int *dbm_whatsInColumnBuffer(doubleBufferedMatrix Matrix){
+  int fd;
 
-  return Matrix->which_cols;
-  
-}
+  if (Matrix->memory_mapped){
+    memcpy(dest,dbm_ColumnView(Matrix,col) + first_row,(size_t)nrows*sizeof(double));
+    return 0;
+  }
 
+  /* the file must first receive any write of the column still pending */
+  if (dbm_WriteBehindSync(Matrix,col)){
+    return 1;
+  }
 
+  if (Matrix->col_zero[col]){
+    memset(dest,0,(size_t)nrows*sizeof(double));
+    return 0;
+  }
 
+  fd = dbm_OpenFile(Matrix,dbm_FileOfColumn(Matrix,col));
 
+  if (fd < 0 || dbm_ColumnIO(Matrix,fd,col,first_row,nrows,dest,0)){
+    return 1;
+  }
+  if (nrows == Matrix->rows){
+    dbm_DropCache(Matrix,fd,col);
+  }
+  return 0;
+}
 
 
 /*****************************************************
- *****************************************************
- *****************************************************
  **
- ** The following are functions that should be considered
- ** exposed to the real world. Ie the constitute the 
- ** API that might be used by others.
- ** Every thing above this point is internal, subject to
- ** be changed and not to be called except from within
- ** the routines below.
- ** 
+ ** static int dbm_WriteColumnData(doubleBufferedMatrix Matrix, int col, int first_row, int nrows, const double *src)
  **
+ ** int col - column of the matrix
+ ** int first_row - first row to write
+ ** int nrows - number of consecutive rows to write
+ ** const double *src - values to be written
  **
+ ** Writes a contiguous section of a column out to its file.
+ **
+ ** Returns 0 if successful, 1 if problem
  **
- *****************************************************
- *****************************************************
- *****************************************************/
-
-/*****************************************************
- **
- ** doubleBufferedMatrix dbm_alloc(int max_rows,int max_cols,const char *prefix, const char *directory)
- **
- ** int max_rows - maximum number of rows that can be stored in the row buffer (if it is activated)
- ** int max_cols - maximum number of columns that can be stored in the column buffer
- ** const char *prefix - character string to use for start of filename for temporary files. 
- ** const char *directory - character string for 
- **
- ** 
- ** RETURNS an allocated empty doubleBufferedMatrix. Note that this routine
- **         does not actually allocate the space for the data that is stored.
- **         This is done by the AddColumn routine.
- **                               
- **
  *****************************************************/
 
+static int dbm_WriteColumnData(doubleBufferedMatrix Matrix, int col, int first_row, int nrows, const double *src){
 
-doubleBufferedMatrix dbm_alloc(int max_rows,int max_cols,const char *prefix, const char *directory){
-  
-  char *tmp;
+  int fd;
 
-  struct _double_buffered_matrix *handle;
+  if (Matrix->memory_mapped){
+    memcpy(dbm_ColumnView(Matrix,col) + first_row,src,(size_t)nrows*sizeof(double));
+    return 0;
+  }
 
-  
-  handle = (struct _double_buffered_matrix *)Calloc(1,struct _double_buffered_matrix);
+  /* any copy read ahead of time would now be out of date, and a pending write must not land after this one */
+  dbm_PrefetchInvalidate(Matrix,col);
+  if (dbm_WriteBehindSync(Matrix,col)){
+    return 1;
+  }
+  Matrix->col_zero[col] = 0;
 
+  fd = dbm_OpenFile(Matrix,dbm_FileOfColumn(Matrix,col));
 
+  if (fd < 0 || dbm_ColumnIO(Matrix,fd,col,first_row,nrows,(double *)src,1)){
+    return 1;
+  }
+  if (nrows == Matrix->rows){
+    dbm_DropCache(Matrix,fd,col);
+  }
+  return 0;
+}
 
 
-  handle->rows =0;
-  handle->cols =0;
-  handle->max_rows = max_rows;
-  handle->max_cols = max_cols;
-  
-  handle->coldata = 0;
-  handle->rowdata = 0;
-  
-  handle->which_cols = 0;
+/*****************************************************
+ **
+ ** static int dbm_ReadAdjacentColumns(doubleBufferedMatrix Matrix, int first_col, int ncols, double **dest)
+ **
+ ** int first_col - first column to read
+ ** int ncols - number of consecutive columns to read
+ ** double **dest - dest[k] is where column first_col + k should be stored
+ **
+ ** Reads a run of adjacent columns in their entirety. Columns
+ ** that share a storage file are stored one after another so 
+ ** they are read with a single call (in chunks of at most 
+ ** DBM_MAX_READ_CHUNK bytes) and then distributed into place.
+ ** The reads from different files are carried out as a batch
+ ** by the I/O threads, so files in different directories (see
+ ** dbm_setDirectories) are read at the same time.
+ **
+ ** Returns 0 if successful, 1 if problem
+ **
+ *****************************************************/
 
-  handle->filenames = 0;
-  
-  handle->first_rowdata =0;
+static int dbm_ReadAdjacentColumns(doubleBufferedMatrix Matrix, int first_col, int ncols, double **dest){
+
+  int j, k, n, nreq, fd, result = 0;
+  int nfiles, lastfile, file;
+  int row, block_start, block_rows;
+  int col = first_col;
+  int chunk_cols, used, capacity;
+  size_t size = dbm_ElementSize(Matrix);
+  char *scratch = NULL, *base;
+  dbm_io_request *requests;
+  dbm_row_span *spans;
+
+  /* the files must first receive any pending writes of these columns */
+  for (k=0; k < ncols; k++){
+    if (dbm_WriteBehindSync(Matrix,first_col + k)){
+      return 1;
+    }
+  }
 
-  tmp = Calloc(strlen(prefix)+1,char);
-  strcpy(tmp,prefix);
+  if (Matrix->rows == 0 || Matrix->memory_mapped){
+    for (k=0; k < ncols; k++){
+      if (dbm_ReadColumnData(Matrix,first_col + k,0,Matrix->rows,dest[k])){
+	return 1;
+      }
+    }
+    return 0;
+  }
 
-  handle->fileprefix = tmp;
-  
-  tmp = Calloc(strlen(directory)+1,char);
-  strcpy(tmp,directory);
-  
-  handle->filedirectory = tmp;
+  chunk_cols = DBM_MAX_READ_CHUNK/(Matrix->rows*sizeof(double));
+  if (chunk_cols < Matrix->ndirectories){
+    chunk_cols = Matrix->ndirectories;  /* enough to read from every directory at once */
+  }
+  if (chunk_cols < 1){
+    chunk_cols = 1;
+  }
+  if (chunk_cols > ncols){
+    chunk_cols = ncols;
+  }
 
-  handle->rowcolclash = 0;
+  if (Matrix->cols_per_file > 1){
+    scratch = (char *)Calloc((size_t)chunk_cols*Matrix->rows,double);
+  }
+  capacity = 16;
+  requests = Calloc(capacity,dbm_io_request);
+  spans = Calloc(capacity,dbm_row_span);
+
+  while (col < first_col + ncols && !result){
+    /* a batch of reads, each of one column or of a run of columns from one file into scratch */
+    nreq = 0;
+    nfiles = 0;
+    lastfile = -1;
+    used = 0;
+    while (col < first_col + ncols){
+      if (Matrix->col_zero[col]){
+	memset(dest[col - first_col],0,(size_t)Matrix->rows*sizeof(double));
+	col++;
+	continue;
+      }
+      /* columns up to the end of this file, end of the request, end of the scratch space or a column never written */
+      n = Matrix->cols_per_file - col % Matrix->cols_per_file;
+      if (n > first_col + ncols - col){
+	n = first_col + ncols - col;
+      }
+      if (n > 1 && n > chunk_cols - used){
+	n = chunk_cols - used;
+      }
+      for (k=1; k < n; k++){
+	if (Matrix->col_zero[col + k]){
+	  n = k;
+	}
+      }
+      if (n == 0){
+	break;
+      }
+      file = dbm_FileOfColumn(Matrix,col);
+      if (file != lastfile){
+	if (nfiles == Matrix->max_open_files){
+	  break;  /* opening another file could close one this batch is using */
+	}
+	nfiles++;
+	lastfile = file;
+      }
+      fd = dbm_OpenFile(Matrix,file);
+      if (fd < 0){
+	result = 1;
+	break;
+      }
 
-  handle->colmode = 1;        /* Always start of in column mode */
+      /* in the tiled layout the columns are contiguous within each block of rows */
+      base = (n > 1) ? scratch + (size_t)used*Matrix->rows*size : NULL;
+      for (row = 0; row < Matrix->rows; row+= block_rows){
+	if (Matrix->tile_rows && n > 1){
+	  dbm_TileBlock(Matrix,row,&block_start,&block_rows);
+	} else {
+	  block_rows = Matrix->rows;
+	}
+	if (nreq == capacity){
+	  capacity = 2*capacity;
+	  requests = Realloc(requests,capacity,dbm_io_request);
+	  spans = Realloc(spans,capacity,dbm_row_span);
+	}
+	requests[nreq].fd = fd;
+	requests[nreq].write = 0;
+	spans[nreq].col = col;
+	spans[nreq].ncols = n;
+	spans[nreq].first = row;
+	spans[nreq].nrows = block_rows;
+	spans[nreq].stride = block_rows;
+	if (n == 1){
+	  requests[nreq].col = col;
+	  requests[nreq].first_row = 0;
+	  requests[nreq].nrows = Matrix->rows;
+	  requests[nreq].buf = dest[col - first_col];
+	  spans[nreq].scratch = NULL;
+	} else {
+	  requests[nreq].col = -1;
+	  requests[nreq].offset = dbm_ColumnOffset(Matrix,col,row);
+	  requests[nreq].nbytes = (size_t)n*block_rows*size;
+	  requests[nreq].buf = (double *)(base + (size_t)row*n*size);
+	  spans[nreq].scratch = requests[nreq].buf;
+	}
+	nreq++;
+      }
+      if (n > 1){
+	used+= n;
+      }
+      col+= n;
+    }
 
-  handle->readonly=0;
-  
-  return (doubleBufferedMatrix)handle;
+    if (result || (nreq > 0 && dbm_RunIOBatch(Matrix,requests,nreq))){
+      result = 1;
+      break;
+    }
+    for (k=0; k < nreq; k++){
+      if (spans[k].scratch != NULL){
+	for (j=0; j < spans[k].ncols; j++){
+	  dbm_FromStorage(Matrix,(char *)spans[k].scratch + (size_t)j*spans[k].stride*size,&dest[spans[k].col - first_col + j][spans[k].first],spans[k].nrows);
+	}
+      }
+      if (spans[k].first == 0){
+	for (j=0; j < spans[k].ncols; j++){
+	  dbm_DropCache(Matrix,requests[k].fd,spans[k].col + j);
+	}
+      }
+    }
+  }
 
+  if (scratch != NULL){
+    Free(scratch);
+  }
+  Free(requests);
+  Free(spans);
+  return result;
 }
 
+
 /*****************************************************
  **
- ** int dbm_free(doubleBufferedMatrix Matrix)
- ** 
- ** doubleBufferedMatrix *Matrix 
- ** 
- ** Deallocates all allocated space and deletes temporary files
+ ** Memory mapped mode
+ **
+ ** static int dbm_MapFile(doubleBufferedMatrix Matrix, int which)
+ **
+ ** Extends the (newly created) file to hold cols_per_file
+ ** columns and maps it into memory. 
+ **
+ ** Returns 0 if successful, 1 if problem
  **
  *****************************************************/
 
-int dbm_free(doubleBufferedMatrix Matrix){
-  
-  int i;
-  int lastcol;
-  struct _double_buffered_matrix *handle;
-  
-  handle = Matrix;
+static int dbm_MapFile(doubleBufferedMatrix Matrix, int which){
 
-  if (handle->cols < handle->max_cols){
-    lastcol = handle->cols;
-  } else {
-    lastcol = handle->max_cols;
+#ifdef _WIN32
+  return 1;
+#else
+  size_t size = (size_t)Matrix->cols_per_file*Matrix->rows*sizeof(double);
+  void *map;
+  int fd;
+
+  Matrix->file_map[which] = NULL;
+
+  if (size == 0){
+    return 0;
   }
 
-  for (i=0; i < handle->cols; i++){
-    //printf("%s\n",filenames[i]);
-    remove(handle->filenames[i]);
+  fd = dbm_OpenFile(Matrix,which);
+  if (fd < 0){
+    return 1;
+  }
+  
+  if (ftruncate(fd,(dbm_offset)size)){
+    return 1;
+  }
+  
+  map = mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+  if (map == MAP_FAILED){
+    return 1;
   }
+  Matrix->file_map[which] = (char *)map;
 
-  Free(handle->which_cols);
+  /* the mapping stays valid after the descriptor is closed, so no need to hold it open */
+  dbm_CloseFile(Matrix,which);
+  return 0;
+#endif
+}
 
-  for (i = 0; i < handle->cols; i++){
-    Free(handle->filenames[i]);
+
+static void dbm_UnmapAllFiles(doubleBufferedMatrix Matrix){
+
+#ifndef _WIN32
+  int i;
+  size_t size = (size_t)Matrix->cols_per_file*Matrix->rows*sizeof(double);
+
+  if (!Matrix->memory_mapped){
+    return;
   }
-  Free(handle->filenames);
 
-  if (!(handle->colmode)){
-    for (i=0; i < handle->cols; i++){
-      Free(handle->rowdata[i]);
+  for (i=0; i < dbm_NumFiles(Matrix); i++){
+    if (Matrix->file_map[i] != NULL){
+      munmap(Matrix->file_map[i],size);
+      Matrix->file_map[i] = NULL;
     }
-    Free(handle->rowdata);
   }
+#endif
+}
 
 
-  for (i=0; i < lastcol; i++){
-    Free(handle->coldata[i]);
-  }
-  Free(handle->coldata);
-  
+/* location of the column within the mapped files */
 
-  Free(handle->fileprefix);
-  Free(handle->filedirectory);
+static double *dbm_ColumnView(doubleBufferedMatrix Matrix, int col){
 
-  Free(handle);
-  return 0;
+  return (double *)(Matrix->file_map[dbm_FileOfColumn(Matrix,col)] + dbm_ColumnOffset(Matrix,col,0));
 }
 
 
 /*****************************************************
  **
- ** int dbm_setRows(doubleBufferedMatrix Matrix, int Rows)
+ ** static double *dbm_NewColumnSlot(doubleBufferedMatrix Matrix, int col)
  **
- ** doubleBufferedMatrix Matrix
- ** int Rows - number of rows in each column of the matrix
- ** 
- ** returns 1 if successful, 0 otherwise
+ ** Returns space for column col in the column buffer. Normally
+ ** this is newly allocated and must be filled in by the caller,
+ ** when memory mapped it is a view of the column itself.
  **
- ** Note that this function sets the number of rows in
- ** the matrix. Once set the number of rows can not be altered.
+ ** static void dbm_ReleaseColumnSlot(doubleBufferedMatrix Matrix, double *slot)
+ **
+ ** Gives back space returned by dbm_NewColumnSlot. When memory
+ ** mapped the OS is told the pages are no longer needed.
  **
  *****************************************************/
 
+static double *dbm_NewColumnSlot(doubleBufferedMatrix Matrix, int col){
 
-int dbm_setRows(doubleBufferedMatrix Matrix, int Rows){
-
-
-  if (Matrix->rows > 0){
-    return 0;
+  if (Matrix->memory_mapped){
+    return dbm_ColumnView(Matrix,col);
   }
+  return Calloc(Matrix->rows,double);
+}
 
-  Matrix->rows = Rows;
-
-  if (Matrix->rows < Matrix->max_rows){
-    Matrix->max_rows = Matrix->rows;
-  }
 
-  
-  return 1;
+static void dbm_ReleaseColumnSlot(doubleBufferedMatrix Matrix, double *slot){
 
+  if (!Matrix->memory_mapped){
+    Free(slot);
+    return;
+  }
+#if !defined(_WIN32) && defined(MADV_DONTNEED)
+  {
+    /* only whole pages lying entirely within the column */
+    size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = ((size_t)slot + pagesize - 1)/pagesize*pagesize;
+    size_t end = ((size_t)(slot + Matrix->rows))/pagesize*pagesize;
+    
+    if (end > start){
+      madvise((void *)start,end - start,MADV_DONTNEED);
+    }
+  }
+#endif
 }
 
+
 /*****************************************************
  **
- ** int dbm_AddColumn(doubleBufferedMatrix Matrix)
- ** 
- ** doubleBufferedMatrix Matrix
- **
- ** Adds an additional column to the matrix at edge of 
- ** Matrix. Note this entails creating an additional 
- ** temporary file. Note also that the number of rows 
- ** in the matrix should have already been set by 
- ** Previously calling dbm_setRows().
+ ** Prefetching
  **
- ** RETURNS 0 is successful and 1 if problem
+ ** The background thread takes queued requests in the order
+ ** they were made and reads each column into its entry. The
+ ** lock is not held while reading. The thread only ever uses
+ ** the file descriptor and buffer in the entry it is working on.
  **
  *****************************************************/
 
+#ifdef DBM_HAVE_THREADS
 
-int dbm_AddColumn(doubleBufferedMatrix Matrix){
-
-  
-  FILE *myfile;
-  int j;
-  int which_col_num;
+static void *dbm_PrefetchWorker(void *arg){
 
-  int blocks_written;
-  
-  /* Handle the housekeeping of indices, clearing buffer if needed etc */
-  if (Matrix->cols < Matrix->max_cols){
-    /* No need to clear out column buffer */
-    int *temp_indices = Calloc(Matrix->cols+1, int);
-    int *temp_old_indices = Matrix->which_cols;
-    double **temp_ptr = Calloc(Matrix->cols +1,double *);
-    double **old_temp_ptr = Matrix->coldata;
+  doubleBufferedMatrix Matrix = (doubleBufferedMatrix)arg;
+  dbm_prefetch_entry *entry;
+  int k, next, fd, result;
 
-    for (j =0; j < Matrix->cols; j++){
-      temp_indices[j] = Matrix->which_cols[j];
-      temp_ptr[j] = Matrix->coldata[j];
+  pthread_mutex_lock(&Matrix->prefetch_lock);
+  while (!Matrix->prefetch_shutdown){
+    next = -1;
+    for (k=0; k < Matrix->prefetch_depth; k++){
+      if (Matrix->prefetch[k].state == DBM_PF_QUEUED && (next < 0 || Matrix->prefetch[k].seq < Matrix->prefetch[next].seq)){
+	next = k;
+      }
+    }
+    if (next < 0){
+      pthread_cond_wait(&Matrix->prefetch_work,&Matrix->prefetch_lock);
+      continue;
     }
-    temp_indices[Matrix->cols] =Matrix->cols;
-    temp_ptr[Matrix->cols] = Calloc(Matrix->rows,double);
 
-    Matrix->coldata = temp_ptr;
-    
-    /* for (i =0; i < Matrix->rows; i++){
-       Matrix->coldata[Matrix->cols][i] = 0.0;  //(cols)*rows + i; 
-       } */
-    memset(&Matrix->coldata[Matrix->cols][0],0,sizeof(double)* Matrix->rows);
+    entry = &Matrix->prefetch[next];
+    entry->state = DBM_PF_READING;
+    fd = entry->fd;
+    entry->fd = -1;
+    pthread_mutex_unlock(&Matrix->prefetch_lock);
 
+    result = dbm_ColumnIO(Matrix,fd,entry->col,0,Matrix->rows,entry->data,0);
+    if (!result){
+      dbm_DropCache(Matrix,fd,entry->col);
+    }
+    close(fd);
 
+    pthread_mutex_lock(&Matrix->prefetch_lock);
+    entry->state = result ? DBM_PF_FAILED : DBM_PF_READY;
+    pthread_cond_broadcast(&Matrix->prefetch_done);
+  }
+  pthread_mutex_unlock(&Matrix->prefetch_lock);
 
-    which_col_num = Matrix->cols;
-    Matrix->which_cols = temp_indices;
-    Free(temp_old_indices);
-    Free(old_temp_ptr);
+  return NULL;
+}
 
-    if (!(Matrix->colmode)){
-      /* Now handle the row buffer */
-      old_temp_ptr = Matrix->rowdata;
-      temp_ptr = Calloc(Matrix->cols+1,double *);
-      
-      for (j =0; j <  Matrix->cols; j++){
-	temp_ptr[j] =  Matrix->rowdata[j];
-      }
-      temp_ptr[Matrix->cols] = Calloc(Matrix->max_rows,double);
-      
-      /* for (i=0; i < Matrix->max_rows; i++){
-	 temp_ptr[Matrix->cols][i] = 0.0;   // (cols)*rows + i; 
-	 }
-      */
-      memset(&temp_ptr[Matrix->cols][0],0,sizeof(double)* Matrix->max_rows);
 
+/* discard any queued or completed requests */
 
+static void dbm_PrefetchClearEntries(doubleBufferedMatrix Matrix){
 
-      Matrix->rowdata = temp_ptr;
-      Free(old_temp_ptr);
-    }
+  int k;
 
-  } else {
-    /* Need to remove oldest column from buffer */
-    double **temp_ptr;
-    double *temp_col = Matrix->coldata[0];
-    double **old_temp_ptr = Matrix->rowdata;
- 
-    /* Before we deallocate, better empty the column buffer */
-    myfile = fopen(Matrix->filenames[Matrix->which_cols[0]],"rb+");
-    blocks_written = fwrite(&temp_col[0],sizeof(double),Matrix->rows,myfile);
-    fclose(myfile); 
-    
-    if (blocks_written != Matrix->rows){
-      return 1;
+  for (k=0; k < Matrix->prefetch_depth; k++){
+    if (Matrix->prefetch[k].fd >= 0){
+      close(Matrix->prefetch[k].fd);
+      Matrix->prefetch[k].fd = -1;
     }
+    Matrix->prefetch[k].col = -1;
+    Matrix->prefetch[k].state = DBM_PF_EMPTY;
+  }
+}
 
-    
-    for (j =1; j < Matrix->max_cols; j++){
-      Matrix->which_cols[j-1] = Matrix->which_cols[j];
-      Matrix->coldata[j-1] = Matrix->coldata[j];
-    }
-    Matrix->which_cols[Matrix->max_cols-1] = Matrix->cols;
-    Matrix->coldata[Matrix->max_cols-1] = temp_col; //new double[this->rows];
-    /* 
-       for (i =0; i < Matrix->rows; i++){
-       Matrix->coldata[Matrix->max_cols-1][i] = 0.0; // (cols)*rows +i;
-       }
-    */
-    memset(&Matrix->coldata[Matrix->max_cols-1][0],0,sizeof(double)* Matrix->rows);
-
-    
-    which_col_num = Matrix->max_cols-1;
 
-   
-    
-    if (!(Matrix->colmode)){
-      old_temp_ptr = Matrix->rowdata;
-      temp_ptr = Calloc(Matrix->cols+1,double *);
-      
-      for (j =0; j < Matrix->cols; j++){
-	temp_ptr[j] = Matrix->rowdata[j];
-      }
-      temp_ptr[Matrix->cols] = Calloc(Matrix->max_rows,double);
-      
-      /*
-	for (i=0; i < Matrix->max_rows; i++){
-	temp_ptr[Matrix->cols][i] = 0.0;      //(cols)*rows + i;
-	}
-      */
-      memset(&temp_ptr[Matrix->cols][0],0,sizeof(double)* Matrix->max_rows);
-      
-      Matrix->rowdata = temp_ptr;
-      Free(old_temp_ptr);
-    }
+/* a forked child (eg from mclapply) has a copy of the matrix but not of the background threads */
 
+static void dbm_PrefetchCheckFork(doubleBufferedMatrix Matrix){
 
+  if (Matrix->prefetch_running && Matrix->prefetch_pid != getpid()){
+    Matrix->prefetch_running = 0;
+    Free(Matrix->prefetch_threads);
+    Matrix->prefetch_threads = NULL;
+    dbm_PrefetchClearEntries(Matrix);
   }
-  /* now do the file stuff */
+}
 
-  char **temp_filenames = Calloc(Matrix->cols+1,char *);
-  char *temp_name;
-  char **temp_names_ptr = Matrix->filenames;
 
+static int dbm_PrefetchStart(doubleBufferedMatrix Matrix){
 
-  for (j =0; j < Matrix->cols; j++){
-    temp_filenames[j] = Matrix->filenames[j];
+  int k, nthreads;
+
+  if (Matrix->prefetch_running){
+    return 0;
   }
 
- 
+  /* columns next to each other are in different directories when striped, so are read at the same time */
+  nthreads = (Matrix->ndirectories < Matrix->prefetch_depth) ? Matrix->ndirectories : Matrix->prefetch_depth;
+  if (nthreads < 1){
+    nthreads = 1;
+  }
 
-  temp_name = (char *)R_tmpnam(Matrix->fileprefix,Matrix->filedirectory);
+  Matrix->prefetch_shutdown = 0;
+  pthread_mutex_init(&Matrix->prefetch_lock,NULL);
+  pthread_cond_init(&Matrix->prefetch_work,NULL);
+  pthread_cond_init(&Matrix->prefetch_done,NULL);
 
-  char *tmp = Calloc(strlen(temp_name)+1,char);
-  strcpy(tmp,temp_name);
+  Matrix->prefetch_threads = Calloc(nthreads,pthread_t);
+  for (k=0; k < nthreads; k++){
+    if (pthread_create(&Matrix->prefetch_threads[k],NULL,dbm_PrefetchWorker,Matrix)){
+      break;
+    }
+  }
+  if (k == 0){
+    Free(Matrix->prefetch_threads);
+    Matrix->prefetch_threads = NULL;
+    pthread_mutex_destroy(&Matrix->prefetch_lock);
+    pthread_cond_destroy(&Matrix->prefetch_work);
+    pthread_cond_destroy(&Matrix->prefetch_done);
+    return 1;
+  }
+  Matrix->prefetch_nthreads = k;
+  Matrix->prefetch_running = 1;
+  Matrix->prefetch_pid = getpid();
+  return 0;
+}
 
-  temp_filenames[Matrix->cols] = Calloc(strlen(tmp)+1,char);
-  temp_filenames[Matrix->cols] = strcpy(temp_filenames[Matrix->cols],tmp);
 
-  Matrix->filenames = temp_filenames;
+/*****************************************************
+ **
+ ** static void dbm_PrefetchStop(doubleBufferedMatrix Matrix)
+ **
+ ** Stops the background thread (if running) and deallocates
+ ** the prefetch buffers.
+ **
+ *****************************************************/
 
-  /*   SHOULD NEVER HAVE BEEN HERE. CAUSED CRASHES ON WINDOWS Free(temp_name); */
-  Free(temp_names_ptr);
-  Free(tmp);
+static void dbm_PrefetchStop(doubleBufferedMatrix Matrix){
 
+  int k;
 
-  /* Finally lets write it all out to a file */
+  dbm_PrefetchCheckFork(Matrix);
 
-  const char *mode = "wb";
-  //printf("%s\n", filenames[cols]);
-  myfile = fopen(temp_filenames[Matrix->cols],mode);
-  if (!myfile){
-    return 1;            /** Bad error **/
+  if (Matrix->prefetch_running){
+    pthread_mutex_lock(&Matrix->prefetch_lock);
+    Matrix->prefetch_shutdown = 1;
+    pthread_cond_broadcast(&Matrix->prefetch_work);
+    pthread_mutex_unlock(&Matrix->prefetch_lock);
+    for (k=0; k < Matrix->prefetch_nthreads; k++){
+      pthread_join(Matrix->prefetch_threads[k],NULL);
+    }
+    Free(Matrix->prefetch_threads);
+    Matrix->prefetch_threads = NULL;
+    pthread_mutex_destroy(&Matrix->prefetch_lock);
+    pthread_cond_destroy(&Matrix->prefetch_work);
+    pthread_cond_destroy(&Matrix->prefetch_done);
+    Matrix->prefetch_running = 0;
   }
-  blocks_written = fwrite(Matrix->coldata[which_col_num],sizeof(double),  Matrix->rows, myfile);
 
-  if (blocks_written != Matrix->rows){
-    return 1;
+  if (Matrix->prefetch != NULL){
+    dbm_PrefetchClearEntries(Matrix);
+    for (k=0; k < Matrix->prefetch_depth; k++){
+      Free(Matrix->prefetch[k].data);
+    }
+    Free(Matrix->prefetch);
+    Matrix->prefetch = NULL;
   }
-
-  fclose(myfile);
-  Matrix->cols++;
-
-  return 0;
-  
 }
 
+
 /*****************************************************
  **
- ** int dbm_ResizeColBuffer(doubleBufferedMatrix Matrix, int new_maxcol)
+ ** static int dbm_PrefetchTake(doubleBufferedMatrix Matrix, int col, double **slot)
  **
- ** doubleBufferedMatrix Matrix
- ** int new_maxcol - the number of columns that should be stored in the column buffer
- **                  upon exit from this routine.
+ ** If column col has been (or is being) prefetched, wait
+ ** for it to be ready then swap its buffer with *slot.
  **
- ** This function deals with the mechanics of loading new data in or emptying
- ** data out of the the column buffer depending on whether the size of the
- ** column buffer is to be increased or decreased.
- ** 
+ ** Returns 0 if *slot now contains the column, 1 if it
+ ** must be read in the usual way.
  **
  *****************************************************/
 
-int dbm_ResizeColBuffer(doubleBufferedMatrix Matrix, int new_maxcol){
+static int dbm_PrefetchTake(doubleBufferedMatrix Matrix, int col, double **slot){
 
+  int k, result = 1;
+  double *tmp;
+  dbm_prefetch_entry *entry;
 
-  int i,j;
-  int lastcol;
-  int n_cols_remove=0;
-  int n_cols_add=0; 
-  double *tmpptr;
-  double **tmpptr2;
-  int *tmpptr3;
+  dbm_PrefetchCheckFork(Matrix);
 
-  int *whichadd;
+  if (!Matrix->prefetch_running){
+    return 1;
+  }
 
-  int curcol;
-  int min_j;
+  pthread_mutex_lock(&Matrix->prefetch_lock);
+  for (k=0; k < Matrix->prefetch_depth; k++){
+    entry = &Matrix->prefetch[k];
+    if (entry->col == col && entry->state != DBM_PF_EMPTY){
+      while (entry->state == DBM_PF_QUEUED || entry->state == DBM_PF_READING){
+	pthread_cond_wait(&Matrix->prefetch_done,&Matrix->prefetch_lock);
+      }
+      if (entry->state == DBM_PF_READY){
+	tmp = *slot;
+	*slot = entry->data;
+	entry->data = tmp;
+	result = 0;
+      }
+      entry->state = DBM_PF_EMPTY;
+      entry->col = -1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&Matrix->prefetch_lock);
 
+  return result;
+}
 
-    /* Fix up any potential clashes */
-  if (Matrix->rowcolclash){
-    dbm_ClearClash(Matrix);
+
+/*****************************************************
+ **
+ ** static void dbm_PrefetchInvalidate(doubleBufferedMatrix Matrix, int col)
+ **
+ ** Discards any prefetched copy of column col. Must be called
+ ** before the column is written to its file.
+ **
+ *****************************************************/
+
+static void dbm_PrefetchInvalidate(doubleBufferedMatrix Matrix, int col){
+
+  int k;
+  dbm_prefetch_entry *entry;
+
+  dbm_PrefetchCheckFork(Matrix);
+
+  if (!Matrix->prefetch_running){
+    return;
   }
-  // First figure out if need to mak any changes
 
-  if (new_maxcol <= 0){
-    return 1;  /** Big big error **/
+  pthread_mutex_lock(&Matrix->prefetch_lock);
+  for (k=0; k < Matrix->prefetch_depth; k++){
+    entry = &Matrix->prefetch[k];
+    if (entry->col == col && entry->state != DBM_PF_EMPTY){
+      if (entry->state == DBM_PF_QUEUED){
+	close(entry->fd);
+	entry->fd = -1;
+      }
+      while (entry->state == DBM_PF_READING){
+	pthread_cond_wait(&Matrix->prefetch_done,&Matrix->prefetch_lock);
+      }
+      entry->state = DBM_PF_EMPTY;
+      entry->col = -1;
+    }
   }
+  pthread_mutex_unlock(&Matrix->prefetch_lock);
+}
 
-  if (Matrix->cols < Matrix->max_cols){
-    lastcol = Matrix->cols;
-  } else {
-    lastcol = Matrix->max_cols;
+
+/*****************************************************
+ **
+ ** static void dbm_PrefetchIssue(doubleBufferedMatrix Matrix, int col)
+ **
+ ** Called after column col has been loaded into the column
+ ** buffer from file. If columns appear to be being loaded in
+ ** increasing order, queue requests for the next prefetch_depth
+ ** columns that are not already in the column buffer (or
+ ** known to be zero).
+ **
+ *****************************************************/
+
+static void dbm_PrefetchIssue(doubleBufferedMatrix Matrix, int col){
+
+  int k, c, fd, issued = 0, queued = 0;
+  int lastcol, curcol;
+  int sequential;
+  dbm_prefetch_entry *entry;
+
+  /* skipping over columns that are already buffered still counts as sequential */
+  lastcol = (Matrix->cols < Matrix->max_cols) ? Matrix->cols : Matrix->max_cols;
+  sequential = (col > Matrix->prefetch_last_col) && (col - Matrix->prefetch_last_col <= lastcol + 1);
+  Matrix->prefetch_last_col = col;
+
+  if (!sequential || Matrix->prefetch_depth <= 0 || Matrix->memory_mapped || col + 1 >= Matrix->cols){
+    return;
   }
-  
 
-  if (Matrix->max_cols == new_maxcol){
-    // No need to do anything.
-    return 0;
-  } else if (Matrix->max_cols > new_maxcol){
-    // Remove columns from the column buffer
-    // Will remove max_col - new_maxcol oldest columns
-    if (new_maxcol < Matrix->cols){
-      if (Matrix->max_cols < Matrix->cols){
-	n_cols_remove = Matrix->max_cols - new_maxcol;
-      } else{
-	n_cols_remove = Matrix->cols - new_maxcol;
-      }
+  dbm_PrefetchCheckFork(Matrix);
 
+  if (Matrix->prefetch == NULL){
+    Matrix->prefetch = Calloc(Matrix->prefetch_depth,dbm_prefetch_entry);
+    for (k=0; k < Matrix->prefetch_depth; k++){
+      Matrix->prefetch[k].col = -1;
+      Matrix->prefetch[k].state = DBM_PF_EMPTY;
+      Matrix->prefetch[k].fd = -1;
+      Matrix->prefetch[k].data = Calloc(Matrix->rows,double);
+    }
+  }
 
-      for (i=0; i < n_cols_remove; i++){
-	dbm_FlushOldestColumn(Matrix);
-	tmpptr = Matrix->coldata[0];
-	for (j=1; j < lastcol; j++){
-	  Matrix->coldata[j-1] = Matrix->coldata[j];
-	  Matrix->which_cols[j-1] = Matrix->which_cols[j];
+  if (dbm_PrefetchStart(Matrix)){
+    return;
+  }
+
+  pthread_mutex_lock(&Matrix->prefetch_lock);
+  c = col + 1;
+  while (issued < Matrix->prefetch_depth && c < Matrix->cols){
+    if (dbm_InColBuffer(Matrix,0,c,&curcol) || Matrix->col_zero[c] || dbm_WriteBehindHas(Matrix,c)){
+      c++;
+      continue;
+    }
+    entry = NULL;
+    for (k=0; k < Matrix->prefetch_depth; k++){
+      if (Matrix->prefetch[k].col == c && Matrix->prefetch[k].state != DBM_PF_EMPTY){
+	entry = &Matrix->prefetch[k];
+	break;
+      }
+    }
+    if (entry == NULL){
+      /* a free entry, or else one holding a column the scan has already passed */
+      for (k=0; k < Matrix->prefetch_depth; k++){
+	if (Matrix->prefetch[k].state == DBM_PF_EMPTY){
+	  entry = &Matrix->prefetch[k];
+	  break;
 	}
-	Free(tmpptr);
       }
-      
-      tmpptr2 = Matrix->coldata;
-      tmpptr3 = Matrix->which_cols;
-      
-      Matrix->coldata = Calloc(new_maxcol,double *);
-      Matrix->which_cols = Calloc(new_maxcol,int);
-      
-      for (j=0; j < new_maxcol; j++){
-	Matrix->coldata[j] = tmpptr2[j];
-	Matrix->which_cols[j] = tmpptr3[j];
+      for (k=0; entry == NULL && k < Matrix->prefetch_depth; k++){
+	if ((Matrix->prefetch[k].state == DBM_PF_READY || Matrix->prefetch[k].state == DBM_PF_FAILED) && Matrix->prefetch[k].col <= col){
+	  entry = &Matrix->prefetch[k];
+	}
       }
-      Free(tmpptr2);
-      Free(tmpptr3);
+      if (entry == NULL){
+	break;
+      }
+      /* the thread gets its own descriptor so the open file cache may close ours at any time */
+      fd = dbm_OpenFile(Matrix,dbm_FileOfColumn(Matrix,c));
+      if (fd < 0 || (fd = dup(fd)) < 0){
+	break;
+      }
+      entry->fd = fd;
+      entry->col = c;
+      entry->seq = ++Matrix->prefetch_seq;
+      entry->state = DBM_PF_QUEUED;
+      queued++;
     }
-    Matrix->max_cols = new_maxcol;
+    issued++;
+    c++;
+  }
+  if (queued){
+    pthread_cond_signal(&Matrix->prefetch_work);
+  }
+  pthread_mutex_unlock(&Matrix->prefetch_lock);
+}
 
-  } else {
-    // Need to add columns to the column buffer
-    
-    if (new_maxcol < Matrix->cols){
-      n_cols_add = new_maxcol - Matrix->max_cols;
-    } else if (Matrix->max_cols < Matrix->cols){
-      n_cols_add = Matrix->cols - Matrix->max_cols;
-    } else {
-      // there are no more columns to add, everything is already in the buffer
-      n_cols_add = 0;
-      Matrix->max_cols = new_maxcol;
-      return 0;
+#else
+
+/* no background thread available, so no prefetching */
+
+static int dbm_PrefetchTake(doubleBufferedMatrix Matrix, int col, double **slot){
+  return 1;
+}
+
+static void dbm_PrefetchInvalidate(doubleBufferedMatrix Matrix, int col){
+}
+
+static void dbm_PrefetchIssue(doubleBufferedMatrix Matrix, int col){
+  Matrix->prefetch_last_col = col;
+}
+
+static void dbm_PrefetchStop(doubleBufferedMatrix Matrix){
+}
+
+#endif
+
+
+/*****************************************************
+ **
+ ** Write-behind
+ **
+ ** The background thread writes queued columns in the order
+ ** they were queued, using the file descriptor and buffer in
+ ** the entry. The lock is not held while writing. Everything
+ ** else happens on the calling thread, which keeps at most
+ ** one entry (that is not empty) for any column. The entries
+ ** only exist while the thread is running.
+ **
+ *****************************************************/
+
+#ifdef DBM_HAVE_THREADS
+
+static void *dbm_WriteBehindWorker(void *arg){
+
+  doubleBufferedMatrix Matrix = (doubleBufferedMatrix)arg;
+  dbm_prefetch_entry *entry;
+  int k, next, fd, result;
+
+  pthread_mutex_lock(&Matrix->writebehind_lock);
+  while (!Matrix->writebehind_shutdown){
+    next = -1;
+    for (k=0; k < Matrix->writebehind_depth; k++){
+      if (Matrix->writebehind[k].state == DBM_WB_QUEUED && (next < 0 || Matrix->writebehind[k].seq < Matrix->writebehind[next].seq)){
+	next = k;
+      }
     }
-    
-    // Figure out which columns to add
-    // rule will be to add columns in numerical order (ie column 0 if not it, then 1 if not in and so on)
-    
-    whichadd = Calloc(n_cols_add,int);
-    
-    min_j=0;
-    for (i=0; i < n_cols_add; i++){
-      for (j=min_j; j < Matrix->cols; j++){ /************************** *****/
-	//	printf("j is %d %d ",j, min_j);
-	if(!dbm_InColBuffer(Matrix,0,j,&curcol)){
-	  whichadd[i] = j;
-	  //printf("Adding %d\n",j);
-	  break;
-	}
+    if (next < 0){
+      pthread_cond_wait(&Matrix->writebehind_work,&Matrix->writebehind_lock);
+      continue;
+    }
+
+    entry = &Matrix->writebehind[next];
+    entry->state = DBM_WB_WRITING;
+    fd = entry->fd;
+    entry->fd = -1;
+    pthread_mutex_unlock(&Matrix->writebehind_lock);
+
+    result = dbm_ColumnIO(Matrix,fd,entry->col,0,Matrix->rows,entry->data,1);
+    close(fd);
+
+    pthread_mutex_lock(&Matrix->writebehind_lock);
+    entry->state = result ? DBM_WB_FAILED : DBM_WB_WRITTEN;
+    pthread_cond_broadcast(&Matrix->writebehind_done);
+  }
+  pthread_mutex_unlock(&Matrix->writebehind_lock);
+
+  return NULL;
+}
+
+
+/* writes an entry on the calling thread (eg after the background thread could not). Returns 0 if successful, 1 if problem */
+
+static int dbm_WriteBehindRetry(doubleBufferedMatrix Matrix, dbm_prefetch_entry *entry){
+
+  int fd;
+
+  fd = dbm_OpenFile(Matrix,dbm_FileOfColumn(Matrix,entry->col));
+  if (fd < 0 || dbm_ColumnIO(Matrix,fd,entry->col,0,Matrix->rows,entry->data,1)){
+    return 1;
+  }
+  entry->state = DBM_WB_WRITTEN;
+  return 0;
+}
+
+
+/* discards all the entries and their buffers */
+
+static void dbm_WriteBehindFreeEntries(doubleBufferedMatrix Matrix){
+
+  int k;
+
+  for (k=0; k < Matrix->writebehind_depth; k++){
+    if (Matrix->writebehind[k].fd >= 0){
+      close(Matrix->writebehind[k].fd);
+    }
+    Free(Matrix->writebehind[k].data);
+  }
+  Free(Matrix->writebehind);
+  Matrix->writebehind = NULL;
+}
+
+
+/* a forked child (eg from mclapply) has a copy of the matrix but not of the background thread, 
+   so it writes anything not yet written itself (the parent will also write the same values) */
+
+static void dbm_WriteBehindCheckFork(doubleBufferedMatrix Matrix){
+
+  int k;
+
+  if (Matrix->writebehind_running && Matrix->writebehind_pid != getpid()){
+    Matrix->writebehind_running = 0;
+    for (k=0; k < Matrix->writebehind_depth; k++){
+      if (Matrix->writebehind[k].state != DBM_WB_EMPTY && Matrix->writebehind[k].state != DBM_WB_WRITTEN){
+	dbm_WriteBehindRetry(Matrix,&Matrix->writebehind[k]);
       }
-      min_j = j+1;
     }
-    
-    // Add columns to end of buffer
-    tmpptr2 = Matrix->coldata;
-    tmpptr3 = Matrix->which_cols;
-    
-    Matrix->coldata = Calloc(Matrix->max_cols+ n_cols_add, double *);
-    Matrix->which_cols = Calloc(new_maxcol+ n_cols_add,int);  
-    for (j=0; j < Matrix->max_cols; j++){
-      Matrix->coldata[j] = tmpptr2[j];
-      Matrix->which_cols[j] = tmpptr3[j];
+    dbm_WriteBehindFreeEntries(Matrix);
+  }
+}
+
+
+static int dbm_WriteBehindStart(doubleBufferedMatrix Matrix){
+
+  int k;
+
+  dbm_WriteBehindCheckFork(Matrix);
+
+  if (Matrix->writebehind_running){
+    return 0;
+  }
+
+  Matrix->writebehind = Calloc(Matrix->writebehind_depth,dbm_prefetch_entry);
+  for (k=0; k < Matrix->writebehind_depth; k++){
+    Matrix->writebehind[k].col = -1;
+    Matrix->writebehind[k].state = DBM_WB_EMPTY;
+    Matrix->writebehind[k].fd = -1;
+    Matrix->writebehind[k].data = Calloc(Matrix->rows,double);
+  }
+
+  Matrix->writebehind_shutdown = 0;
+  pthread_mutex_init(&Matrix->writebehind_lock,NULL);
+  pthread_cond_init(&Matrix->writebehind_work,NULL);
+  pthread_cond_init(&Matrix->writebehind_done,NULL);
+
+  if (pthread_create(&Matrix->writebehind_thread,NULL,dbm_WriteBehindWorker,Matrix)){
+    pthread_mutex_destroy(&Matrix->writebehind_lock);
+    pthread_cond_destroy(&Matrix->writebehind_work);
+    pthread_cond_destroy(&Matrix->writebehind_done);
+    dbm_WriteBehindFreeEntries(Matrix);
+    return 1;
+  }
+  Matrix->writebehind_running = 1;
+  Matrix->writebehind_pid = getpid();
+  return 0;
+}
+
+
+/* the entry holding column col, NULL if none. Called with the lock held */
+
+static dbm_prefetch_entry *dbm_WriteBehindFind(doubleBufferedMatrix Matrix, int col){
+
+  int k;
+
+  for (k=0; k < Matrix->writebehind_depth; k++){
+    if (Matrix->writebehind[k].col == col && Matrix->writebehind[k].state != DBM_WB_EMPTY){
+      return &Matrix->writebehind[k];
     }
-    
-    for (i=0; i < n_cols_add; i++){
-      dbm_LoadAdditionalColumn(Matrix,whichadd[i], Matrix->max_cols + i);
+  }
+  return NULL;
+}
+
+
+/*****************************************************
+ **
+ ** static void dbm_WriteBehindStop(doubleBufferedMatrix Matrix)
+ **
+ ** Stops the background thread (if running) and deallocates
+ ** the write-behind buffers. Columns still waiting to be
+ ** written are discarded, call dbm_WriteBehindSync first
+ ** if they are wanted.
+ **
+ *****************************************************/
+
+static void dbm_WriteBehindStop(doubleBufferedMatrix Matrix){
+
+  dbm_WriteBehindCheckFork(Matrix);
+
+  if (Matrix->writebehind_running){
+    pthread_mutex_lock(&Matrix->writebehind_lock);
+    Matrix->writebehind_shutdown = 1;
+    pthread_cond_broadcast(&Matrix->writebehind_work);
+    pthread_mutex_unlock(&Matrix->writebehind_lock);
+    pthread_join(Matrix->writebehind_thread,NULL);
+    pthread_mutex_destroy(&Matrix->writebehind_lock);
+    pthread_cond_destroy(&Matrix->writebehind_work);
+    pthread_cond_destroy(&Matrix->writebehind_done);
+    Matrix->writebehind_running = 0;
+    dbm_WriteBehindFreeEntries(Matrix);
+  }
+}
+
+
+/*****************************************************
+ **
+ ** static int dbm_WriteBehindQueue(doubleBufferedMatrix Matrix, int col, double **slot)
+ **
+ ** Hands *slot (holding all of column col) to the background
+ ** thread to be written and puts a spare buffer in its place.
+ ** Waits if writebehind_depth columns are already waiting.
+ **
+ ** Returns 0 if queued, 1 if the column must be written in
+ ** the usual way.
+ **
+ *****************************************************/
+
+static int dbm_WriteBehindQueue(doubleBufferedMatrix Matrix, int col, double **slot){
+
+  int k, fd;
+  double *tmp;
+  dbm_prefetch_entry *entry;
+
+  if (Matrix->writebehind_depth <= 0 || Matrix->memory_mapped || Matrix->direct_io){
+    return 1;  /* with direct I/O two writes to the same block must not overlap */
+  }
+  if (dbm_WriteBehindStart(Matrix)){
+    return 1;
+  }
+
+  /* any copy read ahead of time would now be out of date */
+  dbm_PrefetchInvalidate(Matrix,col);
+
+  /* the thread gets its own descriptor so the open file cache may close ours at any time */
+  fd = dbm_OpenFile(Matrix,dbm_FileOfColumn(Matrix,col));
+  if (fd < 0 || (fd = dup(fd)) < 0){
+    return 1;
+  }
+
+  pthread_mutex_lock(&Matrix->writebehind_lock);
+
+  /* an older version of the column is no longer needed, once any write of it has finished */
+  entry = dbm_WriteBehindFind(Matrix,col);
+  if (entry != NULL){
+    while (entry->state == DBM_WB_WRITING){
+      pthread_cond_wait(&Matrix->writebehind_done,&Matrix->writebehind_lock);
     }
-    Free(tmpptr2);
-    Free(tmpptr3);
-    Free(whichadd);
+    if (entry->fd >= 0){
+      close(entry->fd);
+      entry->fd = -1;
+    }
+    entry->state = DBM_WB_EMPTY;
+    entry->col = -1;
+  }
+
+  /* a free entry, or else the one written longest ago, or else wait for one */
+  entry = NULL;
+  while (entry == NULL){
+    for (k=0; k < Matrix->writebehind_depth; k++){
+      if (Matrix->writebehind[k].state == DBM_WB_EMPTY){
+	entry = &Matrix->writebehind[k];
+	break;
+      }
+      if (Matrix->writebehind[k].state == DBM_WB_WRITTEN && (entry == NULL || Matrix->writebehind[k].seq < entry->seq)){
+	entry = &Matrix->writebehind[k];
+      }
+    }
+    for (k=0; entry == NULL && k < Matrix->writebehind_depth; k++){
+      if (Matrix->writebehind[k].state == DBM_WB_FAILED){
+	if (dbm_WriteBehindRetry(Matrix,&Matrix->writebehind[k])){
+	  pthread_mutex_unlock(&Matrix->writebehind_lock);
+	  close(fd);
+	  return 1;
+	}
+	entry = &Matrix->writebehind[k];
+      }
+    }
+    if (entry == NULL){
+      pthread_cond_wait(&Matrix->writebehind_done,&Matrix->writebehind_lock);
+    }
+  }
+
+  tmp = *slot;
+  *slot = entry->data;
+  entry->data = tmp;
+  entry->fd = fd;
+  entry->col = col;
+  entry->seq = ++Matrix->writebehind_seq;
+  entry->state = DBM_WB_QUEUED;
+  pthread_cond_signal(&Matrix->writebehind_work);
+  pthread_mutex_unlock(&Matrix->writebehind_lock);
+
+  Matrix->col_zero[col] = 0;
+  return 0;
+}
+
+
+/*****************************************************
+ **
+ ** static int dbm_WriteBehindTake(doubleBufferedMatrix Matrix, int col, double **slot)
+ **
+ ** If column col is held for the write-behind thread (waiting
+ ** to be written or already written) swap its buffer with
+ ** *slot. If slot is NULL the column is about to be entirely
+ ** overwritten, so any copy is just discarded.
+ **
+ ** Returns 0 if the column is not held, 1 if *slot now holds
+ ** the column as it is in the file, 2 if *slot holds the 
+ ** column but it has not been written to the file.
+ **
+ *****************************************************/
+
+static int dbm_WriteBehindTake(doubleBufferedMatrix Matrix, int col, double **slot){
+
+  int result = 0;
+  double *tmp;
+  dbm_prefetch_entry *entry;
+
+  dbm_WriteBehindCheckFork(Matrix);
+
+  if (!Matrix->writebehind_running){
+    return 0;
+  }
+
+  pthread_mutex_lock(&Matrix->writebehind_lock);
+  entry = dbm_WriteBehindFind(Matrix,col);
+  if (entry != NULL){
+    while (entry->state == DBM_WB_WRITING){
+      pthread_cond_wait(&Matrix->writebehind_done,&Matrix->writebehind_lock);
+    }
+    if (slot != NULL){
+      tmp = *slot;
+      *slot = entry->data;
+      entry->data = tmp;
+      result = (entry->state == DBM_WB_WRITTEN) ? 1 : 2;
+    }
+    if (entry->fd >= 0){
+      close(entry->fd);
+      entry->fd = -1;
+    }
+    entry->state = DBM_WB_EMPTY;
+    entry->col = -1;
+  }
+  pthread_mutex_unlock(&Matrix->writebehind_lock);
+
+  return result;
+}
+
+
+/*****************************************************
+ **
+ ** static int dbm_WriteBehindSync(doubleBufferedMatrix Matrix, int col)
+ **
+ ** Waits until any pending write of column col (of every
+ ** column if col is -1) has reached the file, then forgets
+ ** the column, so that the file may be read or written 
+ ** directly.
+ **
+ ** Returns 0 if successful, 1 if a column could not be
+ ** written (it is then kept so that nothing is lost).
+ **
+ *****************************************************/
+
+static int dbm_WriteBehindSync(doubleBufferedMatrix Matrix, int col){
+
+  int k, result = 0;
+  dbm_prefetch_entry *entry;
+
+  dbm_WriteBehindCheckFork(Matrix);
+
+  if (!Matrix->writebehind_running){
+    return 0;
+  }
+
+  pthread_mutex_lock(&Matrix->writebehind_lock);
+  for (k=0; k < Matrix->writebehind_depth; k++){
+    entry = &Matrix->writebehind[k];
+    if (entry->state == DBM_WB_EMPTY || (col >= 0 && entry->col != col)){
+      continue;
+    }
+    while (entry->state == DBM_WB_QUEUED || entry->state == DBM_WB_WRITING){
+      pthread_cond_wait(&Matrix->writebehind_done,&Matrix->writebehind_lock);
+    }
+    if (entry->state == DBM_WB_FAILED && dbm_WriteBehindRetry(Matrix,entry)){
+      result = 1;
+      continue;
+    }
+    entry->state = DBM_WB_EMPTY;
+    entry->col = -1;
+  }
+  pthread_mutex_unlock(&Matrix->writebehind_lock);
+
+  return result;
+}
+
+
+/* true if column col is held for the write-behind thread */
+
+static int dbm_WriteBehindHas(doubleBufferedMatrix Matrix, int col){
+
+  int result;
+
+  dbm_WriteBehindCheckFork(Matrix);
+
+  if (!Matrix->writebehind_running){
+    return 0;
+  }
+
+  pthread_mutex_lock(&Matrix->writebehind_lock);
+  result = (dbm_WriteBehindFind(Matrix,col) != NULL);
+  pthread_mutex_unlock(&Matrix->writebehind_lock);
+
+  return result;
+}
+
+#else
+
+/* no background thread available, so columns are always written when they leave the buffer */
+
+static int dbm_WriteBehindQueue(doubleBufferedMatrix Matrix, int col, double **slot){
+  return 1;
+}
+
+static int dbm_WriteBehindTake(doubleBufferedMatrix Matrix, int col, double **slot){
+  return 0;
+}
+
+static int dbm_WriteBehindSync(doubleBufferedMatrix Matrix, int col){
+  return 0;
+}
+
+static int dbm_WriteBehindHas(doubleBufferedMatrix Matrix, int col){
+  return 0;
+}
+
+static void dbm_WriteBehindStop(doubleBufferedMatrix Matrix){
+}
+
+#endif
+
+
+
+/*****************************************************
+ **
+ ** Batched I/O
+ **
+ ** The row buffer needs a block of rows from every column,
+ ** ie one read (or write) per column. Rather than issuing
+ ** these one after another they are collected into a batch
+ ** and carried out by a small pool of threads (plus the
+ ** calling thread), so that several requests are outstanding
+ ** at once. The pool threads only ever call pread()/pwrite().
+ **
+ *****************************************************/
+
+static int dbm_DoIORequest(doubleBufferedMatrix Matrix, dbm_io_request *request){
+
+  if (request->col >= 0){
+    request->result = dbm_ColumnIO(Matrix,request->fd,request->col,request->first_row,request->nrows,request->buf,request->write);
+  } else if (request->write){
+    request->result = dbm_pwrite(request->fd,request->buf,request->nbytes,(dbm_offset)request->offset);
+  } else {
+    request->result = dbm_pread(request->fd,request->buf,request->nbytes,(dbm_offset)request->offset);
+  }
+  return request->result;
+}
+
+#ifdef DBM_HAVE_THREADS
+
+
+static void *dbm_IOWorker(void *arg){
+
+  doubleBufferedMatrix Matrix = (doubleBufferedMatrix)arg;
+  dbm_io_request *request;
+
+  pthread_mutex_lock(&Matrix->io_lock);
+  while (!Matrix->io_shutdown){
+    if (Matrix->io_batch == NULL || Matrix->io_next >= Matrix->io_batch_size){
+      pthread_cond_wait(&Matrix->io_work,&Matrix->io_lock);
+      continue;
+    }
+    request = &Matrix->io_batch[Matrix->io_next++];
+    pthread_mutex_unlock(&Matrix->io_lock);
+
+    dbm_DoIORequest(Matrix,request);
+
+    pthread_mutex_lock(&Matrix->io_lock);
+    if (--Matrix->io_pending == 0){
+      pthread_cond_broadcast(&Matrix->io_done);
+    }
+  }
+  pthread_mutex_unlock(&Matrix->io_lock);
+
+  return NULL;
+}
+
+
+/*****************************************************
+ **
+ ** static void dbm_IOPoolStop(doubleBufferedMatrix Matrix)
+ **
+ ** Stops the I/O threads (if running).
+ **
+ *****************************************************/
+
+static void dbm_IOPoolStop(doubleBufferedMatrix Matrix){
+
+  int k;
+
+  if (Matrix->io_running && Matrix->io_pid != getpid()){
+    /* threads do not survive a fork, nothing to stop */
+    Matrix->io_running = 0;
+  }
+  if (!Matrix->io_running){
+    Free(Matrix->io_thread);
+    Matrix->io_thread = NULL;
+    return;
+  }
+
+  pthread_mutex_lock(&Matrix->io_lock);
+  Matrix->io_shutdown = 1;
+  pthread_cond_broadcast(&Matrix->io_work);
+  pthread_mutex_unlock(&Matrix->io_lock);
+  for (k=0; k < Matrix->io_running; k++){
+    pthread_join(Matrix->io_thread[k],NULL);
+  }
+  pthread_mutex_destroy(&Matrix->io_lock);
+  pthread_cond_destroy(&Matrix->io_work);
+  pthread_cond_destroy(&Matrix->io_done);
+  Free(Matrix->io_thread);
+  Matrix->io_thread = NULL;
+  Matrix->io_running = 0;
+}
+
+
+static int dbm_IOPoolStart(doubleBufferedMatrix Matrix){
+
+  int k;
+
+  if (Matrix->io_running && Matrix->io_pid != getpid()){
+    /* the threads belong to the parent process */
+    Matrix->io_running = 0;
+    Free(Matrix->io_thread);
+    Matrix->io_thread = NULL;
+  }
+  if (Matrix->io_running){
+    return 0;
+  }
+
+  Matrix->io_shutdown = 0;
+  Matrix->io_batch = NULL;
+  Matrix->io_batch_size = 0;
+  Matrix->io_next = 0;
+  Matrix->io_pending = 0;
+  pthread_mutex_init(&Matrix->io_lock,NULL);
+  pthread_cond_init(&Matrix->io_work,NULL);
+  pthread_cond_init(&Matrix->io_done,NULL);
+
+  /* the calling thread also services requests so one fewer is needed */
+  Matrix->io_thread = Calloc(Matrix->io_threads - 1,pthread_t);
+  Matrix->io_pid = getpid();
+  for (k=0; k < Matrix->io_threads - 1; k++){
+    if (pthread_create(&Matrix->io_thread[k],NULL,dbm_IOWorker,Matrix)){
+      break;
+    }
+    Matrix->io_running++;
+  }
+  if (!Matrix->io_running){
+    pthread_mutex_destroy(&Matrix->io_lock);
+    pthread_cond_destroy(&Matrix->io_work);
+    pthread_cond_destroy(&Matrix->io_done);
+    Free(Matrix->io_thread);
+    Matrix->io_thread = NULL;
+    return 1;
+  }
+  return 0;
+}
+
+#endif
+
+
+/*****************************************************
+ **
+ ** static int dbm_RunIOBatch(doubleBufferedMatrix Matrix, dbm_io_request *requests, int n)
+ **
+ ** dbm_io_request *requests - the reads and writes to carry out
+ ** int n - number of requests
+ **
+ ** Carries out all the requests, several at a time when
+ ** there are I/O threads available. The requests must not
+ ** overlap each other.
+ **
+ ** Returns 0 if successful, 1 if any request failed
+ **
+ *****************************************************/
+
+static int dbm_RunIOBatch(doubleBufferedMatrix Matrix, dbm_io_request *requests, int n){
+
+  int k, result = 0;
+
+#ifdef DBM_HAVE_THREADS
+  dbm_io_request *request;
+
+  /* partial block writes with direct I/O read then rewrite their neighbours, so may not overlap */
+  if (n > 1 && Matrix->io_threads > 1 && !(Matrix->direct_io && requests[0].write) && !dbm_IOPoolStart(Matrix)){
+    pthread_mutex_lock(&Matrix->io_lock);
+    Matrix->io_batch = requests;
+    Matrix->io_batch_size = n;
+    Matrix->io_next = 0;
+    Matrix->io_pending = n;
+    pthread_cond_broadcast(&Matrix->io_work);
+    while (Matrix->io_next < n){
+      request = &requests[Matrix->io_next++];
+      pthread_mutex_unlock(&Matrix->io_lock);
+      dbm_DoIORequest(Matrix,request);
+      pthread_mutex_lock(&Matrix->io_lock);
+      Matrix->io_pending--;
+    }
+    while (Matrix->io_pending > 0){
+      pthread_cond_wait(&Matrix->io_done,&Matrix->io_lock);
+    }
+    Matrix->io_batch = NULL;
+    Matrix->io_batch_size = 0;
+    pthread_mutex_unlock(&Matrix->io_lock);
+
+    for (k=0; k < n; k++){
+      result |= requests[k].result;
+    }
+    return (result != 0);
+  }
+#endif
+
+  for (k=0; k < n; k++){
+    if (dbm_DoIORequest(Matrix,&requests[k])){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/*****************************************************
+ **
+ ** static int dbm_RowBlockIO(doubleBufferedMatrix Matrix, int *cols, int *first, int *nrows, int ncols, int write)
+ **
+ ** int *cols - the columns involved, in increasing order
+ ** int *first - for each column the row (relative to first_rowdata) to start at
+ ** int *nrows - for each column the number of rows
+ ** int ncols - length of cols, first, nrows
+ ** int write - if true write the rows from the row buffer to file,
+ **             otherwise read them from file into the row buffer.
+ **
+ ** Transfers a section of each given column between the row
+ ** buffer and the files as batches of requests. A batch never
+ ** needs more files than may be held open at once.
+ **
+ ** When reading the same rows of neighbouring columns in the same
+ ** file (in the tiled layout these are close together) they are
+ ** read as a single range and then distributed, provided no more
+ ** than half of what is read is unwanted.
+ **
+ ** Returns 0 if successful, 1 if problem
+ **
+ *****************************************************/
+
+static int dbm_RowBlockIO(doubleBufferedMatrix Matrix, int *cols, int *first, int *nrows, int ncols, int write){
+
+  int j, k, n, g, fd, result = 0;
+  int nfiles, lastfile, file;
+  int row, end, next, block_start, block_rows;
+  int capacity;
+  dbm_io_request *requests;
+  dbm_row_span *spans;
+
+  if (Matrix->memory_mapped){
+    for (j=0; j < ncols; j++){
+      if (write){
+	if (dbm_WriteColumnData(Matrix,cols[j],Matrix->first_rowdata + first[j],nrows[j],&(Matrix->rowdata)[cols[j]][first[j]])){
+	  return 1;
+	}
+      } else {
+	if (dbm_ReadColumnData(Matrix,cols[j],Matrix->first_rowdata + first[j],nrows[j],&(Matrix->rowdata)[cols[j]][first[j]])){
+	  return 1;
+	}
+      }
+    }
+    return 0;
+  }
+
+  /* pending write-behinds of these columns must reach the files first */
+  for (j=0; j < ncols; j++){
+    if (dbm_WriteBehindSync(Matrix,cols[j])){
+      return 1;
+    }
+  }
+
+  capacity = ncols + 1;
+  requests = Calloc(capacity,dbm_io_request);
+  spans = Calloc(capacity,dbm_row_span);
+
+  j = 0;
+  while (j < ncols && !result){
+    n = 0;
+    nfiles = 0;
+    lastfile = -1;
+    while (j < ncols){
+      if (!write && Matrix->col_zero[cols[j]]){
+	memset(&(Matrix->rowdata)[cols[j]][first[j]],0,(size_t)nrows[j]*sizeof(double));
+	j++;
+	continue;
+      }
+      file = dbm_FileOfColumn(Matrix,cols[j]);
+      if (file != lastfile){
+	if (nfiles == Matrix->max_open_files){
+	  break;  /* opening another file could close one this batch is using */
+	}
+	nfiles++;
+	lastfile = file;
+      }
+      fd = dbm_OpenFile(Matrix,file);
+      if (fd < 0){
+	result = 1;
+	break;
+      }
+
+      /* the following columns that want the same rows from the same file */
+      g = 1;
+      if (!write){
+	while (j + g < ncols && cols[j+g] == cols[j] + g && dbm_FileOfColumn(Matrix,cols[j+g]) == file && first[j+g] == first[j] && nrows[j+g] == nrows[j] && !Matrix->col_zero[cols[j+g]]){
+	  g++;
+	}
+      } else {
+	dbm_PrefetchInvalidate(Matrix,cols[j]);
+	Matrix->col_zero[cols[j]] = 0;
+      }
+
+      row = Matrix->first_rowdata + first[j];
+      end = row + nrows[j];
+      while (row < end){
+	if (Matrix->tile_rows){
+	  dbm_TileBlock(Matrix,row,&block_start,&block_rows);
+	  next = (block_start + block_rows < end) ? block_start + block_rows : end;
+	} else {
+	  block_rows = Matrix->rows;
+	  next = end;
+	}
+	if (n + g > capacity){
+	  k = capacity;
+	  capacity = 2*(n + g);
+	  requests = Realloc(requests,capacity,dbm_io_request);
+	  spans = Realloc(spans,capacity,dbm_row_span);
+	  memset(&spans[k],0,(capacity - k)*sizeof(dbm_row_span));
+	}
+	if (g > 1 && (size_t)(g - 1)*block_rows + (next - row) <= (size_t)2*g*(next - row)){
+	  spans[n].col = cols[j];
+	  spans[n].ncols = g;
+	  spans[n].stride = block_rows;
+	  spans[n].first = row - Matrix->first_rowdata;
+	  spans[n].nrows = next - row;
+	  spans[n].scratch = Calloc((size_t)(g - 1)*block_rows + (next - row),double);
+	  requests[n].fd = fd;
+	  requests[n].write = 0;
+	  requests[n].col = -1;
+	  requests[n].offset = (long long)dbm_ColumnOffset(Matrix,cols[j],row);
+	  requests[n].nbytes = ((size_t)(g - 1)*block_rows + (next - row))*dbm_ElementSize(Matrix);
+	  requests[n].buf = spans[n].scratch;
+	  requests[n].result = 0;
+	  n++;
+	} else {
+	  for (k=0; k < g; k++){
+	    requests[n].fd = fd;
+	    requests[n].write = write;
+	    requests[n].col = cols[j+k];
+	    requests[n].first_row = row;
+	    requests[n].nrows = next - row;
+	    requests[n].buf = &(Matrix->rowdata)[cols[j+k]][row - Matrix->first_rowdata];
+	    requests[n].result = 0;
+	    n++;
+	  }
+	}
+	row = next;
+      }
+      j+= g;
+    }
+
+    if (!result && dbm_RunIOBatch(Matrix,requests,n)){
+      result = 1;
+    }
+    for (k=0; k < n; k++){
+      if (spans[k].scratch != NULL){
+	if (!result){
+	  for (g=0; g < spans[k].ncols; g++){
+	    dbm_FromStorage(Matrix,(char *)spans[k].scratch + (size_t)g*spans[k].stride*dbm_ElementSize(Matrix),&(Matrix->rowdata)[spans[k].col + g][spans[k].first],spans[k].nrows);
+	  }
+	}
+	Free(spans[k].scratch);
+	spans[k].scratch = NULL;
+      }
+    }
+  }
+
+  Free(requests);
+  Free(spans);
+  return result;
+}
+
+
+
+
+/*****************************************************
+ ** 
+ ** void dbm_SetClash(doubleBufferedMatrix Matrix,int row, int col)
+ **
+ ** doubleBufferedMatrix Matrix - a buffered Matrix object
+ ** int row, col - location in matrix for potential clash
+ **
+ ** This function sets a flag that says whether or not there is
+ ** a potential clash between the row buffer and the column buffer
+ ** and the location in the matrix of this clash.
+ **
+ ** A clash means that the values might not agree. When in colmode there
+ ** is no chance of a clash because the row buffer does not exist.
+ **
+ ** in rowmode the rowbuffer is assumed to be the updated one.
+ **
+ **
+ *****************************************************/
+
+static void dbm_SetClash(doubleBufferedMatrix Matrix,int row, int col){
+  Matrix->rowcolclash = 1;
+  Matrix->clash_row = row;
+  Matrix->clash_col = col;
+}
+
+/*****************************************************
+ ** 
+ ** void dbm_ClearClash(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix - a buffered Matrix object
+ **
+ ** Clears potential clashes by resyncing the column and row buffers.
+ **
+ *****************************************************/
+
+
+static void dbm_ClearClash(doubleBufferedMatrix Matrix){
+
+    // Should mean that row buffer is up to date and column buffer is potentially not
+  int curcol = Matrix->col_slot[Matrix->clash_col];
+
+
+
+  if (Matrix->rowdata[Matrix->clash_col][Matrix->clash_row - Matrix->first_rowdata] != Matrix->coldata[curcol][Matrix->clash_row]){
+    /* there is a clash, update coldata with current version in rowdata */
+    Matrix->coldata[curcol][Matrix->clash_row] = Matrix->rowdata[Matrix->clash_col][Matrix->clash_row - Matrix->first_rowdata];
+    Matrix->col_dirty[curcol] = 1;
+  } 
+
+  Matrix->rowcolclash=0;
+  
+}
+
+
+
+/*****************************************************
+ ** 
+ ** int dbm_InRowBuffer(doubleBufferedMatrix Matrix,int row, int col)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int row, int col - location in Matrix
+ **
+ ** Returns 1 if the specified element is the Row Buffer
+ ** otherwise returns 0 
+ **
+ *****************************************************/
+
+static int dbm_InRowBuffer(doubleBufferedMatrix Matrix,int row, int col){
+  if ((Matrix->first_rowdata <= row) && (row < Matrix->first_rowdata +  Matrix->max_rows)){
+    return 1;
+  } else {
+    return 0;
+  }
+
+
+
+}
+
+/*****************************************************
+ **
+ ** Eviction policies for the column buffer.
+ **
+ ** The slots of the column buffer are kept on doubly
+ ** linked lists. When a column not in the buffer is
+ ** needed dbm_VictimSlot picks the slot it replaces
+ **
+ ** DBM_EVICT_LRU   - the least recently used column
+ ** DBM_EVICT_FIFO  - the column loaded longest ago
+ ** DBM_EVICT_MRU   - the most recently used column, so that
+ **                   repeated scans of more columns than fit in
+ **                   the buffer keep most of the buffer in use
+ ** DBM_EVICT_CLOCK - the column loaded longest ago that has not
+ **                   been used since it was last passed over
+ ** DBM_EVICT_ARC   - adaptive replacement. Columns used once are
+ **                   kept apart from those used more than once, so
+ **                   that a scan can not push out the often used 
+ **                   columns. The recently evicted columns (the 
+ **                   ghosts) are remembered to tune the split
+ **
+ *****************************************************/
+
+static void dbm_ListClear(dbm_list *list){
+
+  list->head = -1;
+  list->tail = -1;
+  list->size = 0;
+}
+
+
+static void dbm_ListRemove(dbm_list *list, int *prev, int *next, int node){
+
+  if (prev[node] >= 0){
+    next[prev[node]] = next[node];
+  } else {
+    list->head = next[node];
+  }
+  if (next[node] >= 0){
+    prev[next[node]] = prev[node];
+  } else {
+    list->tail = prev[node];
+  }
+  prev[node] = -1;
+  next[node] = -1;
+  list->size--;
+}
+
+
+static void dbm_ListPushFront(dbm_list *list, int *prev, int *next, int node){
+
+  prev[node] = -1;
+  next[node] = list->head;
+  if (list->head >= 0){
+    prev[list->head] = node;
+  } else {
+    list->tail = node;
+  }
+  list->head = node;
+  list->size++;
+}
+
+
+/* the list holding a slot of the column buffer */
+
+static dbm_list *dbm_SlotList(doubleBufferedMatrix Matrix, int slot){
+
+  if (Matrix->eviction_policy == DBM_EVICT_ARC){
+    return &(Matrix->col_list[(int)Matrix->col_ref[slot]]);
+  }
+  return &(Matrix->col_list[0]);
+}
+
+
+static void dbm_ColListRemove(doubleBufferedMatrix Matrix, int slot){
+
+  dbm_ListRemove(dbm_SlotList(Matrix,slot),Matrix->col_list_prev,Matrix->col_list_next,slot);
+}
+
+
+static void dbm_ColListPushFront(doubleBufferedMatrix Matrix, int slot){
+
+  dbm_ListPushFront(dbm_SlotList(Matrix,slot),Matrix->col_list_prev,Matrix->col_list_next,slot);
+}
+
+
+/* the ghost lists are emptied, eg when the size of the column buffer changes */
+
+static void dbm_ClearGhosts(doubleBufferedMatrix Matrix){
+
+  int k, col;
+
+  if (Matrix->col_ghost == NULL){
+    return;
+  }
+  for (k=0; k < 2; k++){
+    for (col = Matrix->ghost_list[k].head; col >= 0; col = Matrix->ghost_next[col]){
+      Matrix->col_ghost[col] = 0;
+    }
+    dbm_ListClear(&(Matrix->ghost_list[k]));
+  }
+}
+
+
+/* number of slots of the column buffer holding a column */
+
+static int dbm_SlotsInUse(doubleBufferedMatrix Matrix){
+
+  return Matrix->col_list[0].size + Matrix->col_list[1].size;
+}
+
+
+static void dbm_DropOldestGhost(doubleBufferedMatrix Matrix, int which){
+
+  int col = Matrix->ghost_list[which].tail;
+
+  dbm_ListRemove(&(Matrix->ghost_list[which]),Matrix->ghost_prev,Matrix->ghost_next,col);
+  Matrix->col_ghost[col] = 0;
+}
+
+
+/*****************************************************
+ **
+ ** void dbm_ColumnUsed(doubleBufferedMatrix Matrix, int slot)
+ **
+ ** Called each time the column in a slot of the column 
+ ** buffer is referenced.
+ **
+ *****************************************************/
+
+static void dbm_ColumnUsed(doubleBufferedMatrix Matrix, int slot){
+
+  if (Matrix->which_cols[slot] == Matrix->col_last_ref){
+    return;   /* still working on the same column */
+  }
+  Matrix->col_last_ref = Matrix->which_cols[slot];
+  Matrix->col_hits++;
+  dbm_SharedActive(Matrix);
+
+  switch (Matrix->eviction_policy){
+  case DBM_EVICT_LRU:
+  case DBM_EVICT_MRU:
+    if (Matrix->col_list[0].head != slot){
+      dbm_ColListRemove(Matrix,slot);
+      dbm_ColListPushFront(Matrix,slot);
+    }
+    break;
+  case DBM_EVICT_CLOCK:
+    Matrix->col_ref[slot] = 1;
+    break;
+  case DBM_EVICT_ARC:
+    /* used again, so it moves to (the head of) T2 */
+    dbm_ColListRemove(Matrix,slot);
+    Matrix->col_ref[slot] = 1;
+    dbm_ColListPushFront(Matrix,slot);
+    break;
+  }
+}
+
+
+/*****************************************************
+ **
+ ** int dbm_VictimSlot(doubleBufferedMatrix Matrix)
+ **
+ ** Returns the slot of the column buffer that the next 
+ ** column loaded will replace. Calling it again before 
+ ** anything else changes gives the same slot. Returns -1
+ ** if the buffer has a free slot (it has just grown, see
+ ** dbm_SharedBorrow) so nothing need be replaced.
+ **
+ *****************************************************/
+
+static int dbm_VictimSlot(doubleBufferedMatrix Matrix){
+
+  int slot;
+  dbm_list *T1 = &(Matrix->col_list[0]);
+  dbm_list *T2 = &(Matrix->col_list[1]);
+
+  slot = dbm_SlotsInUse(Matrix);
+  if (slot < Matrix->max_cols && slot < Matrix->cols){
+    return -1;
+  }
+
+  switch (Matrix->eviction_policy){
+  case DBM_EVICT_MRU:
+    return T1->head;
+  case DBM_EVICT_CLOCK:
+    /* columns used since they were last passed over get a second chance */
+    slot = T1->tail;
+    while (slot >= 0 && Matrix->col_ref[slot]){
+      Matrix->col_ref[slot] = 0;
+      dbm_ColListRemove(Matrix,slot);
+      dbm_ColListPushFront(Matrix,slot);
+      slot = T1->tail;
+    }
+    return slot;
+  case DBM_EVICT_ARC:
+    if (T1->size > 0 && (T1->size > Matrix->arc_target || T2->size == 0)){
+      return T1->tail;
+    }
+    return T2->tail;
+  default:
+    return T1->tail;
+  }
+}
+
+
+/*****************************************************
+ **
+ ** void dbm_ColumnEvicted(doubleBufferedMatrix Matrix, int slot)
+ **
+ ** void dbm_ColumnLoaded(doubleBufferedMatrix Matrix, int slot)
+ **
+ ** The column in a slot of the column buffer is about to be
+ ** replaced, and a new column has been put in a slot. 
+ **
+ *****************************************************/
+
+static void dbm_ColumnEvicted(doubleBufferedMatrix Matrix, int slot){
+
+  int col = Matrix->which_cols[slot];
+  int which = (Matrix->eviction_policy == DBM_EVICT_ARC) ? Matrix->col_ref[slot] : 0;
+
+  dbm_ColListRemove(Matrix,slot);
+  if (Matrix->eviction_policy == DBM_EVICT_ARC){
+    /* remembered on B1 or B2 */
+    Matrix->col_ghost[col] = which + 1;
+    dbm_ListPushFront(&(Matrix->ghost_list[which]),Matrix->ghost_prev,Matrix->ghost_next,col);
+  }
+}
+
+
+static void dbm_ColumnLoaded(doubleBufferedMatrix Matrix, int slot){
+
+  int col = Matrix->which_cols[slot];
+  int c = Matrix->max_cols;
+  int delta;
+  dbm_list *B1 = &(Matrix->ghost_list[0]);
+  dbm_list *B2 = &(Matrix->ghost_list[1]);
+
+  Matrix->col_ref[slot] = 0;
+
+  if (Matrix->eviction_policy == DBM_EVICT_ARC){
+    if (Matrix->col_ghost[col] == 1){
+      /* evicted from T1 too soon, so T1 should be larger */
+      delta = (B1->size >= B2->size) ? 1 : B2->size/B1->size;
+      Matrix->arc_target = (Matrix->arc_target + delta < c) ? Matrix->arc_target + delta : c;
+    } else if (Matrix->col_ghost[col] == 2){
+      /* evicted from T2 too soon, so T1 should be smaller */
+      delta = (B2->size >= B1->size) ? 1 : B1->size/B2->size;
+      Matrix->arc_target = (Matrix->arc_target - delta > 0) ? Matrix->arc_target - delta : 0;
+    }
+    if (Matrix->col_ghost[col]){
+      dbm_ListRemove(&(Matrix->ghost_list[Matrix->col_ghost[col] - 1]),Matrix->ghost_prev,Matrix->ghost_next,col);
+      Matrix->col_ghost[col] = 0;
+      Matrix->col_ref[slot] = 1;   /* seen before, so it goes on T2 */
+    } else {
+      /* keep at most c columns on T1 and B1 and 2c on all four lists */
+      while (B1->size > 0 && Matrix->col_list[0].size + B1->size >= c){
+	dbm_DropOldestGhost(Matrix,0);
+      }
+      while (B2->size > 0 && Matrix->col_list[0].size + Matrix->col_list[1].size + B1->size + B2->size >= 2*c){
+	dbm_DropOldestGhost(Matrix,1);
+      }
+    }
+  }
+  dbm_ColListPushFront(Matrix,slot);
+}
+
+
+/* makes room for n slots in the arrays parallel to which_cols */
+
+static void dbm_ReserveColSlots(doubleBufferedMatrix Matrix, int n){
+
+  if (n < 1){
+    n = 1;
+  }
+  Matrix->which_cols = Realloc(Matrix->which_cols,n,int);
+  Matrix->col_dirty = Realloc(Matrix->col_dirty,n,int);
+  Matrix->coldata = Realloc(Matrix->coldata,n,double *);
+  Matrix->col_list_prev = Realloc(Matrix->col_list_prev,n,int);
+  Matrix->col_list_next = Realloc(Matrix->col_list_next,n,int);
+  Matrix->col_ref = Realloc(Matrix->col_ref,n,char);
+}
+
+
+/*****************************************************
+ ** 
+ ** int dbm_InColBuffer(doubleBufferedMatrix Matrix,int row, int col)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int row, int col - location in Matrix
+ **
+ ** Returns 1 if the specified element is the Col Buffer
+ ** otherwise returns 0 
+ **
+ *****************************************************/
+
+static int dbm_InColBuffer(doubleBufferedMatrix Matrix,int row, int col, int *which_col_index){
+
+  int curcol = Matrix->col_slot[col];
+
+  if (curcol >= 0){
+    *which_col_index = curcol;
+    return 1;  /* Found it */
+  }
+  
+  return 0; /* Not found */
+}
+
+/*****************************************************
+ ** 
+ ** int dbm_FlushRowBuffer(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** Writes entire contents of Row Buffer back out to file
+ **
+ ** Returns 0 if successful, Returns 1 if problem
+ **
+ *****************************************************/
+
+
+static int dbm_FlushRowBuffer(doubleBufferedMatrix Matrix){
+
+
+  int j, n = 0;
+  int *cols, *first, *nrows;
+
+  if (Matrix->cols == 0){
+    return 0;
+  }
+
+  cols = Calloc(Matrix->cols,int);
+  first = Calloc(Matrix->cols,int);
+  nrows = Calloc(Matrix->cols,int);
+
+  for (j =0; j < Matrix->cols; j++){
+    if (Matrix->row_dirty_first[j] > Matrix->row_dirty_last[j]){
+      continue;   /* nothing changed in this column */
+    }
+    cols[n] = j;
+    first[n] = Matrix->row_dirty_first[j];
+    nrows[n] = Matrix->row_dirty_last[j] - Matrix->row_dirty_first[j] + 1;
+    n++;
+  } 
+
+  if (dbm_RowBlockIO(Matrix,cols,first,nrows,n,1)){
+    Free(cols);
+    Free(first);
+    Free(nrows);
+    return 1;
+  }
+  
+  for (j =0; j < n; j++){
+    dbm_ClearRowDirty(Matrix,cols[j]);
+  }
+  Free(cols);
+  Free(first);
+  Free(nrows);
+  return 0;
+}
+
+
+/*****************************************************
+ ** 
+ ** void dbm_ClearRowDirty(doubleBufferedMatrix Matrix, int col)
+ **
+ ** void dbm_MarkRowDirty(doubleBufferedMatrix Matrix, int row, int col)
+ **
+ ** Maintain the range of modified rows for a column of 
+ ** the row buffer. row is relative to first_rowdata.
+ **
+ *****************************************************/
+
+static void dbm_ClearRowDirty(doubleBufferedMatrix Matrix, int col){
+
+  Matrix->row_dirty_first[col] = Matrix->max_rows;
+  Matrix->row_dirty_last[col] = -1;
+}
+
+
+static void dbm_MarkRowDirty(doubleBufferedMatrix Matrix, int row, int col){
+
+  if (row < Matrix->row_dirty_first[col]){
+    Matrix->row_dirty_first[col] = row;
+  }
+  if (row > Matrix->row_dirty_last[col]){
+    Matrix->row_dirty_last[col] = row;
+  }
+}
+
+/*****************************************************
+ ** 
+ ** int dbm_FlushOldestColumn(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** Writes what is stored in the column of the buffer that is
+ ** the next to be replaced (see dbm_VictimSlot) to file.
+ **
+ ** Return 1 if problem, 0 if fine.
+ **
+ *****************************************************/
+
+
+static int dbm_FlushOldestColumn(doubleBufferedMatrix Matrix){
+
+  int slot = dbm_VictimSlot(Matrix);
+
+  if (Matrix->memory_mapped || slot < 0){
+    return 0;  /* column buffer is a view of the file, nothing to write */
+  }
+  if (!Matrix->col_dirty[slot]){
+    return 0;  /* unchanged since it was read in */
+  }
+  if (dbm_WriteColumnData(Matrix,Matrix->which_cols[slot],0,Matrix->rows,Matrix->coldata[slot])){
+    return 1;
+  }
+  Matrix->col_dirty[slot] = 0;
+  return 0;
+
+}
+
+
+/*****************************************************
+ ** 
+ ** int dbm_EvictOldestColumn(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** As dbm_FlushOldestColumn, but the write may be left to the
+ ** write-behind thread, in which case the slot of the column
+ ** buffer is given a spare buffer. Only for
+ ** use when that column is about to leave the buffer.
+ **
+ ** Return 1 if problem, 0 if fine.
+ **
+ *****************************************************/
+
+static int dbm_EvictOldestColumn(doubleBufferedMatrix Matrix){
+
+  int slot = dbm_VictimSlot(Matrix);
+
+  if (!Matrix->memory_mapped && slot >= 0 && Matrix->col_dirty[slot] && !dbm_WriteBehindQueue(Matrix,Matrix->which_cols[slot],&(Matrix->coldata[slot]))){
+    Matrix->col_dirty[slot] = 0;
+    return 0;
+  }
+  return dbm_FlushOldestColumn(Matrix);
+
+}
+
+
+/*****************************************************
+ ** 
+ ** int dbm_FlushOldestColumn(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** Writes what is stored in all the columns in the column buffer to
+ ** file
+ **
+ ** Return 1 if problem, 0 if fine.
+ **
+ **
+ ****************************************************/
+
+
+
+static int dbm_FlushAllColumns(doubleBufferedMatrix Matrix){
+
+
+
+  int k,lastcol;  
+ 
+  if (Matrix->memory_mapped){
+    return 0;
+  }
+
+  if (Matrix->cols < Matrix->max_cols){
+    lastcol = Matrix->cols;
+  } else {
+    lastcol = Matrix->max_cols;
+  }
+    
+  
+  for (k=0; k < lastcol; k++){
+    if (!Matrix->col_dirty[k]){
+      continue;
+    }
+    if (dbm_WriteColumnData(Matrix,Matrix->which_cols[k],0,Matrix->rows,Matrix->coldata[k])){
+      return 1;
+    }
+    Matrix->col_dirty[k] = 0;
+  }
+
+  return 0;
+
+}
+
+
+/*****************************************************
+ ** 
+ ** static int dbm_TakeColumnSlot(doubleBufferedMatrix Matrix,int col)
+ **
+ ** Gives column col the slot of the column buffer chosen by the
+ ** eviction policy, or a free slot if there is one, and returns
+ ** it. When memory mapped the slot becomes a view of the column,
+ ** otherwise it must be filled in by the caller.
+ **
+ ****************************************************/
+
+static int dbm_TakeColumnSlot(doubleBufferedMatrix Matrix,int col){
+
+  int slot = dbm_VictimSlot(Matrix);
+
+  if (slot < 0){
+    slot = dbm_SlotsInUse(Matrix);
+    dbm_ReserveColSlots(Matrix,slot+1);
+    Matrix->coldata[slot] = dbm_NewColumnSlot(Matrix,col);
+  } else {
+    dbm_ColumnEvicted(Matrix,slot);
+    Matrix->col_slot[Matrix->which_cols[slot]] = -1;
+    if (Matrix->memory_mapped){
+      dbm_ReleaseColumnSlot(Matrix,Matrix->coldata[slot]);
+      Matrix->coldata[slot] = dbm_NewColumnSlot(Matrix,col);
+    }
+  }
+  Matrix->which_cols[slot] = col;
+  Matrix->col_slot[col] = slot;
+  return slot;
+}
+
+
+/*****************************************************
+ ** 
+ ** void dbm_LoadNewColumn(doubleBufferedMatrix Matrix,int col);
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int col - column of the matrix to load into the buffer
+ **
+ ** Read the specified column into the column buffer
+ **
+ ** Works by replacing the column of the column buffer chosen by the eviction policy
+ ** (see dbm_VictimSlot) by reading in new data from file, or by using a free
+ ** slot if there is one
+ **
+ ** Returns 0 if successful, returns 1 if problem
+ **
+ ****************************************************/
+
+static int dbm_LoadNewColumn(doubleBufferedMatrix Matrix,int col){
+  
+  int slot = dbm_TakeColumnSlot(Matrix,col);
+  int held;
+
+  Matrix->col_dirty[slot] = 0;
+  dbm_ColumnLoaded(Matrix,slot);
+  Matrix->col_misses++;
+  Matrix->col_last_ref = col;
+  
+  if (Matrix->memory_mapped){
+    return 0;
+  }
+
+  //printf("loading column %d \n",whichcol);
+  /* a column recently pushed out of the buffer may still be held for the write-behind thread */
+  held = dbm_WriteBehindTake(Matrix,col,&(Matrix->coldata[slot]));
+  if (held == 2){
+    Matrix->col_dirty[slot] = 1;  /* not written yet */
+  }
+  if (!held && dbm_PrefetchTake(Matrix,col,&(Matrix->coldata[slot]))){
+    if (dbm_ReadColumnData(Matrix,col,0,Matrix->rows,Matrix->coldata[slot])){
+      return 1;
+    }
+  }
+  if (Matrix->colmode){
+    dbm_PrefetchIssue(Matrix,col);
+  }
+  return 0;
+  
+}
+
+/*****************************************************
+ ** 
+ ** void dbm_LoadNewColumn_nofill(doubleBufferedMatrix Matrix,int col);
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int col - column of the matrix to load into the buffer
+ **
+ ** Read the specified column into the column buffer
+ **
+ ** Works by giving the slot of the column buffer chosen by the eviction policy to the 
+ ** column. Does not fill it with new data. The calling function should 
+ ** appropriately handle this.
+ **
+ ** WARNING: If you don't no why this function exists you should probably
+ **          be calling dbm_LoadNewColumn instead
+ **
+ ** Returns 0 if successful, returns 1 if problem
+ **
+ ****************************************************/
+
+static int dbm_LoadNewColumn_nofill(doubleBufferedMatrix Matrix,int col){
+  
+  int slot = dbm_TakeColumnSlot(Matrix,col);
+
+  Matrix->col_dirty[slot] = 1;   /* caller is going to fill it in */
+  dbm_ColumnLoaded(Matrix,slot);
+  Matrix->col_misses++;
+  Matrix->col_last_ref = col;
+
+  if (!Matrix->memory_mapped){
+    /* any copy waiting to be written is about to be out of date */
+    dbm_WriteBehindTake(Matrix,col,NULL);
+  }
+  
+  //printf("loading column %d \n",whichcol);
+  return 0;
+  
+}
+
+
+
+/*****************************************************
+ ** 
+ ** int dbm_LoadRowBuffer(doubleBufferedMatrix Matrix,int row)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int row  - row to read into row buffer
+ **
+ ** Reads the specified row and adjacent rows into the 
+ ** row buffer.
+ ** 
+ ** Returns 0 if successful, returns 1 if problem
+ **
+ *****************************************************/
+
+
+
+
+static int dbm_LoadRowBuffer(doubleBufferedMatrix Matrix,int row){
+
+
+  int j,k,n;
+  int curcol;
+  int *cols, *first, *nrows;
+  int block_start, block_rows;
+
+
+  /* in the tiled layout keep within one block if possible, otherwise start at a block boundary */
+  if (Matrix->tile_rows){
+    dbm_TileBlock(Matrix,row,&block_start,&block_rows);
+    if (Matrix->max_rows <= block_rows){
+      if (row > block_start + block_rows - Matrix->max_rows){
+	row = block_start + block_rows - Matrix->max_rows;
+      }
+    } else {
+      row = block_start;
+    }
+  }
+
+  if (row > Matrix->rows - Matrix->max_rows){
+    Matrix->first_rowdata = Matrix->rows - Matrix->max_rows;
+  } else {
+    Matrix->first_rowdata = row;
+  }
+
+  /* columns in the column buffer are copied from there below, so only read the others */
+  cols = Calloc(Matrix->cols + 1,int);
+  first = Calloc(Matrix->cols + 1,int);
+  nrows = Calloc(Matrix->cols + 1,int);
+  n = 0;
+  for (j =0; j < Matrix->cols; j++){
+    if (dbm_InColBuffer(Matrix,0,j,&curcol)){
+      continue;
+    }
+    cols[n] = j;
+    first[n] = 0;
+    nrows[n] = Matrix->max_rows;
+    n++;
+  }
+  k = dbm_RowBlockIO(Matrix,cols,first,nrows,n,0);
+  Free(cols);
+  Free(first);
+  Free(nrows);
+  if (k){
+    return 1;
+  }
+  
+  for (j =0; j < Matrix->cols; j++){
+    curcol = Matrix->col_slot[j];
+    if (curcol >= 0){
+      for (k= Matrix->first_rowdata; k < Matrix->first_rowdata + Matrix->max_rows; k++){
+	Matrix->rowdata[j][k- Matrix->first_rowdata] = Matrix->coldata[curcol][k];
+      }	
+    }
+  }
+
+  for (j =0; j < Matrix->cols; j++){
+    dbm_ClearRowDirty(Matrix,j);
+  }
+
+  return 0;
+
+}
+
+
+
+
+
+
+/*****************************************************
+ ** 
+ ** int dbm_LoadAdditionalColumn(doubleBufferedMatrix Matrix,int col, int where)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int col - column to read into buffer
+ ** int where - which column of the buffer do we read it into.
+ **
+ ** Allocates space and reads in a new column of data.
+ ** 
+ ** Returns 0 if successful, returns 1 if problem
+ **
+ *****************************************************/
+
+
+static int dbm_LoadAdditionalColumn(doubleBufferedMatrix Matrix,int col, int where){
+
+  Matrix->coldata[where] = dbm_NewColumnSlot(Matrix,col);
+  Matrix->which_cols[where] = col;
+  Matrix->col_slot[col] = where;
+  Matrix->col_dirty[where] = 0;
+  dbm_ColumnLoaded(Matrix,where);
+
+  if (Matrix->memory_mapped){
+    return 0;
+  }
+  return dbm_ReadColumnData(Matrix,col,0,Matrix->rows,Matrix->coldata[where]);
+}
+
+/*****************************************************
+ ** 
+ ** double *dbm_internalValue(doubleBufferedMatrix Matrix,int row, int col, int writing)
+ **
+ **
+ ** this function returns a pointer to a location containing current value
+ ** of element located at (row,col) in the matrix. Carries out all the necessary
+ ** mechanics of loading it into the buffer if it is not there currently.
+ **
+ ** if writing is true the caller is going to store a value at the returned 
+ ** location, so the column buffer slot is marked as modified.
+ ** (Writes that land in the row buffer reach the column buffer via
+ ** dbm_ClearClash)
+ **
+ ** Use dbm_internalgetValue and dbm_internalsetValue rather than calling
+ ** this directly.
+ **
+ *****************************************************/
+
+static double *dbm_internalValue(doubleBufferedMatrix Matrix,int row, int col, int writing){
+  
+  
+  int whichcol = col;
+  int whichrow = row;
+ 
+  int curcol;
+ 
+
+  if (!(Matrix->colmode)){
+    /* Fix up any potential clashes */
+    if ((Matrix->rowcolclash)){
+      dbm_ClearClash(Matrix);
+    }
+    
+    /* check to see if this cell is in row buffer, then column buffer, then read from files */
+    
+    if (dbm_InRowBuffer(Matrix,whichrow,whichcol)){
+      /* In row buffer so return */
+      if (dbm_InColBuffer(Matrix,whichrow,whichcol,&curcol)){
+	dbm_SetClash(Matrix, whichrow,whichcol);
+      }
+      if (writing){
+	dbm_MarkRowDirty(Matrix,whichrow - Matrix->first_rowdata,whichcol);
+      }
+      
+      return &(Matrix->rowdata[whichcol][whichrow - Matrix->first_rowdata]);
+    } else if (dbm_InColBuffer(Matrix,whichrow,whichcol,&curcol)){
+      dbm_ColumnUsed(Matrix,curcol);
+      if (writing){
+	Matrix->col_dirty[curcol] = 1;
+      }
+      return &(Matrix->coldata[curcol][whichrow]);
+    } else {
+      
+      /* looks like we are going to have to go to files */
+      //printf("Couldn't find in buffers\n");
+      dbm_SharedBorrow(Matrix);
+
+      if (!(Matrix->readonly)){
+	/* Flush buffers */ 
+	/* First row buffer */
+	dbm_FlushRowBuffer(Matrix);
+      
+	/* Now flush the column buffer (for oldest column) */
+	dbm_FlushOldestColumn(Matrix);
+      }
+      
+      /* Now fill up the buffer */
+      /* read in this row and surrounding rows into row buffer */
+      dbm_LoadRowBuffer(Matrix,whichrow);
+      
+      /* read in this column into column buffer */
+      dbm_LoadNewColumn(Matrix,whichcol);
+      
+      
+      dbm_SetClash(Matrix,whichrow,whichcol);
+      if (writing){
+	dbm_MarkRowDirty(Matrix,whichrow - Matrix->first_rowdata,whichcol);
+      }
+      return &(Matrix->rowdata[whichcol][whichrow - Matrix->first_rowdata]);
+    
+    }
+  } else {
+    if (dbm_InColBuffer(Matrix,whichrow,whichcol,&curcol)){
+      dbm_ColumnUsed(Matrix,curcol);
+      if (writing){
+	Matrix->col_dirty[curcol] = 1;
+      }
+      return &(Matrix->coldata[curcol][whichrow]);
+    } else {
+      dbm_SharedBorrow(Matrix);
+      if (!(Matrix->readonly))
+	dbm_EvictOldestColumn(Matrix); 
+      dbm_LoadNewColumn(Matrix,whichcol);
+      curcol = Matrix->col_slot[whichcol];
+      if (writing){
+	Matrix->col_dirty[curcol] = 1;
+      }
+      return &(Matrix->coldata[curcol][whichrow]);
+    }
+
+  }
+
+   
+}
+
+
+
+static double *dbm_internalgetValue(doubleBufferedMatrix Matrix,int row, int col){
+
+  return dbm_internalValue(Matrix,row,col,0);
+}
+
+
+static double *dbm_internalsetValue(doubleBufferedMatrix Matrix,int row, int col){
+
+  return dbm_internalValue(Matrix,row,col,1);
+}
+
+
+/*****************************************************
+ ** 
+ ** static int *dbm_whatsInColumnBuffer(doubleBufferedMatrix Matrix)
+ **
+ ** Returns a pointer to a vector containing column indices 
+ **
+ **
+ *****************************************************/
+
+
+static int *dbm_whatsInColumnBuffer(doubleBufferedMatrix Matrix){
+
+  return Matrix->which_cols;
+  
+}
+
+
+
+
+
+
+/*****************************************************
+ *****************************************************
+ *****************************************************
+ **
+ ** The following are functions that should be considered
+ ** exposed to the real world. Ie the constitute the 
+ ** API that might be used by others.
+ ** Every thing above this point is internal, subject to
+ ** be changed and not to be called except from within
+ ** the routines below.
+ ** 
+ **
+ **
+ **
+ *****************************************************
+ *****************************************************
+ *****************************************************/
+
+/*****************************************************
+ **
+ ** doubleBufferedMatrix dbm_alloc(int max_rows,int max_cols,const char *prefix, const char *directory)
+ **
+ ** int max_rows - maximum number of rows that can be stored in the row buffer (if it is activated)
+ ** int max_cols - maximum number of columns that can be stored in the column buffer
+ ** const char *prefix - character string to use for start of filename for temporary files. 
+ ** const char *directory - character string for 
+ **
+ ** 
+ ** RETURNS an allocated empty doubleBufferedMatrix. Note that this routine
+ **         does not actually allocate the space for the data that is stored.
+ **         This is done by the AddColumn routine.
+ **                               
+ **
+ *****************************************************/
+
+
+doubleBufferedMatrix dbm_alloc(int max_rows,int max_cols,const char *prefix, const char *directory){
+  
+  char *tmp;
+
+  struct _double_buffered_matrix *handle;
+
+  
+  handle = (struct _double_buffered_matrix *)Calloc(1,struct _double_buffered_matrix);
+
+
+
+
+  handle->rows =0;
+  handle->cols =0;
+  handle->max_rows = max_rows;
+  handle->max_cols = max_cols;
+  handle->buffer_bytes = 0;
+  handle->shared = 0;
+  handle->shared_prev = NULL;
+  handle->shared_next = NULL;
+  
+  handle->coldata = 0;
+  handle->rowdata = 0;
+  handle->row_dirty_first = 0;
+  handle->row_dirty_last = 0;
+  
+  handle->which_cols = 0;
+  handle->col_dirty = 0;
+  handle->col_slot = 0;
+  handle->col_list_prev = 0;
+  handle->col_list_next = 0;
+  dbm_ListClear(&(handle->col_list[0]));
+  dbm_ListClear(&(handle->col_list[1]));
+  handle->col_ref = 0;
+  handle->eviction_policy = DBM_EVICT_LRU;
+  handle->col_ghost = NULL;
+  handle->ghost_prev = NULL;
+  handle->ghost_next = NULL;
+  dbm_ListClear(&(handle->ghost_list[0]));
+  dbm_ListClear(&(handle->ghost_list[1]));
+  handle->arc_target = 0;
+  handle->col_hits = 0;
+  handle->col_misses = 0;
+  handle->col_last_ref = -1;
+  handle->col_zero = 0;
+  handle->col_capacity = 0;
+
+  handle->filenames = 0;
+  handle->cols_per_file = 1;
+  handle->tile_rows = 0;
+  handle->storage_type = DBM_STORAGE_DOUBLE;
+  handle->memory_mapped = 0;
+  handle->file_map = 0;
+  handle->persistent = 0;
+  handle->direct_io = 0;
+
+  handle->prefetch_depth = DBM_DEFAULT_PREFETCH;
+  handle->prefetch_last_col = -1;
+  handle->prefetch = 0;
+#ifdef DBM_HAVE_THREADS
+  handle->prefetch_running = 0;
+  handle->prefetch_shutdown = 0;
+  handle->prefetch_seq = 0;
+  handle->prefetch_nthreads = 0;
+  handle->prefetch_threads = NULL;
+#endif
+
+  handle->writebehind_depth = DBM_DEFAULT_WRITEBEHIND;
+  handle->writebehind = 0;
+#ifdef DBM_HAVE_THREADS
+  handle->writebehind_running = 0;
+  handle->writebehind_shutdown = 0;
+  handle->writebehind_seq = 0;
+#endif
+
+  handle->io_threads = DBM_DEFAULT_IO_THREADS;
+#ifdef DBM_HAVE_THREADS
+  handle->io_running = 0;
+  handle->io_thread = NULL;
+  handle->io_batch = NULL;
+#endif
+
+  handle->file_capacity = 0;
+  handle->file_fd = 0;
+  handle->file_lru_prev = 0;
+  handle->file_lru_next = 0;
+  handle->file_lru_head = -1;
+  handle->file_lru_tail = -1;
+  handle->n_open_files = 0;
+  handle->max_open_files = DBM_DEFAULT_MAX_OPEN_FILES;
+  
+  handle->first_rowdata =0;
+
+  tmp = Calloc(strlen(prefix)+1,char);
+  strcpy(tmp,prefix);
+
+  handle->fileprefix = tmp;
+  
+  tmp = Calloc(strlen(directory)+1,char);
+  strcpy(tmp,directory);
+  
+  handle->filedirectory = tmp;
+  handle->directories = NULL;
+  handle->ndirectories = 0;
+
+  handle->rowcolclash = 0;
+
+  handle->colmode = 1;        /* Always start of in column mode */
+
+  handle->readonly=0;
+  
+  return (doubleBufferedMatrix)handle;
+
+}
+
+/*****************************************************
+ **
+ ** int dbm_free(doubleBufferedMatrix Matrix)
+ ** 
+ ** doubleBufferedMatrix *Matrix 
+ ** 
+ ** Deallocates all allocated space and deletes temporary files
+ ** (unless the matrix is persistent, see dbm_setPersistent)
+ **
+ *****************************************************/
+
+int dbm_free(doubleBufferedMatrix Matrix){
+  
+  int i;
+  int lastcol;
+  int nfiles;
+  struct _double_buffered_matrix *handle;
+  
+  handle = Matrix;
+
+  nfiles = dbm_NumFiles(handle);
+
+  if (handle->cols < handle->max_cols){
+    lastcol = handle->cols;
+  } else {
+    lastcol = handle->max_cols;
+  }
+
+  if (handle->persistent){
+    /* the files outlive the matrix so must hold its current contents */
+    dbm_Flush(handle);
+  }
+  dbm_setSharedBuffer(handle,0);
+
+  dbm_WriteBehindStop(handle);
+  dbm_PrefetchStop(handle);
+#ifdef DBM_HAVE_THREADS
+  dbm_IOPoolStop(handle);
+#endif
+  dbm_UnmapAllFiles(handle);
+  dbm_CloseAllFiles(handle);
+
+  if (!handle->persistent){
+    for (i=0; i < nfiles; i++){
+      //printf("%s\n",filenames[i]);
+      remove(handle->filenames[i]);
+    }
+  }
+
+  Free(handle->which_cols);
+  Free(handle->col_dirty);
+  Free(handle->col_slot);
+  Free(handle->col_list_prev);
+  Free(handle->col_list_next);
+  Free(handle->col_ref);
+  if (handle->col_ghost != NULL){
+    Free(handle->col_ghost);
+    Free(handle->ghost_prev);
+    Free(handle->ghost_next);
+  }
+  Free(handle->col_zero);
+
+  Free(handle->file_fd);
+  Free(handle->file_lru_prev);
+  Free(handle->file_lru_next);
+  if (handle->file_map != NULL){
+    Free(handle->file_map);
+  }
+
+  for (i = 0; i < nfiles; i++){
+    Free(handle->filenames[i]);
+  }
+  Free(handle->filenames);
+
+  if (!(handle->colmode)){
+    for (i=0; i < handle->cols; i++){
+      Free(handle->rowdata[i]);
+    }
+    Free(handle->rowdata);
+    Free(handle->row_dirty_first);
+    Free(handle->row_dirty_last);
+  }
+
+
+  if (!handle->memory_mapped){
+    for (i=0; i < lastcol; i++){
+      Free(handle->coldata[i]);
+    }
+  }
+  Free(handle->coldata);
+  
+
+  Free(handle->fileprefix);
+  Free(handle->filedirectory);
+  dbm_FreeDirectories(handle);
+
+  Free(handle);
+  return 0;
+}
+
+
+/*****************************************************
+ **
+ ** int dbm_setRows(doubleBufferedMatrix Matrix, int Rows)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int Rows - number of rows in each column of the matrix
+ ** 
+ ** returns 1 if successful, 0 otherwise
+ **
+ ** Note that this function sets the number of rows in
+ ** the matrix. Once set the number of rows can not be altered.
+ **
+ *****************************************************/
+
+
+int dbm_setRows(doubleBufferedMatrix Matrix, int Rows){
+
+
+  if (Matrix->rows > 0){
+    return 0;
+  }
+
+  Matrix->rows = Rows;
+
+  if (Matrix->rows < Matrix->max_rows){
+    Matrix->max_rows = Matrix->rows;
+  }
+  dbm_BalanceBuffers(Matrix,!(Matrix->colmode));
+
+  
+  return 1;
+
+}
+
+/*****************************************************
+ **
+ ** static int dbm_GrowCapacity(int capacity, int needed)
+ **
+ ** Returns a capacity of at least needed, at least doubling
+ ** the current capacity when it must grow. Adding columns one
+ ** at a time then only reallocates O(log(cols)) times.
+ **
+ *****************************************************/
+
+static int dbm_GrowCapacity(int capacity, int needed){
+
+  if (needed <= capacity){
+    return capacity;
+  }
+  if (capacity > needed/2){
+    return 2*capacity;
+  }
+  return needed;
+}
+
+
+/* makes room in the per file arrays (filenames, file_fd etc) for nfiles files */
+
+static void dbm_ReserveFiles(doubleBufferedMatrix Matrix, int nfiles){
+
+  int capacity = dbm_GrowCapacity(Matrix->file_capacity,nfiles);
+
+  if (capacity == Matrix->file_capacity){
+    return;
+  }
+  Matrix->filenames = Realloc(Matrix->filenames,capacity,char *);
+  Matrix->file_fd = Realloc(Matrix->file_fd,capacity,int);
+  Matrix->file_lru_prev = Realloc(Matrix->file_lru_prev,capacity,int);
+  Matrix->file_lru_next = Realloc(Matrix->file_lru_next,capacity,int);
+  if (Matrix->memory_mapped){
+    Matrix->file_map = Realloc(Matrix->file_map,capacity,char *);
+  }
+  Matrix->file_capacity = capacity;
+}
+
+
+/* makes room in the per column arrays (col_zero, col_slot, the ghosts of ARC and in row mode rowdata etc) for ncols columns */
+
+static void dbm_ReserveColumns(doubleBufferedMatrix Matrix, int ncols){
+
+  int capacity = dbm_GrowCapacity(Matrix->col_capacity,ncols);
+
+  if (capacity == Matrix->col_capacity){
+    return;
+  }
+  Matrix->col_zero = Realloc(Matrix->col_zero,capacity,char);
+  Matrix->col_slot = Realloc(Matrix->col_slot,capacity,int);
+  if (Matrix->col_ghost != NULL){
+    Matrix->col_ghost = Realloc(Matrix->col_ghost,capacity,char);
+    Matrix->ghost_prev = Realloc(Matrix->ghost_prev,capacity,int);
+    Matrix->ghost_next = Realloc(Matrix->ghost_next,capacity,int);
+  }
+  if (!(Matrix->colmode)){
+    Matrix->rowdata = Realloc(Matrix->rowdata,capacity,double *);
+    Matrix->row_dirty_first = Realloc(Matrix->row_dirty_first,capacity,int);
+    Matrix->row_dirty_last = Realloc(Matrix->row_dirty_last,capacity,int);
+  }
+  Matrix->col_capacity = capacity;
+}
+
+
+/*****************************************************
+ **
+ ** Copying storage files
+ **
+ ** When dbm_setNewDirectory can not rename a file into the new
+ ** directory (typically because it is on another file system)
+ ** the file is copied instead. Up to io_threads files are
+ ** copied at once while the calling thread reports progress.
+ ** Only the parts of a file holding data are copied, holes are
+ ** left as holes. Each copy is flushed to disk and its size
+ ** checked before the caller removes the original.
+ **
+ ** The copy threads only use the dbm_copy_job they are given.
+ **
+ *****************************************************/
+
+typedef struct {
+  char **from;            /* files to copy */
+  char **to;              /* where to copy them (these already exist, empty) */
+  int n;
+  int next;               /* next file to be copied */
+  int failed;             /* set when a copy fails, no further copies are started */
+  double done;            /* bytes copied so far */
+  double total;           /* bytes in all the files */
+  void (*progress)(double, double, void *);
+  void *progress_arg;
+#ifdef DBM_HAVE_THREADS
+  int threaded;           /* true when the copies are carried out by other threads */
+  int running;            /* number of those threads yet to finish */
+  pthread_mutex_t lock;   /* protects next, failed, done and running */
+  pthread_cond_t changed; /* signalled when done or running change */
+#endif
+} dbm_copy_job;
+
+
+/* size of a file in bytes, -1 if it can not be opened */
+
+static double dbm_FileSize(const char *filename){
+
+  int fd = open(filename,O_RDONLY | O_BINARY);
+  double size;
+
+  if (fd < 0){
+    return -1.0;
+  }
+#ifdef _WIN32
+  size = (double)_lseeki64(fd,0,SEEK_END);
+#else
+  size = (double)lseek(fd,0,SEEK_END);
+#endif
+  close(fd);
+  return size;
+}
+
+
+/*****************************************************
+ **
+ ** static int dbm_CopyRange(int in, int out, dbm_offset offset, size_t nbytes, int *method)
+ **
+ ** int in, out - files to copy from and to
+ ** dbm_offset offset - where in the files to start
+ ** size_t nbytes - number of bytes to copy
+ ** int *method - how to copy: 0 copy_file_range(), 1 sendfile(),
+ **               2 read and write through a buffer. Moved on
+ **               to the next when the kernel does not support
+ **               one for these files
+ **
+ ** Copies a range of one file to the same place in another.
+ **
+ ** Returns 0 if successful, 1 if problem
+ **
+ *****************************************************/
+
+static int dbm_CopyRange(int in, int out, dbm_offset offset, size_t nbytes, int *method){
+
+  char *buf;
+  size_t len;
+  long long ncopied;
+
+#ifdef DBM_HAVE_COPY_FILE_RANGE
+  while (*method == 0 && nbytes > 0){
+    loff_t off_in = offset, off_out = offset;
+    ncopied = copy_file_range(in,&off_in,out,&off_out,nbytes,0);
+    if (ncopied < 0){
+      if (errno == EINTR)
+	continue;
+      if (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP){
+	*method = 1;
+	break;
+      }
+      return 1;
+    }
+    if (ncopied == 0){
+      return 1;  /* file is shorter than it should be */
+    }
+    offset+= ncopied;
+    nbytes-= ncopied;
+  }
+#endif
+#ifdef DBM_HAVE_SENDFILE
+  if (*method <= 1 && nbytes > 0){
+    off_t off_in = offset;
+    *method = 1;
+    /* sendfile() writes at the current position of out */
+    if (lseek(out,offset,SEEK_SET) < 0){
+      return 1;
+    }
+    while (nbytes > 0){
+      ncopied = sendfile(out,in,&off_in,(nbytes > DBM_COPY_CHUNK) ? DBM_COPY_CHUNK : nbytes);
+      if (ncopied < 0){
+	if (errno == EINTR)
+	  continue;
+	if (errno == ENOSYS || errno == EINVAL){
+	  *method = 2;
+	  break;
+	}
+	return 1;
+      }
+      if (ncopied == 0){
+	return 1;
+      }
+      offset+= ncopied;
+      nbytes-= ncopied;
+    }
+  }
+#endif
+  if (nbytes == 0){
+    return 0;
+  }
+
+  *method = 2;
+  /* plain malloc, R's allocators may not be used off the main thread */
+  buf = malloc(DBM_MAX_READ_CHUNK);
+  if (buf == NULL){
+    return 1;
+  }
+  while (nbytes > 0){
+    len = (nbytes > DBM_MAX_READ_CHUNK) ? DBM_MAX_READ_CHUNK : nbytes;
+    if (dbm_pread(in,buf,len,offset) || dbm_pwrite(out,buf,len,offset)){
+      free(buf);
+      return 1;
+    }
+    offset+= len;
+    nbytes-= len;
+  }
+  free(buf);
+  return 0;
+}
+
+
+/* adds to the bytes copied and reports progress if on the calling thread. Returns true if the job has failed */
+
+static int dbm_CopyProgress(dbm_copy_job *job, double nbytes){
+
+  int failed;
+
+#ifdef DBM_HAVE_THREADS
+  if (job->threaded){
+    pthread_mutex_lock(&job->lock);
+    job->done+= nbytes;
+    failed = job->failed;
+    pthread_cond_signal(&job->changed);
+    pthread_mutex_unlock(&job->lock);
+    return failed;
+  }
+#endif
+  job->done+= nbytes;
+  if (job->progress != NULL && nbytes > 0){
+    job->progress(job->done,job->total,job->progress_arg);
+  }
+  failed = job->failed;
+  return failed;
+}
+
+
+/*****************************************************
+ **
+ ** static int dbm_CopyFile(dbm_copy_job *job, int which)
+ **
+ ** dbm_copy_job *job - the files being copied
+ ** int which - index into job->from and job->to
+ **
+ ** Copies one file and makes sure the copy is on disk and
+ ** the same size as the original.
+ **
+ ** Returns 0 if successful, 1 if problem
+ **
+ *****************************************************/
+
+static int dbm_CopyFile(dbm_copy_job *job, int which){
+
+  int in, out, method = 0, result = 0;
+  dbm_offset size, start, end;
+  size_t len;
+
+  in = open(job->from[which],O_RDONLY | O_BINARY);
+  if (in < 0){
+    return 1;
+  }
+  out = open(job->to[which],O_WRONLY | O_BINARY);
+  if (out < 0){
+    close(in);
+    return 1;
+  }
+
+#ifdef _WIN32
+  size = _lseeki64(in,0,SEEK_END);
+  result = (size < 0 || _chsize_s(out,(__int64)size) != 0);
+#else
+  size = lseek(in,0,SEEK_END);
+  /* sized first, so that the parts not copied read as zeros */
+  result = (size < 0 || ftruncate(out,size) != 0);
+#endif
+
+  start = 0;
+  while (!result && start < size){
+    end = size;
+#ifdef SEEK_DATA
+    /* skip over holes (columns never written), they count as copied */
+    {
+      dbm_offset data = lseek(in,start,SEEK_DATA);
+      if (data < 0 && errno == ENXIO){
+	data = size;
+      }
+      if (data >= 0){
+	if (data > start && dbm_CopyProgress(job,(double)(data - start))){
+	  result = 1;
+	}
+	start = data;
+	end = (start < size) ? lseek(in,start,SEEK_HOLE) : size;
+	if (end < start || end > size){
+	  end = size;
+	}
+      }
+    }
+    if (result || start >= size){
+      break;
+    }
+#endif
+    len = (end - start > DBM_COPY_CHUNK) ? DBM_COPY_CHUNK : (size_t)(end - start);
+    if (dbm_CopyRange(in,out,start,len,&method)){
+      result = 1;
+      break;
+    }
+    start+= len;
+    if (dbm_CopyProgress(job,(double)len)){
+      result = 1;
+    }
+  }
+
+  /* the original is removed once copied, so the copy must be safely on disk */
+#ifdef _WIN32
+  if (!result && (_commit(out) || _lseeki64(out,0,SEEK_END) != size)){
+    result = 1;
+  }
+#else
+  if (!result && (fsync(out) || lseek(out,0,SEEK_END) != size)){
+    result = 1;
+  }
+#endif
+  close(in);
+  if (close(out)){
+    result = 1;
+  }
+  return result;
+}
+
+
+#ifdef DBM_HAVE_THREADS
+
+static void *dbm_CopyWorker(void *arg){
+
+  dbm_copy_job *job = (dbm_copy_job *)arg;
+  int which;
+
+  pthread_mutex_lock(&job->lock);
+  while (!job->failed && job->next < job->n){
+    which = job->next++;
+    pthread_mutex_unlock(&job->lock);
+
+    if (dbm_CopyFile(job,which)){
+      pthread_mutex_lock(&job->lock);
+      job->failed = 1;
+    } else {
+      pthread_mutex_lock(&job->lock);
+    }
+  }
+  job->running--;
+  pthread_cond_signal(&job->changed);
+  pthread_mutex_unlock(&job->lock);
+
+  return NULL;
+}
+
+#endif
+
+
+/*****************************************************
+ **
+ ** static int dbm_CopyFiles(doubleBufferedMatrix Matrix, dbm_copy_job *job)
+ **
+ ** dbm_copy_job *job - the files to copy. from, to, n, total
+ **                     and progress should be set
+ **
+ ** Copies the files, using up to io_threads threads at once.
+ ** Progress is only ever reported from the calling thread.
+ ** Stops at the first failure, leaving whatever was copied.
+ **
+ ** Returns 0 if successful, 1 if problem
+ **
+ *****************************************************/
+
+static int dbm_CopyFiles(doubleBufferedMatrix Matrix, dbm_copy_job *job){
+
+  job->next = 0;
+  job->failed = 0;
+  job->done = 0.0;
+  if (job->progress != NULL){
+    job->progress(0.0,job->total,job->progress_arg);
+  }
+
+#ifdef DBM_HAVE_THREADS
+  job->threaded = 0;
+  if (Matrix->io_threads > 1){
+    int k, nthreads = (job->n < Matrix->io_threads) ? job->n : Matrix->io_threads;
+    pthread_t *threads = Calloc(nthreads,pthread_t);
+    double done, reported = 0.0;
+
+    job->threaded = 1;
+    job->running = 0;
+    pthread_mutex_init(&job->lock,NULL);
+    pthread_cond_init(&job->changed,NULL);
+
+    pthread_mutex_lock(&job->lock);
+    for (k=0; k < nthreads; k++){
+      if (pthread_create(&threads[k],NULL,dbm_CopyWorker,job)){
+	break;
+      }
+      job->running++;
+    }
+    nthreads = job->running;
+    while (job->running > 0){
+      pthread_cond_wait(&job->changed,&job->lock);
+      if (job->progress != NULL && job->done > reported){
+	done = job->done;
+	pthread_mutex_unlock(&job->lock);
+	job->progress(done,job->total,job->progress_arg);
+	reported = done;
+	pthread_mutex_lock(&job->lock);
+      }
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    for (k=0; k < nthreads; k++){
+      pthread_join(threads[k],NULL);
+    }
+    Free(threads);
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->changed);
+    job->threaded = 0;
+
+    if (nthreads > 0){
+      return job->failed;
+    }
+    /* no threads could be started, copy the files here instead */
+  }
+#endif
+
+  while (!job->failed && job->next < job->n){
+    if (dbm_CopyFile(job,job->next++)){
+      job->failed = 1;
+    }
+  }
+  return job->failed;
+}
+
+
+/* the directory in which storage file which is created */
+
+static const char *dbm_DirectoryOfFile(doubleBufferedMatrix Matrix, int which){
+
+  if (Matrix->ndirectories > 1){
+    return Matrix->directories[which % Matrix->ndirectories];
+  }
+  return Matrix->filedirectory;
+}
+
+
+/* forget any directories the files are striped over */
+
+static void dbm_FreeDirectories(doubleBufferedMatrix Matrix){
+
+  int k;
+
+  for (k=0; k < Matrix->ndirectories; k++){
+    Free(Matrix->directories[k]);
+  }
+  if (Matrix->directories != NULL){
+    Free(Matrix->directories);
+  }
+  Matrix->directories = NULL;
+  Matrix->ndirectories = 0;
+}
+
+
+/*****************************************************
+ **
+ ** static int dbm_NewFile(doubleBufferedMatrix Matrix)
+ **
+ ** Creates the next storage file, sized to hold cols_per_file
+ ** columns (all zero). If memory mapped it is also mapped.
+ **
+ ** Returns 0 if successful, 1 if problem (in which case
+ ** nothing is left behind)
+ **
+ *****************************************************/
+
+static int dbm_NewFile(doubleBufferedMatrix Matrix){
+
+  int nfiles = dbm_NumFiles(Matrix);
+  char *temp_name;
+  int result = 0;
+
+  dbm_ReserveFiles(Matrix,nfiles+1);
+
+  temp_name = (char *)R_tmpnam(Matrix->fileprefix,dbm_DirectoryOfFile(Matrix,nfiles));
+  Matrix->filenames[nfiles] = Calloc(strlen(temp_name)+1,char);
+  strcpy(Matrix->filenames[nfiles],temp_name);
+  /*   SHOULD NEVER HAVE BEEN HERE. CAUSED CRASHES ON WINDOWS Free(temp_name); */
+
+  Matrix->file_fd[nfiles] = -1;
+  Matrix->file_lru_prev[nfiles] = -1;
+  Matrix->file_lru_next[nfiles] = -1;
+
+  if (dbm_CreateFile(Matrix,nfiles) < 0){
+    Free(Matrix->filenames[nfiles]);
+    return 1;
+  }
+
+  if (Matrix->memory_mapped){
+    result = dbm_MapFile(Matrix,nfiles);
+  } else {
+    /* size the file up front. It reads as zeros so new columns need not be written (and
+       where the file system supports sparse files takes no space until they are) */
+#ifdef _WIN32
+    result = (_chsize_s(dbm_OpenFile(Matrix,nfiles),(__int64)Matrix->cols_per_file*Matrix->rows*dbm_ElementSize(Matrix)) != 0);
+#else
+    result = (ftruncate(dbm_OpenFile(Matrix,nfiles),(dbm_offset)Matrix->cols_per_file*Matrix->rows*dbm_ElementSize(Matrix)) != 0);
+#endif
+  }
+
+  if (result){
+    dbm_CloseFile(Matrix,nfiles);
+    remove(Matrix->filenames[nfiles]);
+    Free(Matrix->filenames[nfiles]);
+  }
+  return result;
+}
+
+
+/*****************************************************
+ **
+ ** int dbm_AddColumns(doubleBufferedMatrix Matrix, int n)
+ ** 
+ ** doubleBufferedMatrix Matrix
+ ** int n - number of columns to add
+ **
+ ** Adds n additional columns (of zeros) at the edge of 
+ ** the Matrix, creating additional temporary files as 
+ ** needed. Note also that the number of rows in the 
+ ** matrix should have already been set by previously 
+ ** calling dbm_setRows().
+ **
+ ** Nothing is written to the files and the new columns
+ ** only go into the column buffer if it has free slots,
+ ** so the cost is independent of the number of rows 
+ ** (except for the row buffer in row mode).
+ **
+ ** RETURNS 0 is successful and 1 if problem (some of
+ ** the columns may have been added)
+ **
+ *****************************************************/
+
+int dbm_AddColumns(doubleBufferedMatrix Matrix, int n){
+
+  int col, k;
+
+  if (n < 0){
+    return 1;
+  }
+
+  /* resync before the buffers are rearranged */
+  if (Matrix->rowcolclash){
+    dbm_ClearClash(Matrix);
+  }
+
+  dbm_ReserveColumns(Matrix,Matrix->cols + n);
+
+  for (k=0; k < n; k++){
+    col = Matrix->cols;
+
+    if (col % Matrix->cols_per_file == 0){
+      /* the last storage file is full (or there is not one yet) so start a new one */
+      if (dbm_NewFile(Matrix)){
+	return 1;
+      }
+    }
+
+    if (Matrix->col_ghost != NULL){
+      Matrix->col_ghost[col] = 0;
+    }
+    if (col < Matrix->max_cols){
+      /* the column buffer is not yet full so the new column goes in a free slot */
+      dbm_ReserveColSlots(Matrix,col+1);
+      Matrix->which_cols[col] = col;
+      Matrix->col_dirty[col] = 0;
+      Matrix->coldata[col] = dbm_NewColumnSlot(Matrix,col);  /* zero, as is the file */
+      Matrix->col_slot[col] = col;
+      dbm_ColumnLoaded(Matrix,col);
+    } else {
+      Matrix->col_slot[col] = -1;
+    }
+
+    if (!(Matrix->colmode)){
+      /* new column of the row buffer is zero as is the file, so nothing to flush */
+      Matrix->rowdata[col] = Calloc(Matrix->max_rows,double);
+      dbm_ClearRowDirty(Matrix,col);
+    }
+
+    Matrix->col_zero[col] = !Matrix->memory_mapped;
+    Matrix->cols++;
+  }
+
+  return dbm_BalanceBuffers(Matrix,!(Matrix->colmode));
+}
+
+
+/*****************************************************
+ **
+ ** int dbm_AddColumn(doubleBufferedMatrix Matrix)
+ ** 
+ ** doubleBufferedMatrix Matrix
+ **
+ ** Adds an additional column to the matrix at edge of 
+ ** Matrix. See dbm_AddColumns().
+ **
+ ** RETURNS 0 is successful and 1 if problem
+ **
+ *****************************************************/
+
+
+int dbm_AddColumn(doubleBufferedMatrix Matrix){
+
+  return dbm_AddColumns(Matrix,1);
+  
+}
+
+
+/*****************************************************
+ **
+ ** int dbm_AppendColumn(doubleBufferedMatrix Matrix, const double *values)
+ ** 
+ ** doubleBufferedMatrix Matrix
+ ** const double *values - the contents of the new column (rows long)
+ **
+ ** Adds a column to the matrix holding the supplied values.
+ ** They are written straight to the file, rather than going
+ ** through the column buffer, and copied into the buffers
+ ** where they hold the new column.
+ **
+ ** RETURNS 0 is successful and 1 if problem
+ **
+ *****************************************************/
+
+int dbm_AppendColumn(doubleBufferedMatrix Matrix, const double *values){
+
+  int col = Matrix->cols;
+  int curcol;
+
+  if (dbm_AddColumns(Matrix,1)){
+    return 1;
+  }
+
+  if (dbm_WriteColumnData(Matrix,col,0,Matrix->rows,values)){
+    return 1;
+  }
+
+  /* when memory mapped a column buffer slot is a view of the file, so already up to date */
+  if (!Matrix->memory_mapped && dbm_InColBuffer(Matrix,0,col,&curcol)){
+    memcpy(Matrix->coldata[curcol],values,(size_t)Matrix->rows*sizeof(double));
+    dbm_StorageValues(Matrix,Matrix->coldata[curcol],Matrix->rows);
+  }
+  if (!(Matrix->colmode)){
+    memcpy(Matrix->rowdata[col],&values[Matrix->first_rowdata],(size_t)Matrix->max_rows*sizeof(double));
+    dbm_StorageValues(Matrix,Matrix->rowdata[col],Matrix->max_rows);
+  }
+
+  return 0;
+}
+
+/* undoes a failed dbm_AdoptFiles, leaving the matrix with no columns and the files in place */
+
+static void dbm_ReleaseFiles(doubleBufferedMatrix Matrix){
+
+  int i;
+
+  dbm_UnmapAllFiles(Matrix);
+  dbm_CloseAllFiles(Matrix);
+  for (i=0; i < dbm_NumFiles(Matrix); i++){
+    Free(Matrix->filenames[i]);
+  }
+  Matrix->cols = 0;
+  dbm_ListClear(&(Matrix->col_list[0]));
+  dbm_ListClear(&(Matrix->col_list[1]));
+  dbm_ClearGhosts(Matrix);
+  Matrix->col_last_ref = -1;
+}
+
+
+/*****************************************************
+ **
+ ** int dbm_AdoptFiles(doubleBufferedMatrix Matrix, int cols, const char **filenames, int nfiles)
+ ** 
+ ** doubleBufferedMatrix Matrix
+ ** int cols - number of columns held in the files
+ ** const char **filenames - the storage files, in order
+ ** int nfiles - length of filenames, must be ceiling(cols/cols_per_file)
+ **
+ ** Makes the matrix use existing storage files (eg those of a
+ ** matrix that was made persistent) rather than creating new 
+ ** ones. The number of rows, columns per file, storage type, 
+ ** tiling and memory mapping must already be set to match the 
+ ** files and the matrix must have no columns and be in column 
+ ** mode. Nothing is copied, only the column buffer is filled.
+ **
+ ** The matrix is then persistent, so the files are not
+ ** deleted when it is freed.
+ **
+ ** RETURNS 0 is successful and 1 if problem (in which case
+ ** the matrix is left with no columns)
+ **
+ *****************************************************/
+
+int dbm_AdoptFiles(doubleBufferedMatrix Matrix, int cols, const char **filenames, int nfiles){
+
+  int i, col, fd, lastcol;
+  dbm_offset size = (dbm_offset)Matrix->cols_per_file*Matrix->rows*dbm_ElementSize(Matrix);
+
+  if (Matrix->cols > 0 || !(Matrix->colmode) || cols < 0 || nfiles != (cols + Matrix->cols_per_file - 1)/Matrix->cols_per_file){
+    return 1;
+  }
+
+  dbm_ReserveFiles(Matrix,nfiles);
+  for (i=0; i < nfiles; i++){
+    Matrix->filenames[i] = Calloc(strlen(filenames[i])+1,char);
+    strcpy(Matrix->filenames[i],filenames[i]);
+    Matrix->file_fd[i] = -1;
+    Matrix->file_lru_prev[i] = -1;
+    Matrix->file_lru_next[i] = -1;
+    if (Matrix->memory_mapped){
+      Matrix->file_map[i] = NULL;
+    }
+  }
+  Matrix->cols = cols;
+
+  /* each file must exist and be large enough to hold all its columns */
+  for (i=0; i < nfiles; i++){
+    fd = dbm_OpenFile(Matrix,i);
+#ifdef _WIN32
+    if (fd < 0 || _lseeki64(fd,0,SEEK_END) < size){
+#else
+    if (fd < 0 || lseek(fd,0,SEEK_END) < size){
+#endif
+      break;
+    }
+    if (Matrix->memory_mapped && dbm_MapFile(Matrix,i)){
+      break;
+    }
+  }
+
+  if (i < nfiles){
+    dbm_ReleaseFiles(Matrix);
+    return 1;
+  }
+
+  dbm_ReserveColumns(Matrix,cols);
+  for (col=0; col < cols; col++){
+    Matrix->col_zero[col] = 0;
+    Matrix->col_slot[col] = -1;
+    if (Matrix->col_ghost != NULL){
+      Matrix->col_ghost[col] = 0;
+    }
+  }
+
+  /* the column buffer starts out holding the first columns */
+  lastcol = (cols < Matrix->max_cols) ? cols : Matrix->max_cols;
+  dbm_ReserveColSlots(Matrix,lastcol);
+  for (col=0; col < lastcol; col++){
+    Matrix->which_cols[col] = col;
+    Matrix->col_slot[col] = col;
+    Matrix->col_dirty[col] = 0;
+    Matrix->coldata[col] = dbm_NewColumnSlot(Matrix,col);
+    dbm_ColumnLoaded(Matrix,col);
+  }
+
+  if (!Matrix->memory_mapped && dbm_ReadAdjacentColumns(Matrix,0,lastcol,Matrix->coldata)){
+    for (col=0; col < lastcol; col++){
+      dbm_ReleaseColumnSlot(Matrix,Matrix->coldata[col]);
+    }
+    dbm_ReleaseFiles(Matrix);
+    return 1;
+  }
+
+  Matrix->persistent = 1;
+  return dbm_BalanceBuffers(Matrix,0);
+}
+
+/*****************************************************
+ **
+ ** int dbm_ExportColumns(doubleBufferedMatrix Matrix, const char *filename, int type)
+ ** 
+ ** doubleBufferedMatrix Matrix
+ ** const char *filename - file to write (replaced if it exists)
+ ** int type - how to store the values, one of the DBM_STORAGE_ types
+ **
+ ** Writes the whole matrix to a single raw file, column after
+ ** column with no header, in native byte order. Such a file may
+ ** be used directly by dbm_AdoptFiles with cols_per_file equal 
+ ** to the number of columns. Several columns are read and
+ ** written at a time (about DBM_MAX_READ_CHUNK bytes worth) so
+ ** the file is written with large sequential writes. 
+ **
+ ** Any modified values in the buffers are flushed first.
+ **
+ ** RETURNS 0 is successful and 1 if problem (in which case
+ ** the file is removed)
+ **
+ *****************************************************/
+
+int dbm_ExportColumns(doubleBufferedMatrix Matrix, const char *filename, int type){
+
+  int fd, col, n, k, chunk_cols;
+  size_t size = dbm_TypeSize(type);
+  dbm_offset offset = 0;
+  double *values, **dest;
+  void *converted;
+  int result = 0;
+
+  if (type < DBM_STORAGE_DOUBLE || type > DBM_STORAGE_LOGICAL){
+    return 1;
+  }
+  if (dbm_Flush(Matrix)){
+    return 1;
+  }
+
+  fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+  if (fd < 0){
+    return 1;
+  }
+  if (Matrix->rows == 0 || Matrix->cols == 0){
+    close(fd);
+    return 0;
+  }
+
+  chunk_cols = DBM_MAX_READ_CHUNK/(Matrix->rows*sizeof(double));
+  if (chunk_cols < Matrix->ndirectories){
+    chunk_cols = Matrix->ndirectories;  /* enough to read from every directory at once */
+  }
+  if (chunk_cols < 1){
+    chunk_cols = 1;
+  }
+  if (chunk_cols > Matrix->cols){
+    chunk_cols = Matrix->cols;
+  }
+
+  values = Calloc((size_t)chunk_cols*Matrix->rows,double);
+  dest = Calloc(chunk_cols,double *);
+  for (k=0; k < chunk_cols; k++){
+    dest[k] = &values[(size_t)k*Matrix->rows];
+  }
+  converted = (type == DBM_STORAGE_DOUBLE) ? (void *)values : (void *)Calloc((size_t)chunk_cols*Matrix->rows*size,char);
+
+  for (col=0; col < Matrix->cols && !result; col+=n){
+    n = (Matrix->cols - col < chunk_cols) ? Matrix->cols - col : chunk_cols;
+    if (dbm_ReadAdjacentColumns(Matrix,col,n,dest)){
+      result = 1;
+      break;
+    }
+    if (type != DBM_STORAGE_DOUBLE){
+      dbm_ConvertToType(type,values,converted,n*Matrix->rows);
+    }
+    if (dbm_pwrite(fd,converted,(size_t)n*Matrix->rows*size,offset)){
+      result = 1;
+    }
+    offset+= (dbm_offset)n*Matrix->rows*size;
+  }
+
+  if (type != DBM_STORAGE_DOUBLE){
+    Free(converted);
+  }
+  Free(values);
+  Free(dest);
+  if (close(fd)){
+    result = 1;
+  }
+  if (result){
+    remove(filename);
+  }
+  return result;
+}
+
+
+/*****************************************************
+ **
+ ** static int dbm_SetColBufferSize(doubleBufferedMatrix Matrix, int new_maxcol)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int new_maxcol - the number of columns that should be stored in the column buffer
+ **                  upon exit from this routine.
+ **
+ ** This function deals with the mechanics of loading new data in or emptying
+ ** data out of the the column buffer depending on whether the size of the
+ ** column buffer is to be increased or decreased.
+ ** 
+ **
+ *****************************************************/
+
+static int dbm_SetColBufferSize(doubleBufferedMatrix Matrix, int new_maxcol){
+
+
+  int i,j;
+  int lastcol;
+  int n_cols_remove=0;
+  int n_cols_add=0; 
+  double **tmpptr2;
+  int *tmpptr3;
+  int *tmpptr4;
+  int *tmpptr5;
+  int *tmpptr6;
+  char *tmpptr7;
+  dbm_list oldlist[2];
+
+  int *whichadd;
+
+  int curcol;
+  int min_j;
+  int k;
+
+
+    /* Fix up any potential clashes */
+  if (Matrix->rowcolclash){
+    dbm_ClearClash(Matrix);
+  }
+  // First figure out if need to mak any changes
+
+  if (new_maxcol <= 0){
+    return 1;  /** Big big error **/
+  }
+
+  if (Matrix->cols < Matrix->max_cols){
+    lastcol = Matrix->cols;
+  } else {
+    lastcol = Matrix->max_cols;
+  }
+  
+
+  if (Matrix->max_cols == new_maxcol){
+    // No need to do anything.
+    return 0;
+  }
+
+  /* what ARC remembers about evicted columns applies to the old size */
+  dbm_ClearGhosts(Matrix);
+  if (Matrix->arc_target > new_maxcol){
+    Matrix->arc_target = new_maxcol;
+  }
+
+  if (Matrix->max_cols > new_maxcol){
+    // Remove columns from the column buffer
+    // Will remove max_col - new_maxcol oldest columns
+    if (new_maxcol < Matrix->cols){
+      if (Matrix->max_cols < Matrix->cols){
+	n_cols_remove = Matrix->max_cols - new_maxcol;
+      } else{
+	n_cols_remove = Matrix->cols - new_maxcol;
+      }
+
+
+      /* the columns the eviction policy would replace next leave the buffer */
+      for (i=0; i < n_cols_remove; i++){
+	Matrix->max_cols = lastcol - i;   /* so the buffer is full, see dbm_VictimSlot */
+	dbm_EvictOldestColumn(Matrix);
+	curcol = dbm_VictimSlot(Matrix);
+	Matrix->col_slot[Matrix->which_cols[curcol]] = -1;
+	dbm_ReleaseColumnSlot(Matrix,Matrix->coldata[curcol]);
+	dbm_ColListRemove(Matrix,curcol);
+      }
+      Matrix->col_last_ref = -1;
+      
+      /* the rest are packed into the first new_maxcol slots, keeping their lists and order */
+      tmpptr2 = Matrix->coldata;
+      tmpptr3 = Matrix->which_cols;
+      tmpptr4 = Matrix->col_dirty;
+      tmpptr5 = Matrix->col_list_prev;
+      tmpptr6 = Matrix->col_list_next;
+      tmpptr7 = Matrix->col_ref;
+      oldlist[0] = Matrix->col_list[0];
+      oldlist[1] = Matrix->col_list[1];
+      
+      Matrix->coldata = Calloc(new_maxcol,double *);
+      Matrix->which_cols = Calloc(new_maxcol,int);
+      Matrix->col_dirty = Calloc(new_maxcol,int);
+      Matrix->col_list_prev = Calloc(new_maxcol,int);
+      Matrix->col_list_next = Calloc(new_maxcol,int);
+      Matrix->col_ref = Calloc(new_maxcol,char);
+      dbm_ListClear(&(Matrix->col_list[0]));
+      dbm_ListClear(&(Matrix->col_list[1]));
+      
+      j = 0;
+      for (k=0; k < 2; k++){
+	for (curcol = oldlist[k].tail; curcol >= 0; curcol = tmpptr5[curcol]){
+	  Matrix->coldata[j] = tmpptr2[curcol];
+	  Matrix->which_cols[j] = tmpptr3[curcol];
+	  Matrix->col_dirty[j] = tmpptr4[curcol];
+	  Matrix->col_ref[j] = tmpptr7[curcol];
+	  Matrix->col_slot[Matrix->which_cols[j]] = j;
+	  dbm_ListPushFront(&(Matrix->col_list[k]),Matrix->col_list_prev,Matrix->col_list_next,j);
+	  j++;
+	}
+      }
+      Free(tmpptr2);
+      Free(tmpptr3);
+      Free(tmpptr4);
+      Free(tmpptr5);
+      Free(tmpptr6);
+      Free(tmpptr7);
+    }
+    Matrix->max_cols = new_maxcol;
+
+  } else {
+    // Need to add columns to the column buffer
+    
+    if (new_maxcol < Matrix->cols){
+      n_cols_add = new_maxcol - Matrix->max_cols;
+    } else if (Matrix->max_cols < Matrix->cols){
+      n_cols_add = Matrix->cols - Matrix->max_cols;
+    } else {
+      // there are no more columns to add, everything is already in the buffer
+      n_cols_add = 0;
+      Matrix->max_cols = new_maxcol;
+      return 0;
+    }
+    
+    // Figure out which columns to add
+    // rule will be to add columns in numerical order (ie column 0 if not it, then 1 if not in and so on)
+    
+    whichadd = Calloc(n_cols_add,int);
+    
+    min_j=0;
+    for (i=0; i < n_cols_add; i++){
+      for (j=min_j; j < Matrix->cols; j++){ /************************** *****/
+	//	printf("j is %d %d ",j, min_j);
+	if(!dbm_InColBuffer(Matrix,0,j,&curcol)){
+	  whichadd[i] = j;
+	  //printf("Adding %d\n",j);
+	  break;
+	}
+      }
+      min_j = j+1;
+    }
+    
+    // In row mode the row buffer may hold newer values than the files for the 
+    // columns about to be read in. So get them out to the files first
+    if (!(Matrix->colmode) && !(Matrix->readonly)){
+      dbm_FlushRowBuffer(Matrix);
+    }
+
+    // Add columns to end of buffer
+    tmpptr2 = Matrix->coldata;
+    tmpptr3 = Matrix->which_cols;
+    tmpptr4 = Matrix->col_dirty;
+    
+    Matrix->coldata = Calloc(Matrix->max_cols+ n_cols_add, double *);
+    Matrix->which_cols = Calloc(Matrix->max_cols+ n_cols_add,int);  
+    Matrix->col_dirty = Calloc(Matrix->max_cols+ n_cols_add,int);  
+    Matrix->col_list_prev = Realloc(Matrix->col_list_prev,Matrix->max_cols+ n_cols_add,int);
+    Matrix->col_list_next = Realloc(Matrix->col_list_next,Matrix->max_cols+ n_cols_add,int);
+    Matrix->col_ref = Realloc(Matrix->col_ref,Matrix->max_cols+ n_cols_add,char);
+    for (j=0; j < Matrix->max_cols; j++){
+      Matrix->coldata[j] = tmpptr2[j];
+      Matrix->which_cols[j] = tmpptr3[j];
+      Matrix->col_dirty[j] = tmpptr4[j];
+    }
+    
+    /* runs of adjacent columns are read together */
+    i = 0;
+    while (i < n_cols_add){
+      int nrun = 1;
+      while (i + nrun < n_cols_add && whichadd[i + nrun] == whichadd[i] + nrun){
+	nrun++;
+      }
+      if (nrun == 1 || Matrix->cols_per_file == 1 || Matrix->memory_mapped){
+	for (j=0; j < nrun; j++){
+	  dbm_LoadAdditionalColumn(Matrix,whichadd[i+j], Matrix->max_cols + i + j);
+	}
+      } else {
+	for (j=0; j < nrun; j++){
+	  Matrix->coldata[Matrix->max_cols + i + j] = Calloc(Matrix->rows,double);
+	  Matrix->which_cols[Matrix->max_cols + i + j] = whichadd[i] + j;
+	  Matrix->col_slot[whichadd[i] + j] = Matrix->max_cols + i + j;
+	  Matrix->col_dirty[Matrix->max_cols + i + j] = 0;
+	  dbm_ColumnLoaded(Matrix,Matrix->max_cols + i + j);
+	}
+	dbm_ReadAdjacentColumns(Matrix,whichadd[i],nrun,&(Matrix->coldata[Matrix->max_cols + i]));
+      }
+      i+=nrun;
+    }
+    Free(tmpptr2);
+    Free(tmpptr3);
+    Free(tmpptr4);
+    Free(whichadd);
+
+    Matrix->max_cols = new_maxcol;
+  }
+
+  return 0;
+
+}
+
+/*****************************************************
+ **
+ ** static int dbm_SetRowBufferSize(doubleBufferedMatrix Matrix, int new_maxrow)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int new_maxrow - the number of rows that should be stored in the row buffer
+ **                  upon exit from this routine (or at least the number possible
+ **                  if thw row buffer was active, if in column mode)
+ **
+ **
+ ** Returns 0 if successful, 1 if problem.
+ **
+ *****************************************************/
+
+
+
+static int dbm_SetRowBufferSize(doubleBufferedMatrix Matrix, int new_maxrow){
+
+
+  int i, j;
+  /* 
+     int n_rows_remove=0;
+     int n_rows_add=0;
+  */
+  double *tmpptr;
+  int new_first_rowdata;
+
+  if (new_maxrow <= 0){
+    return 1;  /** big error **/
+
+
+  }
+
+  if (new_maxrow > Matrix->rows){
+    new_maxrow = Matrix->rows;
+  }
+
+  if (Matrix->colmode){
+    Matrix->max_rows =new_maxrow;
+    return 0;
+  }
+
+
+  /* Fix up any potential clashes */
+  if (Matrix->rowcolclash){
+    dbm_ClearClash(Matrix);
+  }
+
+  if (Matrix->max_rows == new_maxrow){
+    // No need to do anything.
+    return 0;
+  } else if (Matrix->max_rows > new_maxrow){
+    // Remove rows from the rows buffer
+    // Empty out row buffer (at least resync with files)
+    dbm_FlushRowBuffer(Matrix);
+    
+    for (j =0; j < Matrix->cols; j++){
+      // printf("fixing col %d in row buffer\n",j);
+      tmpptr = Matrix->rowdata[j];
+      Matrix->rowdata[j] = Calloc(new_maxrow,double);
+      for (i=0; i < new_maxrow; i++){
+	 Matrix->rowdata[j][i] = tmpptr[i];
+      }
+      Free(tmpptr);
+    }
+    Matrix->max_rows = new_maxrow;
+  } else {
+    // Increase number of rows in row buffer
+    
+    // Empty out row buffer (at least resync with files)
+    dbm_FlushRowBuffer(Matrix);
+
+    // Allocate Spaceint new_maxcol
+    
+    for (j =0; j < Matrix->cols; j++){ 
+      tmpptr = Matrix->rowdata[j];
+      Matrix->rowdata[j] = Calloc(new_maxrow,double);
+      Free(tmpptr);
+    }
+      
+
+    // Now see if we will be hitting the bottom of the matrix with the added rows
+    
+    if (Matrix->first_rowdata + new_maxrow > Matrix->rows){
+      new_first_rowdata = Matrix->rows - new_maxrow;
+    } else {
+      new_first_rowdata = Matrix->rows;
+    }
+    Matrix->max_rows = new_maxrow;
+    dbm_LoadRowBuffer(Matrix,new_first_rowdata);
+    
+  }
+
+  return 0;
+}
+
+
+
+/*****************************************************
+ **
+ ** int dbm_ResizeBuffer(doubleBufferedMatrix Matrix, int new_maxrow,int new_maxcol)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int new_maxrow - the number of rows that should be stored in the row buffer
+ ** int new_maxrow - the number of rows that should be stored in the row buffer
+ **                  upon exit from this routine (or at least the number possible
+ **                  if thw row buffer was active, if in column mode)
+ **
+ **
+ **
+ **
+ *****************************************************/
+
+int dbm_ResizeBuffer(doubleBufferedMatrix Matrix, int new_maxrow, int new_maxcol){
+
+  Matrix->buffer_bytes = 0;   /* explicit sizes replace any memory budget */
+  dbm_setSharedBuffer(Matrix,0);
+  dbm_SetColBufferSize(Matrix,new_maxcol);
+  if (!(Matrix->colmode)){
+    dbm_SetRowBufferSize(Matrix,new_maxrow);
+  } else {
+    /* No actual row buffer active. So just increase potential size.
+       with caveats: Can't: Be smaller than 1 or be bigger than number of rows
+       if those cases exist go to nearest possible value. ie 1 or max
+
+    */
+    if (new_maxrow < 1){
+      Matrix->max_rows = 1;
+    } else if (new_maxrow > Matrix->rows){
+      Matrix->max_rows = Matrix->rows;
+    } else {
+      Matrix->max_rows = new_maxrow;
+    } 
+  }
+  return 0;
+}
+
+
+/*****************************************************
+ **
+ ** int dbm_ResizeColBuffer(doubleBufferedMatrix Matrix, int new_maxcol)
+ **
+ ** int dbm_ResizeRowBuffer(doubleBufferedMatrix Matrix, int new_maxrow)
+ **
+ ** Change the size of the column buffer or the row buffer 
+ ** (see dbm_SetColBufferSize and dbm_SetRowBufferSize). Any
+ ** memory budget (dbm_setBufferBytes) no longer applies. A 
+ ** matrix using the shared buffer pool stops doing so when its
+ ** column buffer is resized.
+ **
+ ** Returns 0 if successful, 1 if problem.
+ **
+ *****************************************************/
+
+int dbm_ResizeColBuffer(doubleBufferedMatrix Matrix, int new_maxcol){
+
+  Matrix->buffer_bytes = 0;
+  dbm_setSharedBuffer(Matrix,0);
+  return dbm_SetColBufferSize(Matrix,new_maxcol);
+}
+
+
+int dbm_ResizeRowBuffer(doubleBufferedMatrix Matrix, int new_maxrow){
+
+  Matrix->buffer_bytes = 0;
+  return dbm_SetRowBufferSize(Matrix,new_maxrow);
+}
+
+
+/*****************************************************
+ **
+ ** static int dbm_BalanceBuffers(doubleBufferedMatrix Matrix, int rowmode)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int rowmode - true if the sizes are for row mode 
+ **
+ ** When there is a memory budget (dbm_setBufferBytes) sets
+ ** the sizes of the buffers to fit within it. Called 
+ ** whenever the dimensions, the mode or the number of spare
+ ** column buffers change.
+ **
+ ** The spare buffers for reading ahead and write-behind are 
+ ** taken out of the budget first. In row mode the row buffer 
+ ** then gets up to half of what is left (but no more rows 
+ ** than the matrix has) and the column buffer gets the rest.
+ ** The column buffer of a memory mapped matrix counts as if 
+ ** it held copies of the columns (the mapped pages it refers
+ ** to are in memory). Each buffer is at least one column or 
+ ** row, even if that does not fit.
+ **
+ ** The column buffers of matrices using the shared buffer
+ ** pool are instead brought back within the pool's budget
+ ** (see dbm_SharedTrim).
+ **
+ ** Returns 0 if successful, 1 if problem.
+ **
+ *****************************************************/
+
+static int dbm_BalanceBuffers(doubleBufferedMatrix Matrix, int rowmode){
+
+  double column_bytes, row_bytes, available;
+  double new_maxrow, new_maxcol;
+
+  if (Matrix->shared){
+    dbm_SharedTrim(NULL,0);
+    return 0;
+  }
+  if (Matrix->buffer_bytes <= 0 || Matrix->rows == 0){
+    return 0;
+  }
+
+  column_bytes = (double)Matrix->rows*sizeof(double);
+  available = Matrix->buffer_bytes - (double)(Matrix->prefetch_depth + Matrix->writebehind_depth)*column_bytes;
+
+  new_maxrow = Matrix->max_rows;
+  if (rowmode && Matrix->cols > 0){
+    row_bytes = (double)Matrix->cols*sizeof(double);
+    new_maxrow = floor(available/2.0/row_bytes);
+    if (new_maxrow > Matrix->rows){
+      new_maxrow = Matrix->rows;
+    }
+    if (new_maxrow < 1){
+      new_maxrow = 1;
+    }
+    available-= new_maxrow*row_bytes;
+  }
+
+  new_maxcol = floor(available/column_bytes);
+  if (new_maxcol < 1){
+    new_maxcol = 1;
+  }
+  if (new_maxcol > DBM_MAX_BUFFER_COLS){
+    new_maxcol = DBM_MAX_BUFFER_COLS;
+  }
+
+  /* shrink one buffer before the other grows */
+  if ((int)new_maxcol < Matrix->max_cols){
+    if (dbm_SetColBufferSize(Matrix,(int)new_maxcol)){
+      return 1;
+    }
+    return dbm_SetRowBufferSize(Matrix,(int)new_maxrow);
+  }
+  if (dbm_SetRowBufferSize(Matrix,(int)new_maxrow)){
+    return 1;
+  }
+  return dbm_SetColBufferSize(Matrix,(int)new_maxcol);
+}
+
+
+/*****************************************************
+ *****************************************************
+ **
+ ** The shared buffer pool
+ **
+ ** Matrices using the pool (dbm_setSharedBuffer) have no
+ ** fixed size for their column buffer. Instead, on a miss,
+ ** the column buffer borrows another slot if the memory in
+ ** use by all of them stays within the pool's budget 
+ ** (dbm_setSharedBufferBytes), taking slots away from the 
+ ** least recently active matrices if need be. Only when that
+ ** is not possible does it replace one of its own columns.
+ ** So whichever matrix is being worked on gets most of the 
+ ** memory, and the least recently used columns (by matrix)
+ ** leave first.
+ **
+ ** A matrix's share of the pool is counted as in 
+ ** dbm_BalanceBuffers: its column buffer, its row buffer and 
+ ** its spare buffers for reading ahead and write-behind.
+ ** Only the column buffers are resized.
+ **
+ ** R is single threaded, and the background threads of
+ ** each matrix never look at the pool, so there is no
+ ** locking.
+ **
+ *****************************************************
+ *****************************************************/
+
+static double dbm_shared_bytes = 0;    /* budget of the pool, 0 if there is none */
+static doubleBufferedMatrix dbm_shared_head = NULL;  /* matrices using the pool, most recently active first */
+static doubleBufferedMatrix dbm_shared_tail = NULL;
+
+
+static void dbm_SharedUnlink(doubleBufferedMatrix Matrix){
+
+  if (Matrix->shared_prev != NULL){
+    Matrix->shared_prev->shared_next = Matrix->shared_next;
+  } else {
+    dbm_shared_head = Matrix->shared_next;
+  }
+  if (Matrix->shared_next != NULL){
+    Matrix->shared_next->shared_prev = Matrix->shared_prev;
+  } else {
+    dbm_shared_tail = Matrix->shared_prev;
+  }
+  Matrix->shared_prev = NULL;
+  Matrix->shared_next = NULL;
+}
+
+
+static void dbm_SharedPushFront(doubleBufferedMatrix Matrix){
+
+  Matrix->shared_prev = NULL;
+  Matrix->shared_next = dbm_shared_head;
+  if (dbm_shared_head != NULL){
+    dbm_shared_head->shared_prev = Matrix;
+  } else {
+    dbm_shared_tail = Matrix;
+  }
+  dbm_shared_head = Matrix;
+}
+
+
+/* the matrix has just been used, so it moves to the head of the pool's list */
+
+static void dbm_SharedActive(doubleBufferedMatrix Matrix){
+
+  if (!Matrix->shared || dbm_shared_head == Matrix){
+    return;
+  }
+  dbm_SharedUnlink(Matrix);
+  dbm_SharedPushFront(Matrix);
+}
+
+
+/* memory the buffers of a matrix count for in the pool */
+
+static double dbm_SharedBytes(doubleBufferedMatrix Matrix){
+
+  double nslots = (Matrix->cols < Matrix->max_cols) ? Matrix->cols : Matrix->max_cols;
+  double bytes;
+
+  bytes = (nslots + Matrix->prefetch_depth + Matrix->writebehind_depth)*Matrix->rows*sizeof(double);
+  if (!Matrix->colmode){
+    bytes+= (double)Matrix->cols*Matrix->max_rows*sizeof(double);
+  }
+  return bytes;
+}
+
+
+/*****************************************************
+ **
+ ** static int dbm_SharedTrim(doubleBufferedMatrix except, double needed)
+ **
+ ** doubleBufferedMatrix except - a matrix not to take slots
+ **                               from, NULL for none
+ ** double needed - bytes that should be left free
+ **
+ ** Takes slots from the column buffers of the matrices using
+ ** the pool, least recently active first (but leaving each
+ ** at least one), until the pool has needed bytes free.
+ **
+ ** Returns 0 if there is now room, 1 if not.
+ **
+ *****************************************************/
+
+static int dbm_SharedTrim(doubleBufferedMatrix except, double needed){
+
+  doubleBufferedMatrix lender;
+  double excess, column_bytes;
+  int nslots, k;
+
+  excess = dbm_getSharedBufferInUse() + needed - dbm_shared_bytes;
+
+  for (lender = dbm_shared_tail; lender != NULL && excess > 0; lender = lender->shared_prev){
+    nslots = (lender->cols < lender->max_cols) ? lender->cols : lender->max_cols;
+    if (lender == except || nslots <= 1){
+      continue;
+    }
+    column_bytes = (double)lender->rows*sizeof(double);
+    k = (int)ceil(excess/column_bytes);
+    if (k > nslots - 1){
+      k = nslots - 1;
+    }
+    if (dbm_SetColBufferSize(lender,nslots - k)){
+      return 1;
+    }
+    excess-= k*column_bytes;
+  }
+
+  return (excess > 0);
+}
+
+
+/*****************************************************
+ **
+ ** static void dbm_SharedBorrow(doubleBufferedMatrix Matrix)
+ **
+ ** Called on a miss in the column buffer, before any column
+ ** is chosen to be replaced. If Matrix uses the pool and the 
+ ** pool has (or can be given) room for another column of 
+ ** Matrix, its column buffer grows by a (free) slot, which
+ ** the column about to be loaded then uses.
+ **
+ *****************************************************/
+
+static void dbm_SharedBorrow(doubleBufferedMatrix Matrix){
+
+  if (!Matrix->shared || dbm_shared_bytes <= 0 || Matrix->max_cols >= Matrix->cols){
+    return;
+  }
+  dbm_SharedActive(Matrix);
+  if (!dbm_SharedTrim(Matrix,(double)Matrix->rows*sizeof(double))){
+    Matrix->max_cols++;
+  }
+}
+
+
+/******************************************************
+ **
+ ** void dbm_RowMode(doubleBufferedMatrix Matrix)
+ **
+ ** Switch to Row Mode 
+ **
+ ******************************************************/
+
+
+
+void dbm_RowMode(doubleBufferedMatrix Matrix){
+  int j;
+
+  /**            When switching from column mode to row mode
+   **             - allocate space for row buffer
+   **             - load data in from files, when data is not 
+   **               currently in column buffer
+   **             - copy across relevant data that is in column buffer
+   **             - set colmode flag to false
+   */
+  if (Matrix->colmode == 1){
+    /* make room for the row buffer first when there is a memory budget */
+    dbm_BalanceBuffers(Matrix,1);
+    Matrix->rowdata = Calloc(Matrix->col_capacity +1,double *);
+    Matrix->row_dirty_first = Calloc(Matrix->col_capacity +1,int);
+    Matrix->row_dirty_last = Calloc(Matrix->col_capacity +1,int);
+    for (j =0; j < Matrix->cols; j++){
+      Matrix->rowdata[j] = Calloc(Matrix->max_rows,double);
+    }
+    dbm_LoadRowBuffer(Matrix,0); /* this both fills the row buffer and copys across anything in the current column buffer */
+    Matrix->colmode =0;
+  }
+  
+}
+
+
+/******************************************************
+ **
+ ** void dbm_ColMode(doubleBufferedMatrix Matrix)
+ **
+ ** Switch to column Mode (ie turns off row mode)
+ **
+ ******************************************************/
+
+void dbm_ColMode(doubleBufferedMatrix Matrix){
+
+  int j;
+  /* **            When switching from row mode to column mode
+  **            - clear clashes
+  **            - flush row buffer (ie write to files)
+  **            - deallocate row buffer
+  **            - set colmode flag to true
+  ** */
+  if (Matrix->colmode == 0){
+    if (Matrix->rowcolclash){
+      dbm_ClearClash(Matrix);
+    }
+    dbm_FlushRowBuffer(Matrix);
+    
+    for (j =0; j < Matrix->cols; j++){
+      Free(Matrix->rowdata[j]);
+    }
+    Free(Matrix->rowdata);
+    Free(Matrix->row_dirty_first);
+    Free(Matrix->row_dirty_last);
+    Matrix->colmode = 1;
+    dbm_BalanceBuffers(Matrix,0);
+  }
+
+}
+
+/******************************************************
+ **
+ ** void dbm_SetPrefix(doubleBufferedMatrix Matrix,const char *prefix)
+ **
+ ** Sets initial part of the filename of temporary files
+ ** used for storing matrix.
+ **
+ ******************************************************/
+
+
+
+void dbm_SetPrefix(doubleBufferedMatrix Matrix,const char *prefix){
+
+  char *tmp;
+
+  tmp = Calloc(strlen(prefix)+1,char);
+  strcpy(tmp,prefix);
+  
+  if (Matrix->fileprefix != NULL){
+    Free(Matrix->fileprefix);
+  }
+  Matrix->fileprefix = tmp;
+
+}
+
+
+/******************************************************
+ **
+ ** void dbm_ReadOnlyMode(doubleBufferedMatrix Matrix, int setting)
+ **
+ ** 
+ **
+ ** Set ReadOnlyMode on or off.
+ **
+ ******************************************************/
+
+void dbm_ReadOnlyMode(doubleBufferedMatrix Matrix, int setting){
+
+
+  /* 
+     If readonly mode is true we don't need to do anything
+     extra except set the flag.
+
+     If however readonly is false and we are changing to
+     true then we will need to flush the current
+     buffers to ensure coherency.
+
+  */
+
+
+  if (!(Matrix->readonly) & setting){
+    if (!(Matrix->colmode)){
+      if (Matrix->rowcolclash){
+	dbm_ClearClash(Matrix);
+      }
+      dbm_FlushRowBuffer(Matrix);
+    }
+    dbm_FlushAllColumns(Matrix);
+    dbm_WriteBehindSync(Matrix,-1);  /* nothing is written once read only */
+  } 
+
+
+
+  Matrix->readonly = setting;
+
+}
+
+/******************************************************
+ **
+ ** int dbm_isReadOnlyMode(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** returns 1 if read only mode is activated otherwise returns 0
+ **
+ ******************************************************/
+
+
+int dbm_isReadOnlyMode(doubleBufferedMatrix Matrix){
+
+  return (Matrix->readonly);
+}
+
+
+/******************************************************
+ **
+ ** int dbm_isRowMode(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** returns 1 if row buffer is activated otherwise returns 0
+ **
+ ******************************************************/
+
+
+int dbm_isRowMode(doubleBufferedMatrix Matrix){
+
+  return (!(Matrix->colmode));
+}
+
+
+/******************************************************
+ **
+ ** int dbm_getValue(doubleBufferedMatrix Matrix, int row, int col, double *value)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int row, col - location in matrix
+ ** double *value - location to store value found in matrix
+ **
+ ** Returns 1 if get was successful. Otherwise returns 0 and *value is unchanged.
+ **
+ **
+ ******************************************************/
+
+int dbm_getValue(doubleBufferedMatrix Matrix, int row, int col, double *value){
+
+  double *tmp;
+
+  if ((row >= Matrix->rows) || (col >= Matrix->cols) || (row < 0) || (col < 0)){
+    return 0;
+  }
+
+
+  tmp = dbm_internalgetValue(Matrix,row,col);
+  
+  *value = *tmp;
+  
+  if (!Matrix->colmode && Matrix->readonly){
+    Matrix->rowcolclash = 0;  /* If readonly. No need to worry about clashes */
+  }
+
+
+  return 1;
+}
+
+
+/******************************************************
+ **
+ ** int dbm_setValue(doubleBufferedMatrix Matrix, int row, int col, double value)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int row, col - location in matrix
+ ** double value - value to store in matrix
+ **
+ **
+ ******************************************************/
+
+int dbm_setValue(doubleBufferedMatrix Matrix, int row, int col, double value){
+  double *tmp;
+  
+  if (Matrix->readonly){
+    return 0; /*Not successful */
+
+  } else {
+    if ((row >= Matrix->rows) || (col >= Matrix->cols) || (row < 0) || (col < 0)){
+      return 0;
+    }
+    
+    tmp = dbm_internalsetValue(Matrix,row,col);
+    *tmp = dbm_StorageValue(Matrix,value);
+    return 1; /*Successful */
+  }
+
+}
+
+/******************************************************
+ **
+ ** int dbm_getValueSI(doubleBufferedMatrix Matrix, int index, double *value)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int index - location in matrix
+ ** double *value - location to store value found in matrix
+ **
+ ** Uses single indexing rather than dual indexing to locate a
+ ** value in the matrix. copys this value into location of supplied
+ ** variable.
+ **
+ ** Returns 1 if get was successful. Otherwise returns 0 and *value is unchanged.
+ **
+ ******************************************************/
+
+
+
+int dbm_getValueSI(doubleBufferedMatrix Matrix, int index, double *value){
+  double *tmp;
+  int whichcol = index/Matrix->rows;
+  int whichrow = index % Matrix->rows;
+
+  if ((whichcol >= Matrix->cols) || (whichrow >= Matrix->rows) || (whichrow < 0) || (whichcol < 0)){
+    return 0;
+  }
+  
+  tmp = dbm_internalgetValue(Matrix,whichrow,whichcol);
+  
+  *value = *tmp;
+
+  if (!Matrix->colmode && Matrix->readonly){
+    Matrix->rowcolclash = 0;  /* If readonly. No need to worry about clashes */
+  }
+  
+  return 1;
+
+}
+
+/******************************************************
+ **
+ ** int dbm_setValueSI(doubleBufferedMatrix Matrix, int index, double value)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int index - location in matrix
+ ** double *value - location to store value found in matrix
+ **
+ ** Uses single indexing rather than dual indexing to locate a
+ ** value in the matrix. Sets value. 
+ **
+ ******************************************************/
+
+
+
+int dbm_setValueSI(doubleBufferedMatrix Matrix, int index, double value){
+  double *tmp;
+  int whichcol = index/Matrix->rows;
+  int whichrow = index % Matrix->rows;
+  
+  if (Matrix->readonly){
+    return 0; /* not successful */
+
+  } else {  
+
+    if ((whichcol >= Matrix->cols) || (whichrow >= Matrix->rows) || (whichrow < 0) || (whichcol < 0)){
+      return 0;
+    }
+  
+    tmp = dbm_internalsetValue(Matrix,whichrow,whichcol);
+  
+    *tmp = dbm_StorageValue(Matrix,value);
+    return 1; /* successful */
+  }
+}
+
+
+/******************************************************
+ **
+ ** int dbm_getRowss(doubleBufferedMatrix Matrix)
+ **
+ ** returns the number of rows in the matrix 
+ **
+ **
+ ******************************************************/
+
+
+int dbm_getRows(doubleBufferedMatrix Matrix){
+  return(Matrix->rows);
+}
+
+
+/******************************************************
+ **
+ ** int dbm_getCols(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** returns the number of columns in the matrix 
+ **
+ **
+ ******************************************************/
+
+
+int dbm_getCols(doubleBufferedMatrix Matrix){
+  /* returns how many cols are currently in matrix */
+  return(Matrix->cols);
+}
+
+
+/******************************************************
+ **
+ ** int dbm_getBufferCols(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** Returns the number of columns in the column buffer or
+ ** at least the maximum number allowed in the buffer.
+ **
+ ******************************************************/
+
+
+
+int dbm_getBufferCols(doubleBufferedMatrix Matrix){
+  /* returns how many columns are currently in the column buffer */
+
+  return(Matrix->max_cols);
+
+}
+
+/******************************************************
+ **
+ ** int dbm_getBufferRows(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** Returns the number of rows allowable in the
+ ** row buffer (note that if the row buffer is not activated
+ ** then this will not agree with the number of rows in the buffer
+ ** currently which would be 0)
+ **
+ ******************************************************/
+
+
+int dbm_getBufferRows(doubleBufferedMatrix Matrix){
+  /* returns how many rows are currently in the row buffer */
+
+  return(Matrix->max_rows);
+
+}
+
+
+/******************************************************
+ **
+ ** int dbm_setBufferBytes(doubleBufferedMatrix Matrix, double bytes)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** double bytes - memory budget for the buffers, 0 for none
+ **
+ ** Rather than a fixed number of columns and rows, the
+ ** buffers are sized to use at most bytes of memory (see
+ ** dbm_BalanceBuffers). They are resized as the matrix
+ ** changes shape or mode. An explicit resize of the buffers
+ ** removes the budget, as does 0 (which leaves the sizes as
+ ** they are). A budget of its own takes the matrix out of the
+ ** shared buffer pool.
+ **
+ ** Returns 0 if successful, 1 if problem.
+ **
+ ******************************************************/
+
+int dbm_setBufferBytes(doubleBufferedMatrix Matrix, double bytes){
+
+  if (!(bytes >= 0)){
+    return 1;
+  }
+  if (bytes > 0){
+    dbm_setSharedBuffer(Matrix,0);
+  }
+  Matrix->buffer_bytes = bytes;
+  return dbm_BalanceBuffers(Matrix,!(Matrix->colmode));
+}
+
+
+/******************************************************
+ **
+ ** double dbm_getBufferBytes(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** returns the memory budget for the buffers, 0 if there is none
+ **
+ ******************************************************/
+
+double dbm_getBufferBytes(doubleBufferedMatrix Matrix){
+
+  return(Matrix->buffer_bytes);
+
+}
+
+
+/******************************************************
+ **
+ ** int dbm_setSharedBuffer(doubleBufferedMatrix Matrix, int setting)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int setting - if true the matrix uses the shared buffer pool
+ **
+ ** A matrix using the shared buffer pool (see 
+ ** dbm_setSharedBufferBytes) has its column buffer grown and
+ ** shrunk within the pool's budget as it and the other 
+ ** matrices using the pool are worked on. Any memory budget
+ ** of its own (dbm_setBufferBytes) no longer applies. When it
+ ** stops using the pool the column buffer keeps its current 
+ ** size. An explicit resize of the column buffer also stops 
+ ** it using the pool.
+ **
+ ** Returns 0 if successful, 1 if problem.
+ **
+ ******************************************************/
+
+int dbm_setSharedBuffer(doubleBufferedMatrix Matrix, int setting){
+
+  if (setting && !Matrix->shared){
+    Matrix->buffer_bytes = 0;
+    Matrix->shared = 1;
+    dbm_SharedPushFront(Matrix);
+    dbm_SharedTrim(NULL,0);
+  } else if (!setting && Matrix->shared){
+    dbm_SharedUnlink(Matrix);
+    Matrix->shared = 0;
+  }
+  return 0;
+}
+
+
+/******************************************************
+ **
+ ** int dbm_isSharedBuffer(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** returns 1 if the matrix uses the shared buffer pool, 0 otherwise
+ **
+ ******************************************************/
+
+int dbm_isSharedBuffer(doubleBufferedMatrix Matrix){
+
+  return(Matrix->shared);
+
+}
+
+
+/******************************************************
+ **
+ ** int dbm_setSharedBufferBytes(double bytes)
+ **
+ ** double bytes - memory budget for the shared buffer pool
+ **
+ ** Sets the memory budget (for the whole process) shared by
+ ** the buffers of all the matrices using the pool. If they 
+ ** now use more than this, columns are taken from their 
+ ** column buffers, least recently active matrix first. With
+ ** 0 (the default) the column buffers of matrices using the
+ ** pool stay at their current sizes.
+ **
+ ** Returns 0 if successful, 1 if problem.
+ **
+ ******************************************************/
+
+int dbm_setSharedBufferBytes(double bytes){
+
+  if (!(bytes >= 0)){
+    return 1;
+  }
+  dbm_shared_bytes = bytes;
+  if (bytes > 0){
+    dbm_SharedTrim(NULL,0);
+  }
+  return 0;
+}
+
+
+/******************************************************
+ **
+ ** double dbm_getSharedBufferBytes(void)
+ **
+ ** returns the memory budget of the shared buffer pool, 0 if there is none
+ **
+ ** double dbm_getSharedBufferInUse(void)
+ **
+ ** returns the memory used by the buffers of the matrices using the pool
+ **
+ ******************************************************/
+
+double dbm_getSharedBufferBytes(void){
 
-    Matrix->max_cols = new_maxcol;
-  }
+  return(dbm_shared_bytes);
 
-  return 0;
+}
 
+
+double dbm_getSharedBufferInUse(void){
+
+  doubleBufferedMatrix Matrix;
+  double bytes = 0;
+
+  for (Matrix = dbm_shared_head; Matrix != NULL; Matrix = Matrix->shared_next){
+    bytes+= dbm_SharedBytes(Matrix);
+  }
+  return bytes;
 }
 
-/*****************************************************
+
+/******************************************************
  **
- ** int dbm_ResizeRowBuffer(doubleBufferedMatrix Matrix, int new_maxrow)
+ ** int dbm_setMaxOpenFiles(doubleBufferedMatrix Matrix, int max_open)
  **
  ** doubleBufferedMatrix Matrix
- ** int new_maxrow - the number of rows that should be stored in the row buffer
- **                  upon exit from this routine (or at least the number possible
- **                  if thw row buffer was active, if in column mode)
+ ** int max_open - maximum number of files the matrix may hold open at once
  **
+ ** Files used to store the matrix are kept open between
+ ** accesses. This sets a limit on how many can be open 
+ ** at once, closing the least recently used files if there 
+ ** are currently more than this open.
  **
  ** Returns 0 if successful, 1 if problem.
  **
- *****************************************************/
+ ******************************************************/
 
+int dbm_setMaxOpenFiles(doubleBufferedMatrix Matrix, int max_open){
 
+  if (max_open < 1){
+    return 1;
+  }
 
-int dbm_ResizeRowBuffer(doubleBufferedMatrix Matrix, int new_maxrow){
+  Matrix->max_open_files = max_open;
+  
+  while (Matrix->n_open_files > Matrix->max_open_files){
+    dbm_CloseFile(Matrix,Matrix->file_lru_tail);
+  }
+  return 0;
+}
 
 
-  int i, j;
-  /* 
-     int n_rows_remove=0;
-     int n_rows_add=0;
-  */
-  double *tmpptr;
-  int new_first_rowdata;
+/******************************************************
+ **
+ ** int dbm_getMaxOpenFiles(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** Returns the maximum number of files that the matrix
+ ** will hold open at once.
+ **
+ ******************************************************/
 
-  if (new_maxrow <= 0){
-    return 1;  /** big error **/
+int dbm_getMaxOpenFiles(doubleBufferedMatrix Matrix){
 
+  return(Matrix->max_open_files);
 
-  }
+}
 
-  if (new_maxrow > Matrix->rows){
-    new_maxrow = Matrix->rows;
-  }
 
-  if (Matrix->colmode){
-    Matrix->max_rows =new_maxrow;
-    return 0;
-  }
+/******************************************************
+ **
+ ** int dbm_setColumnsPerFile(doubleBufferedMatrix Matrix, int cols_per_file)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int cols_per_file - number of columns to store in each file
+ **
+ ** Columns are stored cols_per_file at a time in each
+ ** storage file. Using a larger value keeps the number of files
+ ** small for matrices with many columns and allows adjacent
+ ** columns to be read together. This may only be set before 
+ ** any columns have been added to the matrix.
+ **
+ ** Returns 0 if successful, 1 if problem.
+ **
+ ******************************************************/
 
+int dbm_setColumnsPerFile(doubleBufferedMatrix Matrix, int cols_per_file){
 
-  /* Fix up any potential clashes */
-  if (Matrix->rowcolclash){
-    dbm_ClearClash(Matrix);
+  if (cols_per_file < 1 || Matrix->cols > 0){
+    return 1;
   }
 
-  if (Matrix->max_rows == new_maxrow){
-    // No need to do anything.
-    return 0;
-  } else if (Matrix->max_rows > new_maxrow){
-    // Remove rows from the rows buffer
-    // Empty out row buffer (at least resync with files)
-    dbm_FlushRowBuffer(Matrix);
-    
-    for (j =0; j < Matrix->cols; j++){
-      // printf("fixing col %d in row buffer\n",j);
-      tmpptr = Matrix->rowdata[j];
-      Matrix->rowdata[j] = Calloc(new_maxrow,double);
-      for (i=0; i < new_maxrow; i++){
-	 Matrix->rowdata[j][i] = tmpptr[i];
-      }
-      Free(tmpptr);
-    }
-    Matrix->max_rows = new_maxrow;
-  } else {
-    // Increase number of rows in row buffer
-    
-    // Empty out row buffer (at least resync with files)
-    dbm_FlushRowBuffer(Matrix);
+  Matrix->cols_per_file = cols_per_file;
+  return 0;
+}
 
-    // Allocate Spaceint new_maxcol
-    
-    for (j =0; j < Matrix->cols; j++){ 
-      tmpptr = Matrix->rowdata[j];
-      Matrix->rowdata[j] = Calloc(new_maxrow,double);
-      Free(tmpptr);
-    }
-      
 
-    // Now see if we will be hitting the bottom of the matrix with the added rows
-    
-    if (Matrix->first_rowdata + new_maxrow > Matrix->rows){
-      new_first_rowdata = Matrix->rows - new_maxrow;
-    } else {
-      new_first_rowdata = Matrix->rows;
-    }
-    Matrix->max_rows = new_maxrow;
-    dbm_LoadRowBuffer(Matrix,new_first_rowdata);
-    
-  }
+/******************************************************
+ **
+ ** int dbm_getColumnsPerFile(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** Returns the number of columns stored in each file.
+ **
+ ******************************************************/
 
-  return 0;
-}
+int dbm_getColumnsPerFile(doubleBufferedMatrix Matrix){
+
+  return(Matrix->cols_per_file);
 
+}
 
 
-/*****************************************************
+/******************************************************
  **
- ** int dbm_ResizeBuffer(doubleBufferedMatrix Matrix, int new_maxrow,int new_maxcol)
+ ** int dbm_setStorageType(doubleBufferedMatrix Matrix, int type)
  **
  ** doubleBufferedMatrix Matrix
- ** int new_maxrow - the number of rows that should be stored in the row buffer
- ** int new_maxrow - the number of rows that should be stored in the row buffer
- **                  upon exit from this routine (or at least the number possible
- **                  if thw row buffer was active, if in column mode)
- **
+ ** int type - one of the DBM_STORAGE_ constants
  **
+ ** Sets how values are stored in the files. The buffers always
+ ** hold doubles, values are converted on the way to and from 
+ ** the files. May only be set before any columns have been added 
+ ** to the matrix, and not for a memory mapped matrix.
  **
+ ** Returns 0 if successful, 1 if problem.
  **
- *****************************************************/
-
-int dbm_ResizeBuffer(doubleBufferedMatrix Matrix, int new_maxrow, int new_maxcol){
+ ******************************************************/
 
-  dbm_ResizeColBuffer(Matrix,new_maxcol);
-  if (!(Matrix->colmode)){
-    dbm_ResizeRowBuffer(Matrix,new_maxrow);
-  } else {
-    /* No actual row buffer active. So just increase potential size.
-       with caveats: Can't: Be smaller than 1 or be bigger than number of rows
-       if those cases exist go to nearest possible value. ie 1 or max
+int dbm_setStorageType(doubleBufferedMatrix Matrix, int type){
 
-    */
-    if (new_maxrow < 1){
-      Matrix->max_rows = 1;
-    } else if (new_maxrow > Matrix->rows){
-      Matrix->max_rows = Matrix->rows;
-    } else {
-      Matrix->max_rows = new_maxrow;
-    } 
+  if (Matrix->cols > 0 || type < DBM_STORAGE_DOUBLE || type > DBM_STORAGE_LOGICAL){
+    return 1;
   }
+  if (type != DBM_STORAGE_DOUBLE && Matrix->memory_mapped){
+    return 1;
+  }
+  Matrix->storage_type = type;
   return 0;
 }
 
 
 /******************************************************
  **
- ** void dbm_RowMode(doubleBufferedMatrix Matrix)
+ ** int dbm_getStorageType(doubleBufferedMatrix Matrix)
  **
- ** Switch to Row Mode 
+ ** doubleBufferedMatrix Matrix
+ **
+ ** returns how values are stored in the files
  **
  ******************************************************/
 
+int dbm_getStorageType(doubleBufferedMatrix Matrix){
 
+  return(Matrix->storage_type);
 
-void dbm_RowMode(doubleBufferedMatrix Matrix){
-  int j;
-
-  /**            When switching from column mode to row mode
-   **             - allocate space for row buffer
-   **             - load data in from files, when data is not 
-   **               currently in column buffer
-   **             - copy across relevant data that is in column buffer
-   **             - set colmode flag to false
-   */
-  if (Matrix->colmode == 1){
-    Matrix->rowdata = Calloc(Matrix->cols +1,double *);
-    for (j =0; j < Matrix->cols; j++){
-      Matrix->rowdata[j] = Calloc(Matrix->max_rows,double);
-    }
-    dbm_LoadRowBuffer(Matrix,0); /* this both fills the row buffer and copys across anything in the current column buffer */
-    Matrix->colmode =0;
-  }
-  
 }
 
 
 /******************************************************
  **
- ** void dbm_ColMode(doubleBufferedMatrix Matrix)
+ ** int dbm_setTileRows(doubleBufferedMatrix Matrix, int tile_rows)
  **
- ** Switch to column Mode (ie turns off row mode)
+ ** doubleBufferedMatrix Matrix
+ ** int tile_rows - rows in each block of the tiled layout, 0 to
+ **                 store each column contiguously
+ **
+ ** Selects the layout of the storage files. In the tiled layout 
+ ** each file is a sequence of blocks of tile_rows rows of all of
+ ** its columns. May only be set before any columns have been added 
+ ** to the matrix, and not for a memory mapped matrix.
+ **
+ ** Returns 0 if successful, 1 if problem.
  **
  ******************************************************/
 
-void dbm_ColMode(doubleBufferedMatrix Matrix){
+int dbm_setTileRows(doubleBufferedMatrix Matrix, int tile_rows){
 
-  int j;
-  /* **            When switching from row mode to column mode
-  **            - clear clashes
-  **            - flush row buffer (ie write to files)
-  **            - deallocate row buffer
-  **            - set colmode flag to true
-  ** */
-  if (Matrix->colmode == 0){
-    if (Matrix->rowcolclash){
-      dbm_ClearClash(Matrix);
-    }
-    dbm_FlushRowBuffer(Matrix);
-    
-    for (j =0; j < Matrix->cols; j++){
-      Free(Matrix->rowdata[j]);
-    }
-    Free(Matrix->rowdata);
-    Matrix->colmode = 1;
+  if (Matrix->cols > 0 || tile_rows < 0 || (tile_rows && Matrix->memory_mapped)){
+    return 1;
   }
-
+  Matrix->tile_rows = tile_rows;
+  return 0;
 }
 
+
 /******************************************************
  **
- ** void dbm_SetPrefix(doubleBufferedMatrix Matrix,const char *prefix)
+ ** int dbm_getTileRows(doubleBufferedMatrix Matrix)
  **
- ** Sets initial part of the filename of temporary files
- ** used for storing matrix.
+ ** doubleBufferedMatrix Matrix
+ **
+ ** returns the number of rows in each block of the tiled layout, 
+ ** 0 if columns are stored contiguously
  **
  ******************************************************/
 
+int dbm_getTileRows(doubleBufferedMatrix Matrix){
 
+  return(Matrix->tile_rows);
 
-void dbm_SetPrefix(doubleBufferedMatrix Matrix,const char *prefix){
+}
 
-  char *tmp;
 
-  tmp = Calloc(strlen(prefix)+1,char);
-  strcpy(tmp,prefix);
-  
-  if (Matrix->fileprefix != NULL){
-    Free(Matrix->fileprefix);
-  }
-  Matrix->fileprefix = tmp;
+/******************************************************
+ **
+ ** int dbm_setMemoryMapped(doubleBufferedMatrix Matrix, int setting)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int setting - if true memory map the storage files
+ **
+ ** Turns memory mapped mode on or off. In this mode the
+ ** storage files are mapped into memory and the column buffer
+ ** views the data in place rather than keeping copies. 
+ ** May only be set before any columns have been added to the matrix.
+ ** Not available on Windows, with the tiled layout, with direct I/O
+ ** or when values are not stored as doubles.
+ **
+ ** Returns 0 if successful, 1 if problem.
+ **
+ ******************************************************/
+
+int dbm_setMemoryMapped(doubleBufferedMatrix Matrix, int setting){
 
+  if (Matrix->cols > 0 || (setting && (Matrix->tile_rows || Matrix->storage_type != DBM_STORAGE_DOUBLE || Matrix->direct_io))){
+    return 1;
+  }
+#ifdef _WIN32
+  if (setting){
+    return 1;
+  }
+#endif
+  Matrix->memory_mapped = (setting != 0);
+  return 0;
 }
 
 
 /******************************************************
  **
- ** void dbm_ReadOnlyMode(doubleBufferedMatrix Matrix, int setting)
+ ** int dbm_isMemoryMapped(doubleBufferedMatrix Matrix)
  **
- ** 
+ ** doubleBufferedMatrix Matrix
  **
- ** Set ReadOnlyMode on or off.
+ ** returns 1 if the storage files are memory mapped otherwise returns 0
  **
  ******************************************************/
 
-void dbm_ReadOnlyMode(doubleBufferedMatrix Matrix, int setting){
+int dbm_isMemoryMapped(doubleBufferedMatrix Matrix){
 
+  return(Matrix->memory_mapped);
 
-  /* 
-     If readonly mode is true we don't need to do anything
-     extra except set the flag.
+}
 
-     If however readonly is false and we are changing to
-     true then we will need to flush the current
-     buffers to ensure coherency.
 
-  */
+/******************************************************
+ **
+ ** int dbm_setDirectIO(doubleBufferedMatrix Matrix, int setting)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int setting - if true bypass the page cache
+ **
+ ** Turns direct I/O on or off. The storage files are then opened
+ ** with O_DIRECT (or F_NOCACHE) where the platform and file system 
+ ** support it, so that columns are not also held in the page
+ ** cache. Otherwise each column is dropped from the page cache 
+ ** (posix_fadvise) once it has been read into or written from
+ ** the column buffer. May be changed at any time, but not used 
+ ** with memory mapping. 
+ **
+ ** Returns 0 if successful, 1 if problem.
+ **
+ ******************************************************/
 
+int dbm_setDirectIO(doubleBufferedMatrix Matrix, int setting){
 
-  if (!(Matrix->readonly) & setting){
-    if (!(Matrix->colmode)){
-      if (Matrix->rowcolclash){
-	dbm_ClearClash(Matrix);
-      }
-      dbm_FlushRowBuffer(Matrix);
+  if (setting && Matrix->memory_mapped){
+    return 1;
+  }
+  if ((setting != 0) != Matrix->direct_io){
+    /* files are reopened as needed with the new flags */
+    if (dbm_WriteBehindSync(Matrix,-1)){
+      return 1;
     }
-    dbm_FlushAllColumns(Matrix);
-  } 
+    dbm_WriteBehindStop(Matrix);
+    dbm_PrefetchStop(Matrix);
+    dbm_CloseAllFiles(Matrix);
+    Matrix->direct_io = (setting != 0);
+  }
+  return 0;
+}
+
 
+/******************************************************
+ **
+ ** int dbm_isDirectIO(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** returns 1 if direct I/O is turned on otherwise returns 0
+ **
+ ******************************************************/
 
+int dbm_isDirectIO(doubleBufferedMatrix Matrix){
 
-  Matrix->readonly = setting;
+  return(Matrix->direct_io);
 
 }
 
+
 /******************************************************
  **
- ** int dbm_isReadOnlyMode(doubleBufferedMatrix Matrix)
+ ** int dbm_setPersistent(doubleBufferedMatrix Matrix, int setting)
  **
  ** doubleBufferedMatrix Matrix
+ ** int setting - if true keep the storage files when the matrix is freed
  **
- ** returns 1 if read only mode is activated otherwise returns 0
+ ** A persistent matrix flushes its buffers and leaves its
+ ** storage files in place when freed, so that they may later
+ ** be reopened with dbm_AdoptFiles. Otherwise (the default)
+ ** the files are deleted.
+ **
+ ** Returns 0 if successful, 1 if problem.
  **
  ******************************************************/
 
+int dbm_setPersistent(doubleBufferedMatrix Matrix, int setting){
 
-int dbm_isReadOnlyMode(doubleBufferedMatrix Matrix){
-
-  return (Matrix->readonly);
+  Matrix->persistent = (setting != 0);
+  return 0;
 }
 
 
 /******************************************************
  **
- ** int dbm_isRowMode(doubleBufferedMatrix Matrix)
+ ** int dbm_isPersistent(doubleBufferedMatrix Matrix)
  **
  ** doubleBufferedMatrix Matrix
  **
- ** returns 1 if row buffer is activated otherwise returns 0
+ ** returns 1 if the storage files are kept when the matrix is freed otherwise returns 0
  **
  ******************************************************/
 
+int dbm_isPersistent(doubleBufferedMatrix Matrix){
 
-int dbm_isRowMode(doubleBufferedMatrix Matrix){
+  return(Matrix->persistent);
 
-  return (!(Matrix->colmode));
 }
 
 
 /******************************************************
  **
- ** int dbm_getValue(doubleBufferedMatrix Matrix, int row, int col, double *value)
+ ** int dbm_Flush(doubleBufferedMatrix Matrix)
  **
  ** doubleBufferedMatrix Matrix
- ** int row, col - location in matrix
- ** double *value - location to store value found in matrix
  **
- ** Returns 1 if get was successful. Otherwise returns 0 and *value is unchanged.
+ ** Writes any modified values held in the row and column
+ ** buffers to the storage files, so that the files hold
+ ** the current contents of the matrix. The buffers keep
+ ** their contents.
  **
+ ** Returns 0 if successful, 1 if problem.
  **
  ******************************************************/
 
-int dbm_getValue(doubleBufferedMatrix Matrix, int row, int col, double *value){
-
-  double *tmp;
+int dbm_Flush(doubleBufferedMatrix Matrix){
 
-  if ((row >= Matrix->rows) || (col >= Matrix->cols) || (row < 0) || (col < 0)){
-    return 0;
+  if (!(Matrix->colmode)){
+    if (Matrix->rowcolclash){
+      dbm_ClearClash(Matrix);
+    }
+    if (dbm_FlushRowBuffer(Matrix)){
+      return 1;
+    }
+  }
+  if (dbm_FlushAllColumns(Matrix)){
+    return 1;
   }
+  return dbm_WriteBehindSync(Matrix,-1);
+}
 
 
-  tmp = dbm_internalgetValue(Matrix,row,col);
-  
-  *value = *tmp;
-  
-  if (!Matrix->colmode && Matrix->readonly){
-    Matrix->rowcolclash = 0;  /* If readonly. No need to worry about clashes */
-  }
+/******************************************************
+ **
+ ** int dbm_setPrefetchColumns(doubleBufferedMatrix Matrix, int ncols)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int ncols - how many columns to read ahead
+ **
+ ** When columns are being loaded in increasing order up to
+ ** ncols of the following columns are read in the background,
+ ** each into a spare buffer of one column. 0 turns this off.
+ ** Has no effect when memory mapped or on Windows.
+ **
+ ** Returns 0 if successful, 1 if problem.
+ **
+ ******************************************************/
 
+int dbm_setPrefetchColumns(doubleBufferedMatrix Matrix, int ncols){
 
-  return 1;
+  if (ncols < 0){
+    return 1;
+  }
+#ifndef DBM_HAVE_THREADS
+  ncols = 0;
+#endif
+  if (ncols != Matrix->prefetch_depth){
+    dbm_PrefetchStop(Matrix);
+    Matrix->prefetch_depth = ncols;
+    return dbm_BalanceBuffers(Matrix,!(Matrix->colmode));
+  }
+  return 0;
 }
 
 
 /******************************************************
  **
- ** int dbm_setValue(doubleBufferedMatrix Matrix, int row, int col, double value)
+ ** int dbm_getPrefetchColumns(doubleBufferedMatrix Matrix)
  **
  ** doubleBufferedMatrix Matrix
- ** int row, col - location in matrix
- ** double value - value to store in matrix
  **
+ ** returns how many columns may be read ahead
  **
  ******************************************************/
 
-int dbm_setValue(doubleBufferedMatrix Matrix, int row, int col, double value){
-  double *tmp;
-  
-  if (Matrix->readonly){
-    return 0; /*Not successful */
+int dbm_getPrefetchColumns(doubleBufferedMatrix Matrix){
 
-  } else {
-    if ((row >= Matrix->rows) || (col >= Matrix->cols) || (row < 0) || (col < 0)){
-      return 0;
-    }
-    
-    tmp = dbm_internalgetValue(Matrix,row,col);
-    *tmp = value;
-    return 1; /*Successful */
-  }
+  return(Matrix->prefetch_depth);
 
 }
 
+
 /******************************************************
  **
- ** int dbm_getValueSI(doubleBufferedMatrix Matrix, int index, double *value)
+ ** int dbm_setWriteBehindColumns(doubleBufferedMatrix Matrix, int ncols)
  **
  ** doubleBufferedMatrix Matrix
- ** int index - location in matrix
- ** double *value - location to store value found in matrix
+ ** int ncols - how many columns may wait to be written
  **
- ** Uses single indexing rather than dual indexing to locate a
- ** value in the matrix. copys this value into location of supplied
- ** variable.
+ ** When a modified column leaves the column buffer it is
+ ** written by a background thread while the calling thread
+ ** carries on. Up to ncols columns may be waiting at once,
+ ** each in a spare buffer of one column. 0 turns this off.
+ ** Has no effect when memory mapped, with direct I/O or on
+ ** Windows. Columns already waiting are written first.
  **
- ** Returns 1 if get was successful. Otherwise returns 0 and *value is unchanged.
+ ** Returns 0 if successful, 1 if problem.
  **
  ******************************************************/
 
+int dbm_setWriteBehindColumns(doubleBufferedMatrix Matrix, int ncols){
 
-
-int dbm_getValueSI(doubleBufferedMatrix Matrix, int index, double *value){
-  double *tmp;
-  int whichcol = index/Matrix->rows;
-  int whichrow = index % Matrix->rows;
-
-  if ((whichcol >= Matrix->cols) || (whichrow >= Matrix->rows) || (whichrow < 0) || (whichcol < 0)){
-    return 0;
+  if (ncols < 0){
+    return 1;
   }
-  
-  tmp = dbm_internalgetValue(Matrix,whichrow,whichcol);
-  
-  *value = *tmp;
-
-  if (!Matrix->colmode && Matrix->readonly){
-    Matrix->rowcolclash = 0;  /* If readonly. No need to worry about clashes */
+#ifndef DBM_HAVE_THREADS
+  ncols = 0;
+#endif
+  if (ncols != Matrix->writebehind_depth){
+    if (dbm_WriteBehindSync(Matrix,-1)){
+      return 1;
+    }
+    dbm_WriteBehindStop(Matrix);
+    Matrix->writebehind_depth = ncols;
+    return dbm_BalanceBuffers(Matrix,!(Matrix->colmode));
   }
-  
-  return 1;
-
+  return 0;
 }
 
+
 /******************************************************
  **
- ** int dbm_setValueSI(doubleBufferedMatrix Matrix, int index, double value)
+ ** int dbm_getWriteBehindColumns(doubleBufferedMatrix Matrix)
  **
  ** doubleBufferedMatrix Matrix
- ** int index - location in matrix
- ** double *value - location to store value found in matrix
  **
- ** Uses single indexing rather than dual indexing to locate a
- ** value in the matrix. Sets value. 
+ ** returns how many columns may be waiting to be written
  **
  ******************************************************/
 
+int dbm_getWriteBehindColumns(doubleBufferedMatrix Matrix){
 
+  return(Matrix->writebehind_depth);
 
-int dbm_setValueSI(doubleBufferedMatrix Matrix, int index, double value){
-  double *tmp;
-  int whichcol = index/Matrix->rows;
-  int whichrow = index % Matrix->rows;
-  
-  if (Matrix->readonly){
-    return 0; /* not successful */
+}
 
-  } else {  
 
-    if ((whichcol >= Matrix->cols) || (whichrow >= Matrix->rows) || (whichrow < 0) || (whichcol < 0)){
-      return 0;
-    }
-  
-    tmp = dbm_internalgetValue(Matrix,whichrow,whichcol);
-  
-    *tmp = value;
-    return 1; /* successful */
+/******************************************************
+ **
+ ** int dbm_setIOThreads(doubleBufferedMatrix Matrix, int nthreads)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int nthreads - number of threads to use
+ **
+ ** Sets how many threads (including the calling thread) carry
+ ** out the reads and writes needed to load or flush the row
+ ** buffer. 1 means they are all done by the calling thread.
+ ** Always 1 on Windows.
+ **
+ ** Returns 0 if successful, 1 if problem.
+ **
+ ******************************************************/
+
+int dbm_setIOThreads(doubleBufferedMatrix Matrix, int nthreads){
+
+  if (nthreads < 1){
+    return 1;
   }
+#ifdef DBM_HAVE_THREADS
+  if (nthreads != Matrix->io_threads){
+    dbm_IOPoolStop(Matrix);
+    Matrix->io_threads = nthreads;
+  }
+#endif
+  return 0;
 }
 
 
 /******************************************************
  **
- ** int dbm_getRowss(doubleBufferedMatrix Matrix)
+ ** int dbm_getIOThreads(doubleBufferedMatrix Matrix)
  **
- ** returns the number of rows in the matrix 
+ ** doubleBufferedMatrix Matrix
  **
+ ** returns how many threads are used for batches of reads/writes
  **
  ******************************************************/
 
+int dbm_getIOThreads(doubleBufferedMatrix Matrix){
+
+  return(Matrix->io_threads);
 
-int dbm_getRows(doubleBufferedMatrix Matrix){
-  return(Matrix->rows);
 }
 
 
 /******************************************************
  **
- ** int dbm_getCols(doubleBufferedMatrix Matrix)
+ ** int dbm_setEvictionPolicy(doubleBufferedMatrix Matrix, int policy)
  **
  ** doubleBufferedMatrix Matrix
+ ** int policy - DBM_EVICT_LRU, DBM_EVICT_FIFO, DBM_EVICT_MRU,
+ **              DBM_EVICT_CLOCK or DBM_EVICT_ARC
  **
- ** returns the number of columns in the matrix 
+ ** Chooses which column leaves the column buffer when a 
+ ** column not in it is needed (see dbm_VictimSlot). The 
+ ** columns already in the buffer stay there. The default 
+ ** is DBM_EVICT_LRU.
  **
+ ** Returns 0 if successful, 1 if problem.
  **
  ******************************************************/
 
+int dbm_setEvictionPolicy(doubleBufferedMatrix Matrix, int policy){
 
-int dbm_getCols(doubleBufferedMatrix Matrix){
-  /* returns how many cols are currently in matrix */
-  return(Matrix->cols);
+  int slot, n;
+
+  if (policy < DBM_EVICT_LRU || policy > DBM_EVICT_ARC){
+    return 1;
+  }
+  if (policy == Matrix->eviction_policy){
+    return 0;
+  }
+
+  if (Matrix->eviction_policy == DBM_EVICT_ARC){
+    /* the columns used more than once go ahead of the rest */
+    while (Matrix->col_list[1].size > 0){
+      slot = Matrix->col_list[1].tail;
+      dbm_ListRemove(&(Matrix->col_list[1]),Matrix->col_list_prev,Matrix->col_list_next,slot);
+      dbm_ListPushFront(&(Matrix->col_list[0]),Matrix->col_list_prev,Matrix->col_list_next,slot);
+    }
+    dbm_ClearGhosts(Matrix);
+    Free(Matrix->col_ghost);
+    Free(Matrix->ghost_prev);
+    Free(Matrix->ghost_next);
+    Matrix->col_ghost = NULL;
+    Matrix->ghost_prev = NULL;
+    Matrix->ghost_next = NULL;
+  }
+
+  for (slot = Matrix->col_list[0].head; slot >= 0; slot = Matrix->col_list_next[slot]){
+    Matrix->col_ref[slot] = 0;
+  }
+
+  if (policy == DBM_EVICT_ARC){
+    /* everything in the buffer starts out on T1 */
+    n = (Matrix->col_capacity > 0) ? Matrix->col_capacity : 1;
+    Matrix->col_ghost = Calloc(n,char);
+    Matrix->ghost_prev = Calloc(n,int);
+    Matrix->ghost_next = Calloc(n,int);
+    dbm_ListClear(&(Matrix->ghost_list[0]));
+    dbm_ListClear(&(Matrix->ghost_list[1]));
+    Matrix->arc_target = 0;
+  }
+
+  Matrix->eviction_policy = policy;
+  return 0;
 }
 
 
 /******************************************************
  **
- ** int dbm_getBufferCols(doubleBufferedMatrix Matrix)
+ ** int dbm_getEvictionPolicy(doubleBufferedMatrix Matrix)
  **
  ** doubleBufferedMatrix Matrix
  **
- ** Returns the number of columns in the column buffer or
- ** at least the maximum number allowed in the buffer.
+ ** returns the eviction policy of the column buffer (DBM_EVICT_*)
  **
  ******************************************************/
 
+int dbm_getEvictionPolicy(doubleBufferedMatrix Matrix){
 
-
-int dbm_getBufferCols(doubleBufferedMatrix Matrix){
-  /* returns how many columns are currently in the column buffer */
-
-  return(Matrix->max_cols);
+  return(Matrix->eviction_policy);
 
 }
 
+
 /******************************************************
  **
- ** int dbm_getBufferRows(doubleBufferedMatrix Matrix)
+ ** double dbm_getColumnHits(doubleBufferedMatrix Matrix)
+ **
+ ** double dbm_getColumnMisses(doubleBufferedMatrix Matrix)
+ **
+ ** void dbm_resetColumnStats(doubleBufferedMatrix Matrix)
  **
  ** doubleBufferedMatrix Matrix
  **
- ** Returns the number of rows allowable in the
- ** row buffer (note that if the row buffer is not activated
- ** then this will not agree with the number of rows in the buffer
- ** currently which would be 0)
+ ** The number of references to columns that were found in
+ ** the column buffer and that had to be loaded into it since
+ ** the matrix was created or the counts were reset. Several
+ ** references to one column in a row count once. Only column
+ ** mode (and the column buffer in row mode) is counted.
  **
  ******************************************************/
 
+double dbm_getColumnHits(doubleBufferedMatrix Matrix){
 
-int dbm_getBufferRows(doubleBufferedMatrix Matrix){
-  /* returns how many rows are currently in the row buffer */
+  return(Matrix->col_hits);
 
-  return(Matrix->max_rows);
+}
+
+
+double dbm_getColumnMisses(doubleBufferedMatrix Matrix){
+
+  return(Matrix->col_misses);
+
+}
+
+
+void dbm_resetColumnStats(doubleBufferedMatrix Matrix){
+
+  Matrix->col_hits = 0;
+  Matrix->col_misses = 0;
+  Matrix->col_last_ref = -1;
 
 }
 
@@ -1887,13 +6973,15 @@ int dbm_getValueColumn(doubleBufferedMatrix Matrix, int *cols, double *value, in
     
     for (j= 0; j < ncols; j++){
       if (dbm_InColBuffer(Matrix,0,cols[j],&curcol)){
-	memcpy(&value[j*Matrix->rows],&(Matrix->coldata[curcol][0]),Matrix->rows*sizeof(double));
+	dbm_ColumnUsed(Matrix,curcol);
       } else {
+	dbm_SharedBorrow(Matrix);
 	if (!(Matrix->readonly))
-	  dbm_FlushOldestColumn(Matrix); 
+	  dbm_EvictOldestColumn(Matrix); 
 	dbm_LoadNewColumn(Matrix,cols[j]);
-	memcpy(&value[j*Matrix->rows],&(Matrix->coldata[Matrix->max_cols -1][0]),Matrix->rows*sizeof(double));
+	curcol = Matrix->col_slot[cols[j]];
       }
+      memcpy(&value[j*Matrix->rows],&(Matrix->coldata[curcol][0]),Matrix->rows*sizeof(double));
     }
   }
   
@@ -1996,19 +7084,24 @@ int dbm_setValueColumn(doubleBufferedMatrix Matrix, int *cols, double *value, in
   if (!Matrix->colmode){
     for (j=0; j < ncols; j++){
       for (i =0; i < Matrix->rows; i++){
-	tmp = dbm_internalgetValue(Matrix,i,cols[j]);
-	*tmp = value[j*Matrix->rows + i];
+	tmp = dbm_internalsetValue(Matrix,i,cols[j]);
+	*tmp = dbm_StorageValue(Matrix,value[j*Matrix->rows + i]);
       }
     }
   } else {
     for (j= 0; j < ncols; j++){
       if (dbm_InColBuffer(Matrix,0,cols[j],&curcol)){
+	dbm_ColumnUsed(Matrix,curcol);
 	memcpy(&(Matrix->coldata[curcol][0]),&value[j*Matrix->rows],Matrix->rows*sizeof(double));
+	dbm_StorageValues(Matrix,Matrix->coldata[curcol],Matrix->rows);
+	Matrix->col_dirty[curcol] = 1;
       } else {
+	dbm_SharedBorrow(Matrix);
 	if (!(Matrix->readonly))
-	  dbm_FlushOldestColumn(Matrix); 
+	  dbm_EvictOldestColumn(Matrix); 
 	dbm_LoadNewColumn_nofill(Matrix,cols[j]);
-	memcpy(&(Matrix->coldata[Matrix->max_cols -1][0]),&value[j*Matrix->rows],Matrix->rows*sizeof(double));
+	memcpy(&(Matrix->coldata[Matrix->col_slot[cols[j]]][0]),&value[j*Matrix->rows],Matrix->rows*sizeof(double));
+	dbm_StorageValues(Matrix,Matrix->coldata[Matrix->col_slot[cols[j]]],Matrix->rows);
       }
     }
 
@@ -2059,8 +7152,8 @@ int dbm_setValueRow(doubleBufferedMatrix Matrix, int *rows, double *value, int n
  
      for (j=0; j < Matrix->max_cols; j++){
        for (i=0; i < nrows; i++){
-	 tmp = dbm_internalgetValue(Matrix,rows[i],BufferContents[j]);
-	 *tmp = value[BufferContents[j]*nrows + i];
+	 tmp = dbm_internalsetValue(Matrix,rows[i],BufferContents[j]);
+	 *tmp = dbm_StorageValue(Matrix,value[BufferContents[j]*nrows + i]);
        }
        colsdone[BufferContents[j]] = 1;
      }
@@ -2070,8 +7163,8 @@ int dbm_setValueRow(doubleBufferedMatrix Matrix, int *rows, double *value, int n
      for (j=0; j < Matrix->cols; j++){
        if (colsdone[j] == 0){
 	 for (i=0; i < nrows; i++){
-	   tmp = dbm_internalgetValue(Matrix,rows[i],j);
-	   *tmp = value[j*nrows + i];
+	   tmp = dbm_internalsetValue(Matrix,rows[i],j);
+	   *tmp = dbm_StorageValue(Matrix,value[j*nrows + i]);
 	 }
        }
      }
@@ -2080,16 +7173,16 @@ int dbm_setValueRow(doubleBufferedMatrix Matrix, int *rows, double *value, int n
     } else {
       for (j =0; j < Matrix->cols; j++){  
 	for (i =0; i < nrows; i++){
-	  tmp = dbm_internalgetValue(Matrix,rows[i],j);
-	  *tmp = value[j*nrows + i];
+	  tmp = dbm_internalsetValue(Matrix,rows[i],j);
+	  *tmp = dbm_StorageValue(Matrix,value[j*nrows + i]);
 	}
       }
     }
   } else {
     for (i =0; i < nrows; i++){
       for (j =0; j < Matrix->cols; j++){
-	tmp = dbm_internalgetValue(Matrix,rows[i],j);
-	*tmp = value[j*nrows + i];
+	tmp = dbm_internalsetValue(Matrix,rows[i],j);
+	*tmp = dbm_StorageValue(Matrix,value[j*nrows + i]);
       }
     }
   }
@@ -2104,26 +7197,119 @@ int dbm_setValueRow(doubleBufferedMatrix Matrix, int *rows, double *value, int n
 
 char *dbm_getPrefix(doubleBufferedMatrix Matrix){
 
-  char *returnvalue;
-  int len= strlen(Matrix->fileprefix);
+  char *returnvalue;
+  int len= strlen(Matrix->fileprefix);
+
+  returnvalue = Calloc(len+1,char);
+
+  strcpy(returnvalue,Matrix->fileprefix);
+
+  return returnvalue;
+}
+
+
+
+char *dbm_getDirectory(doubleBufferedMatrix Matrix){
+
+  char *returnvalue;
+  int len = strlen(Matrix->filedirectory);
+
+  returnvalue = Calloc(len+1,char);
+
+  strcpy(returnvalue,Matrix->filedirectory);
+
+  return returnvalue;
+}
+
+
+
+/******************************************************
+ **
+ ** int dbm_setDirectories(doubleBufferedMatrix Matrix, const char **directories, int n)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** const char **directories - n paths
+ ** int n - number of directories
+ **
+ ** Spreads (stripes) the storage files over several directories,
+ ** ideally each on a separate device. Storage file k is created
+ ** in directories[k % n], so with one column per file adjacent
+ ** columns are in different directories, and with several
+ ** columns per file each file is a segment of that many columns.
+ ** Reads of several columns, and background reads ahead, are
+ ** then made from all the directories at the same time. The
+ ** first directory is also the one reported by dbm_getDirectory.
+ ** Can only be set before any columns are added.
+ **
+ ** Returns 0 if successful, 1 if problem.
+ **
+ ******************************************************/
+
+int dbm_setDirectories(doubleBufferedMatrix Matrix, const char **directories, int n){
+
+  int k;
+
+  if (n < 1 || Matrix->cols > 0){
+    return 1;
+  }
+
+  /* threads reading ahead are started again (one per directory) when needed */
+  dbm_PrefetchStop(Matrix);
+  dbm_FreeDirectories(Matrix);
+
+  Free(Matrix->filedirectory);
+  Matrix->filedirectory = Calloc(strlen(directories[0])+1,char);
+  strcpy(Matrix->filedirectory,directories[0]);
+
+  if (n > 1){
+    Matrix->directories = Calloc(n,char *);
+    for (k=0; k < n; k++){
+      Matrix->directories[k] = Calloc(strlen(directories[k])+1,char);
+      strcpy(Matrix->directories[k],directories[k]);
+    }
+    Matrix->ndirectories = n;
+  }
+  return 0;
+}
+
+
+/******************************************************
+ **
+ ** int dbm_getNumDirectories(doubleBufferedMatrix Matrix)
+ **
+ ** doubleBufferedMatrix Matrix
+ **
+ ** returns the number of directories the storage files are spread over
+ **
+ ******************************************************/
 
-  returnvalue = Calloc(len+1,char);
+int dbm_getNumDirectories(doubleBufferedMatrix Matrix){
 
-  strcpy(returnvalue,Matrix->fileprefix);
+  return (Matrix->ndirectories > 1) ? Matrix->ndirectories : 1;
 
-  return returnvalue;
 }
 
 
+/******************************************************
+ **
+ ** char *dbm_getStripeDirectory(doubleBufferedMatrix Matrix, int which)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** int which - 0 to dbm_getNumDirectories(Matrix) - 1
+ **
+ ** returns (a copy of) one of the directories the storage
+ ** files are spread over
+ **
+ ******************************************************/
 
-char *dbm_getDirectory(doubleBufferedMatrix Matrix){
+char *dbm_getStripeDirectory(doubleBufferedMatrix Matrix, int which){
 
   char *returnvalue;
-  int len = strlen(Matrix->filedirectory);
+  const char *directory = (Matrix->ndirectories > 1) ? Matrix->directories[which] : Matrix->filedirectory;
 
-  returnvalue = Calloc(len+1,char);
+  returnvalue = Calloc(strlen(directory)+1,char);
 
-  strcpy(returnvalue,Matrix->filedirectory);
+  strcpy(returnvalue,directory);
 
   return returnvalue;
 }
@@ -2133,11 +7319,11 @@ char *dbm_getDirectory(doubleBufferedMatrix Matrix){
 char *dbm_getFileName(doubleBufferedMatrix Matrix, int col){
   
   char *returnvalue;
-  int len = strlen(Matrix->filenames[col]);
+  int len = strlen(Matrix->filenames[dbm_FileOfColumn(Matrix,col)]);
 
   returnvalue = Calloc(len+1,char);
 
-  strcpy(returnvalue,Matrix->filenames[col]);
+  strcpy(returnvalue,Matrix->filenames[dbm_FileOfColumn(Matrix,col)]);
 
   return returnvalue;
 
@@ -2148,39 +7334,144 @@ char *dbm_getFileName(doubleBufferedMatrix Matrix, int col){
 
 
 
-/* Changes the directory into which the temporary files are stored */
+/*****************************************************
+ **
+ ** int dbm_setNewDirectoryProgress(doubleBufferedMatrix Matrix, const char *newdirectory,
+ **                                 void (*progress)(double, double, void *), void *progress_arg)
+ **
+ ** doubleBufferedMatrix Matrix
+ ** const char *newdirectory - where the storage files should be moved to
+ ** progress - if not NULL, called (from the calling thread) with the
+ **            number of bytes copied so far and the total to copy, 
+ **            while files that could not be renamed are copied
+ ** void *progress_arg - passed to progress
+ **
+ ** Moves the storage files into a new directory, which is where any
+ ** new files will be created. Each file is renamed if possible,
+ ** otherwise copied and the original removed once the copy is known
+ ** to be good.
+ **
+ ** Returns 0 if successful, 1 if problem in which case the files are
+ ** left where they were
+ **
+ *****************************************************/
 
-int dbm_setNewDirectory(doubleBufferedMatrix Matrix, const char *newdirectory){
+int dbm_setNewDirectoryProgress(doubleBufferedMatrix Matrix, const char *newdirectory, void (*progress)(double, double, void *), void *progress_arg){
 
-  char *directory;
-  char *olddirectory;
-  char *tmp, *temp_name;
-  int i;
+  int nfiles = dbm_NumFiles(Matrix);
+  char **newnames;
+  int *copied;
+  char *temp_name;
+  double size;
+  dbm_copy_job job;
+  int i, k, fd, result = 0;
+
+  /* everything must be in the files, with nothing still using them, before they move */
+  if (dbm_WriteBehindSync(Matrix,-1)){
+    return 1;
+  }
+  dbm_PrefetchStop(Matrix);
+  dbm_UnmapAllFiles(Matrix);
+
+  /* open files can not be renamed on all platforms */
+  dbm_CloseAllFiles(Matrix);
+
+  newnames = Calloc(nfiles > 0 ? nfiles : 1,char *);
+  copied = Calloc(nfiles > 0 ? nfiles : 1,int);
+  job.from = Calloc(nfiles > 0 ? nfiles : 1,char *);
+  job.to = Calloc(nfiles > 0 ? nfiles : 1,char *);
+  job.n = 0;
+  job.total = 0.0;
+  job.progress = progress;
+  job.progress_arg = progress_arg;
+
+  for (i =0; i < nfiles; i++){
+    temp_name = (char *)R_tmpnam(Matrix->fileprefix,newdirectory);
+    newnames[i] = Calloc(strlen(temp_name)+1,char);
+    strcpy(newnames[i],temp_name);
+    if (!rename(Matrix->filenames[i],newnames[i])){
+      continue;
+    }
 
+    /* typically the new directory is on another file system. Create the
+       copy now, so that its name can not be taken by a later file */
+    size = dbm_FileSize(Matrix->filenames[i]);
+    fd = open(newnames[i],O_WRONLY | O_CREAT | O_EXCL | O_BINARY,0666);
+    if (size < 0 || fd < 0){
+      if (fd >= 0){
+	close(fd);
+	remove(newnames[i]);
+      }
+      Free(newnames[i]);
+      result = 1;
+      break;
+    }
+    close(fd);
+    copied[i] = 1;
+    job.from[job.n] = Matrix->filenames[i];
+    job.to[job.n] = newnames[i];
+    job.n++;
+    job.total+= size;
+  }
 
-  int len = strlen(newdirectory);
+  if (!result && job.n > 0){
+    result = dbm_CopyFiles(Matrix,&job);
+  }
+
+  /* i files were dealt with above. Either put them all back or finish moving them */
+  for (k=0; k < i; k++){
+    if (result){
+      if (copied[k]){
+	remove(newnames[k]);
+      } else {
+	rename(newnames[k],Matrix->filenames[k]);
+      }
+      Free(newnames[k]);
+    } else {
+      if (copied[k]){
+	remove(Matrix->filenames[k]);
+      }
+      Free(Matrix->filenames[k]);
+      Matrix->filenames[k] = newnames[k];
+    }
+  }
 
-  directory = Calloc(len+1,char);
+  Free(newnames);
+  Free(copied);
+  Free(job.from);
+  Free(job.to);
 
-  strcpy(directory,newdirectory);
+  if (!result){
+    Free(Matrix->filedirectory);
+    Matrix->filedirectory = Calloc(strlen(newdirectory)+1,char);
+    strcpy(Matrix->filedirectory,newdirectory);
 
-  olddirectory = Matrix->filedirectory;
+    /* every file is now in the one directory */
+    dbm_FreeDirectories(Matrix);
+  }
 
-  for (i =0; i < Matrix->cols; i++){
-    temp_name = (char *)R_tmpnam(Matrix->fileprefix,newdirectory);
-    tmp = Calloc(strlen(temp_name)+1,char);
-    strcpy(tmp,temp_name);
-    rename(Matrix->filenames[i], tmp);
-    Matrix->filenames[i] = tmp;
-    /*  Free(temp_name); */
+  if (Matrix->memory_mapped){
+    /* the column buffer holds views into the mappings */
+    for (i=0; i < nfiles; i++){
+      if (dbm_MapFile(Matrix,i)){
+	return 1;
+      }
+    }
+    for (k=0; k < Matrix->max_cols && k < Matrix->cols; k++){
+      Matrix->coldata[k] = dbm_ColumnView(Matrix,Matrix->which_cols[k]);
+    }
   }
 
-  Matrix->filedirectory = directory;
+  return result;
+}
 
-  Free(olddirectory);
 
 
-  return 0;
+/* Changes the directory into which the temporary files are stored */
+
+int dbm_setNewDirectory(doubleBufferedMatrix Matrix, const char *newdirectory){
+
+  return dbm_setNewDirectoryProgress(Matrix,newdirectory,NULL,NULL);
 }
 
 
@@ -2205,8 +7496,8 @@ int dbm_copyValues(doubleBufferedMatrix Matrix_target,doubleBufferedMatrix Matri
   for (j=0; j < Matrix_source->cols; j++){
     for (i=0; i < Matrix_source->rows; i++){
       value = dbm_internalgetValue(Matrix_source,i,j);
-      tmp = dbm_internalgetValue(Matrix_target,i,j);
-      *tmp = *value;
+      tmp = dbm_internalsetValue(Matrix_target,i,j);
+      *tmp = dbm_StorageValue(Matrix_target,*value);
     }
   }
 
@@ -2236,8 +7527,8 @@ int dbm_ewApply(doubleBufferedMatrix Matrix,double (* fn)(double, double *),doub
     /* First do the columns currently in the buffer */
     for (j=0; j < Matrix->max_cols; j++){
       for (i=0; i < Matrix->rows; i++){
-	value = dbm_internalgetValue(Matrix,i,BufferContents[j]);
-	*value = fn(*value,fn_param);
+	value = dbm_internalsetValue(Matrix,i,BufferContents[j]);
+	*value = dbm_StorageValue(Matrix,fn(*value,fn_param));
       }
       colsdone[BufferContents[j]] = 1;
     }
@@ -2246,8 +7537,8 @@ int dbm_ewApply(doubleBufferedMatrix Matrix,double (* fn)(double, double *),doub
     for (j=0; j < Matrix->cols; j++){
       if (colsdone[j] == 0){
 	for (i=0; i < Matrix->rows; i++){
-	  value = dbm_internalgetValue(Matrix,i,j);
-	  *value = fn(*value,fn_param);
+	  value = dbm_internalsetValue(Matrix,i,j);
+	  *value = dbm_StorageValue(Matrix,fn(*value,fn_param));
 	}
       }
     }
@@ -2258,8 +7549,8 @@ int dbm_ewApply(doubleBufferedMatrix Matrix,double (* fn)(double, double *),doub
     /* everything is in memory. Lets process it */
     for (j=0; j < Matrix->cols; j++){
       for (i=0; i < Matrix->rows; i++){
-	value = dbm_internalgetValue(Matrix,i,j);
-	*value = fn(*value,fn_param);
+	value = dbm_internalsetValue(Matrix,i,j);
+	*value = dbm_StorageValue(Matrix,fn(*value,fn_param));
       }
     }
   
@@ -2274,6 +7565,228 @@ int dbm_ewApply(doubleBufferedMatrix Matrix,double (* fn)(double, double *),doub
 
 
 
+/*****************************************************
+ **
+ ** Type specialized reductions.
+ **
+ ** With the integer storage types (uint16, int32 and logical)
+ ** the column sums, means, maxima, minima, ranges and medians, 
+ ** and the sum, mean, max and min of the whole matrix, work on
+ ** the narrow values of any column not in the column buffer. 
+ ** The column is read straight from its file into rows*
+ ** dbm_ElementSize bytes of scratch space rather than being 
+ ** loaded into the column buffer as doubles, so nothing is
+ ** evicted, and sums are accumulated exactly as integers.
+ **
+ ** This is only done in column mode and when the matrix does
+ ** not fit in the column buffer. Otherwise the columns are
+ ** loaded as usual, since they will then stay in memory.
+ **
+ ** dbm_NarrowScratch gives the scratch space (NULL if it does
+ ** not apply). dbm_NarrowSummary reads a column into it and 
+ ** summarizes it, returning 1 if the column must instead go 
+ ** through the buffer (NULL scratch, column already buffered 
+ ** or a read failure, which the buffered path then reports).
+ **
+ *****************************************************/
+
+typedef struct {
+  int n;          /* number of values that are not NA */
+  int na;         /* number of NA values */
+  long long sum;  /* of those not NA, as are min and max (meaningless if n is 0) */
+  int min;
+  int max;
+} dbm_column_summary;
+
+
+static void *dbm_NarrowScratch(doubleBufferedMatrix Matrix){
+
+  if (Matrix->storage_type == DBM_STORAGE_DOUBLE || Matrix->storage_type == DBM_STORAGE_FLOAT || !Matrix->colmode || Matrix->cols <= Matrix->max_cols){
+    return NULL;
+  }
+  return (void *)Calloc((size_t)Matrix->rows*dbm_ElementSize(Matrix),char);
+}
+
+/* reads the narrow values of column col, as held in its file, into dest */
+
+static int dbm_ReadNarrowColumn(doubleBufferedMatrix Matrix, int col, void *dest){
+
+  int fd, n, row = 0;
+  int block_start, block_rows;
+  size_t size = dbm_ElementSize(Matrix);
+
+  if (dbm_WriteBehindSync(Matrix,col)){
+    return 1;
+  }
+  if (Matrix->col_zero[col]){
+    memset(dest,0,(size_t)Matrix->rows*size);
+    return 0;
+  }
+
+  fd = dbm_OpenFile(Matrix,dbm_FileOfColumn(Matrix,col));
+  if (fd < 0){
+    return 1;
+  }
+  while (row < Matrix->rows){
+    n = Matrix->rows - row;
+    if (Matrix->tile_rows){
+      dbm_TileBlock(Matrix,row,&block_start,&block_rows);
+      n = block_start + block_rows - row;
+    }
+    if (dbm_pread(fd,(char *)dest + (size_t)row*size,(size_t)n*size,dbm_ColumnOffset(Matrix,col,row))){
+      return 1;
+    }
+    row+= n;
+  }
+  dbm_DropCache(Matrix,fd,col);
+  return 0;
+}
+
+static int dbm_NarrowSummary(doubleBufferedMatrix Matrix, int col, void *narrow, dbm_column_summary *summary){
+
+  int i, value, curcol;
+  const unsigned short *u16;
+  const int *i32;
+  const unsigned char *lgl;
+
+  if (narrow == NULL || dbm_InColBuffer(Matrix,0,col,&curcol) || dbm_ReadNarrowColumn(Matrix,col,narrow)){
+    return 1;
+  }
+
+  summary->n = 0;
+  summary->na = 0;
+  summary->sum = 0;
+  summary->min = INT_MAX;
+  summary->max = INT_MIN;
+
+  switch (Matrix->storage_type){
+  case DBM_STORAGE_UINT16:
+    u16 = (const unsigned short *)narrow;
+    for (i=0; i < Matrix->rows; i++){
+      if (u16[i] == DBM_UINT16_NA){
+	summary->na++;
+      } else {
+	value = u16[i];
+	summary->sum+= value;
+	if (value < summary->min){
+	  summary->min = value;
+	}
+	if (value > summary->max){
+	  summary->max = value;
+	}
+      }
+    }
+    break;
+  case DBM_STORAGE_INT32:
+    i32 = (const int *)narrow;
+    for (i=0; i < Matrix->rows; i++){
+      if (i32[i] == NA_INTEGER){
+	summary->na++;
+      } else {
+	value = i32[i];
+	summary->sum+= value;
+	if (value < summary->min){
+	  summary->min = value;
+	}
+	if (value > summary->max){
+	  summary->max = value;
+	}
+      }
+    }
+    break;
+  case DBM_STORAGE_LOGICAL:
+    lgl = (const unsigned char *)narrow;
+    for (i=0; i < Matrix->rows; i++){
+      if (lgl[i] == DBM_LOGICAL_NA){
+	summary->na++;
+      } else {
+	summary->sum+= lgl[i];
+      }
+    }
+    break;
+  }
+  summary->n = Matrix->rows - summary->na;
+  if (Matrix->storage_type == DBM_STORAGE_LOGICAL && summary->n > 0){
+    summary->min = (summary->sum < summary->n) ? 0 : 1;
+    summary->max = (summary->sum > 0) ? 1 : 0;
+  }
+  return 0;
+}
+
+/* the median of the narrow values of column col, as dbm_singlecolMedian. Returns 1 if the column must go through the buffer */
+
+static int dbm_NarrowMedian(doubleBufferedMatrix Matrix, int col, void *narrow, int naflag, double *result){
+
+  int i, n = 0, curcol;
+  int *buffer;
+  int ones = 0, zeros;
+  const unsigned short *u16;
+  const int *i32;
+  const unsigned char *lgl;
+
+  if (narrow == NULL || dbm_InColBuffer(Matrix,0,col,&curcol) || dbm_ReadNarrowColumn(Matrix,col,narrow)){
+    return 1;
+  }
+
+  if (Matrix->storage_type == DBM_STORAGE_LOGICAL){
+    /* only the number of ones matters */
+    lgl = (const unsigned char *)narrow;
+    for (i=0; i < Matrix->rows; i++){
+      if (lgl[i] == DBM_LOGICAL_NA){
+	if (!naflag){
+	  *result = R_NaReal;
+	  return 0;
+	}
+      } else {
+	ones+= lgl[i];
+	n++;
+      }
+    }
+    /* sorted, the zeros come first */
+    zeros = n - ones;
+    if (n == 0){
+      *result = R_NaReal;
+    } else if ((n % 2) == 1){
+      *result = ((n-1)/2 >= zeros);
+    } else {
+      *result = ((n/2 - 1 >= zeros) + (n/2 >= zeros))/2.0;
+    }
+    return 0;
+  }
+
+  buffer = Calloc(Matrix->rows,int);
+  u16 = (const unsigned short *)narrow;
+  i32 = (const int *)narrow;
+  for (i=0; i < Matrix->rows; i++){
+    if (Matrix->storage_type == DBM_STORAGE_UINT16 ? (u16[i] == DBM_UINT16_NA) : (i32[i] == NA_INTEGER)){
+      if (!naflag){
+	Free(buffer);
+	*result = R_NaReal;
+	return 0;
+      }
+    } else {
+      buffer[n] = (Matrix->storage_type == DBM_STORAGE_UINT16) ? u16[i] : i32[i];
+      n++;
+    }
+  }
+
+  if (n == 0){
+    *result = R_NaReal;
+  } else if ((n % 2) == 1){
+    iPsort(buffer, n, (n-1)/2);
+    *result = buffer[(n-1)/2];
+  } else {
+    iPsort(buffer, n, n/2);
+    *result = buffer[n/2];
+    iPsort(buffer, n, n/2 - 1);
+    *result = (*result + buffer[n/2 - 1])/2;
+  }
+  Free(buffer);
+  return 0;
+}
+
+
+
 double dbm_max(doubleBufferedMatrix Matrix,int naflag, int *foundfinite){
 
 
@@ -2284,6 +7797,8 @@ double dbm_max(doubleBufferedMatrix Matrix,int naflag, int *foundfinite){
   
   int *BufferContents;
   int *colsdone;
+  void *narrow;
+  dbm_column_summary summary;
   
   BufferContents= dbm_whatsInColumnBuffer(Matrix);
 
@@ -2311,22 +7826,35 @@ double dbm_max(doubleBufferedMatrix Matrix,int naflag, int *foundfinite){
       colsdone[BufferContents[j]] = 1;
     }
     
-    /* now read in what we need to read in */
+    /* now read in what we need to read in, straight from the files if the values are integers */
+    narrow = dbm_NarrowScratch(Matrix);
     for (j=0; j < Matrix->cols; j++){
       if (colsdone[j] == 0){
-	for (i=0; i < Matrix->rows; i++){
-	  value = dbm_internalgetValue(Matrix,i,j);
-	  if (ISNAN(*value) && !naflag){
+	if (!dbm_NarrowSummary(Matrix,j,narrow,&summary)){
+	  if (summary.na && !naflag){
 	    max= R_NaReal;
-	    break;
-	  } 
-	  if (max < *value){
-	    max=*value;
+	  } else if (summary.n > 0 && max < summary.max){
+	    max= summary.max;
 	    *foundfinite = 1;
 	  }
+	} else {
+	  for (i=0; i < Matrix->rows; i++){
+	    value = dbm_internalgetValue(Matrix,i,j);
+	    if (ISNAN(*value) && !naflag){
+	      max= R_NaReal;
+	      break;
+	    } 
+	    if (max < *value){
+	      max=*value;
+	      *foundfinite = 1;
+	    }
+	  }
 	}
       }
     }
+    if (narrow != NULL){
+      Free(narrow);
+    }
   } else {
     for (j=0; j < Matrix->cols; j++){
       for (i=0; i < Matrix->rows; i++){
@@ -2361,6 +7889,8 @@ double dbm_min(doubleBufferedMatrix Matrix,int naflag, int *foundfinite){
   
   int *BufferContents;
   int *colsdone;
+  void *narrow;
+  dbm_column_summary summary;
   
   BufferContents= dbm_whatsInColumnBuffer(Matrix);
 
@@ -2388,22 +7918,35 @@ double dbm_min(doubleBufferedMatrix Matrix,int naflag, int *foundfinite){
       colsdone[BufferContents[j]] = 1;
     }
     
-    /* now read in what we need to read in */
+    /* now read in what we need to read in, straight from the files if the values are integers */
+    narrow = dbm_NarrowScratch(Matrix);
     for (j=0; j < Matrix->cols; j++){
       if (colsdone[j] == 0){
-	for (i=0; i < Matrix->rows; i++){
-	  value = dbm_internalgetValue(Matrix,i,j);
-	  if (ISNAN(*value) && !naflag){
+	if (!dbm_NarrowSummary(Matrix,j,narrow,&summary)){
+	  if (summary.na && !naflag){
 	    min= R_NaReal;
-	    break;
-	  }
-	  if (min > *value){
-	    min = *value;	
+	  } else if (summary.n > 0 && min > summary.min){
+	    min= summary.min;
 	    *foundfinite = 1;
 	  }
+	} else {
+	  for (i=0; i < Matrix->rows; i++){
+	    value = dbm_internalgetValue(Matrix,i,j);
+	    if (ISNAN(*value) && !naflag){
+	      min= R_NaReal;
+	      break;
+	    }
+	    if (min > *value){
+	      min = *value;	
+	      *foundfinite = 1;
+	    }
+	  }
 	}
       }
     }
+    if (narrow != NULL){
+      Free(narrow);
+    }
 
 
 
@@ -2443,6 +7986,8 @@ double dbm_mean(doubleBufferedMatrix Matrix,int naflag){
   
   int *BufferContents;
   int *colsdone;
+  void *narrow;
+  dbm_column_summary summary;
   
   BufferContents= dbm_whatsInColumnBuffer(Matrix);
 
@@ -2468,23 +8013,36 @@ double dbm_mean(doubleBufferedMatrix Matrix,int naflag){
       colsdone[BufferContents[j]] = 1;
     }
    
-    /* now read in what we need to read in */
+    /* now read in what we need to read in, straight from the files if the values are integers */
+    narrow = dbm_NarrowScratch(Matrix);
     for (j=0; j < Matrix->cols; j++){
       if (colsdone[j] == 0){
-	for (i=0; i < Matrix->rows; i++){
-	  value = dbm_internalgetValue(Matrix,i,j);
-	  if (ISNAN(*value)){
-	    if (!naflag){
-	      mean= R_NaReal;
-	      break;
-	    }
+	if (!dbm_NarrowSummary(Matrix,j,narrow,&summary)){
+	  if (summary.na && !naflag){
+	    mean= R_NaReal;
 	  } else {
-	    mean+= *value;
-	    count++;
+	    mean+= (double)summary.sum;
+	    count+= summary.n;
+	  }
+	} else {
+	  for (i=0; i < Matrix->rows; i++){
+	    value = dbm_internalgetValue(Matrix,i,j);
+	    if (ISNAN(*value)){
+	      if (!naflag){
+		mean= R_NaReal;
+		break;
+	      }
+	    } else {
+	      mean+= *value;
+	      count++;
+	    }
 	  }
 	}
       }
     }
+    if (narrow != NULL){
+      Free(narrow);
+    }
   } else {
     for (j=0; j < Matrix->cols; j++){
       for (i=0; i < Matrix->rows; i++){
@@ -2520,6 +8078,8 @@ double dbm_sum(doubleBufferedMatrix Matrix,int naflag){
  
   int *BufferContents;
   int *colsdone;
+  void *narrow;
+  dbm_column_summary summary;
   
   BufferContents= dbm_whatsInColumnBuffer(Matrix);
 
@@ -2543,22 +8103,34 @@ double dbm_sum(doubleBufferedMatrix Matrix,int naflag){
       colsdone[BufferContents[j]] = 1;
     }
     
-    /* now read in what we need to read in */
+    /* now read in what we need to read in, straight from the files if the values are integers */
+    narrow = dbm_NarrowScratch(Matrix);
     for (j=0; j < Matrix->cols; j++){
       if (colsdone[j] == 0){
-	for (i=0; i < Matrix->rows; i++){
-	  value = dbm_internalgetValue(Matrix,i,j);
-	  if (ISNAN(*value)){
-	    if (!naflag){
-	      sum= R_NaReal;
-	      break;
-	    }
+	if (!dbm_NarrowSummary(Matrix,j,narrow,&summary)){
+	  if (summary.na && !naflag){
+	    sum= R_NaReal;
 	  } else {
-	    sum+= *value;
-	    }
+	    sum+= (double)summary.sum;
+	  }
+	} else {
+	  for (i=0; i < Matrix->rows; i++){
+	    value = dbm_internalgetValue(Matrix,i,j);
+	    if (ISNAN(*value)){
+	      if (!naflag){
+		sum= R_NaReal;
+		break;
+	      }
+	    } else {
+	      sum+= *value;
+	      }
+	  }
 	}
       }
     }
+    if (narrow != NULL){
+      Free(narrow);
+    }
   } else {
     for (j=0; j < Matrix->cols; j++){
       for (i=0; i < Matrix->rows; i++){
@@ -2810,6 +8382,8 @@ void dbm_colMeans(doubleBufferedMatrix Matrix,int naflag,double *results){
 
   int *BufferContents;
   int *colsdone;
+  void *narrow;
+  dbm_column_summary summary;
   
   BufferContents= dbm_whatsInColumnBuffer(Matrix);
 
@@ -2824,12 +8398,20 @@ void dbm_colMeans(doubleBufferedMatrix Matrix,int naflag,double *results){
       colsdone[BufferContents[j]] = 1;
     }
     
-    /* now read in what we need to read in */
+    /* now read in what we need to read in, straight from the files if the values are integers */
+    narrow = dbm_NarrowScratch(Matrix);
     for (j=0; j < Matrix->cols; j++){
       if (colsdone[j] == 0){
-	dbm_singlecolMeans(Matrix,j,naflag,results);
+	if (dbm_NarrowSummary(Matrix,j,narrow,&summary)){
+	  dbm_singlecolMeans(Matrix,j,naflag,results);
+	} else {
+	  results[j] = (summary.na && !naflag) ? R_NaReal : (double)summary.sum/(double)summary.n;
+	}
       }
     }
+    if (narrow != NULL){
+      Free(narrow);
+    }
   } else {
     for (j=0; j < Matrix->cols; j++){
       dbm_singlecolMeans(Matrix,j,naflag,results);
@@ -2872,6 +8454,8 @@ void dbm_colSums(doubleBufferedMatrix Matrix,int naflag,double *results){
  
   int *BufferContents;
   int *colsdone;
+  void *narrow;
+  dbm_column_summary summary;
   
   BufferContents= dbm_whatsInColumnBuffer(Matrix);
 
@@ -2886,12 +8470,20 @@ void dbm_colSums(doubleBufferedMatrix Matrix,int naflag,double *results){
       colsdone[BufferContents[j]] = 1;
     }
     
-    /* now read in what we need to read in */
+    /* now read in what we need to read in, straight from the files if the values are integers */
+    narrow = dbm_NarrowScratch(Matrix);
     for (j=0; j < Matrix->cols; j++){
       if (colsdone[j] == 0){
-	dbm_singlecolSums(Matrix,j,naflag,results);
+	if (dbm_NarrowSummary(Matrix,j,narrow,&summary)){
+	  dbm_singlecolSums(Matrix,j,naflag,results);
+	} else {
+	  results[j] = (summary.na && !naflag) ? R_NaReal : (double)summary.sum;
+	}
       }
     }
+    if (narrow != NULL){
+      Free(narrow);
+    }
   } else {
     for (j=0; j < Matrix->cols; j++){
       dbm_singlecolSums(Matrix,j,naflag,results);
@@ -3157,6 +8749,8 @@ void dbm_colMax(doubleBufferedMatrix Matrix,int naflag,double *results){
 
   int *BufferContents;
   int *colsdone;
+  void *narrow;
+  dbm_column_summary summary;
   
   BufferContents= dbm_whatsInColumnBuffer(Matrix);
 
@@ -3171,12 +8765,24 @@ void dbm_colMax(doubleBufferedMatrix Matrix,int naflag,double *results){
       colsdone[BufferContents[j]] = 1;
     }
     
-    /* now read in what we need to read in */
+    /* now read in what we need to read in, straight from the files if the values are integers */
+    narrow = dbm_NarrowScratch(Matrix);
     for (j=0; j < Matrix->cols; j++){
       if (colsdone[j] == 0){
-	dbm_singlecolMax(Matrix,j,naflag,results);
+	if (dbm_NarrowSummary(Matrix,j,narrow,&summary)){
+	  dbm_singlecolMax(Matrix,j,naflag,results);
+	} else {
+	  if (summary.na && !naflag){
+	    results[j] = R_NaReal;
+	  } else {
+	    results[j] = (summary.n > 0) ? (double)summary.max : R_NegInf;
+	  }
+	}
       }
     }
+    if (narrow != NULL){
+      Free(narrow);
+    }
   } else {
     for (j=0; j < Matrix->cols; j++){
       dbm_singlecolMax(Matrix,j,naflag,results);
@@ -3286,6 +8892,8 @@ void dbm_colMin(doubleBufferedMatrix Matrix,int naflag,double *results){
  
   int *BufferContents;
   int *colsdone;
+  void *narrow;
+  dbm_column_summary summary;
   
   BufferContents= dbm_whatsInColumnBuffer(Matrix);
 
@@ -3300,12 +8908,24 @@ void dbm_colMin(doubleBufferedMatrix Matrix,int naflag,double *results){
       colsdone[BufferContents[j]] = 1;
     }
     
-    /* now read in what we need to read in */
+    /* now read in what we need to read in, straight from the files if the values are integers */
+    narrow = dbm_NarrowScratch(Matrix);
     for (j=0; j < Matrix->cols; j++){
       if (colsdone[j] == 0){
-	dbm_singlecolMin(Matrix,j,naflag,results);
+	if (dbm_NarrowSummary(Matrix,j,narrow,&summary)){
+	  dbm_singlecolMin(Matrix,j,naflag,results);
+	} else {
+	  if (summary.na && !naflag){
+	    results[j] = R_NaReal;
+	  } else {
+	    results[j] = (summary.n > 0) ? (double)summary.min : R_PosInf;
+	  }
+	}
       }
     }
+    if (narrow != NULL){
+      Free(narrow);
+    }
   } else {
     for (j=0; j < Matrix->cols; j++){
       dbm_singlecolMin(Matrix,j,naflag,results);
@@ -3395,6 +9015,7 @@ void dbm_colMedians(doubleBufferedMatrix Matrix,int naflag,double *results){
  
   int *BufferContents;
   int *colsdone;
+  void *narrow;
   
   BufferContents= dbm_whatsInColumnBuffer(Matrix);
 
@@ -3409,12 +9030,16 @@ void dbm_colMedians(doubleBufferedMatrix Matrix,int naflag,double *results){
       colsdone[BufferContents[j]] = 1;
     }
     
-    /* now read in what we need to read in */
+    /* now read in what we need to read in, straight from the files if the values are integers */
+    narrow = dbm_NarrowScratch(Matrix);
     for (j=0; j < Matrix->cols; j++){
-      if (colsdone[j] == 0){
+      if (colsdone[j] == 0 && dbm_NarrowMedian(Matrix,j,narrow,naflag,&results[j])){
 	dbm_singlecolMedian(Matrix,j,naflag,results);
       }
     }
+    if (narrow != NULL){
+      Free(narrow);
+    }
   } else {
     for (j=0; j < Matrix->cols; j++){
       dbm_singlecolMedian(Matrix,j,naflag,results);
@@ -3512,6 +9137,8 @@ void dbm_colRanges(doubleBufferedMatrix Matrix,int naflag, int finite, double *r
  
   int *BufferContents;
   int *colsdone;
+  void *narrow;
+  dbm_column_summary summary;
   
   BufferContents= dbm_whatsInColumnBuffer(Matrix);
 
@@ -3526,12 +9153,26 @@ void dbm_colRanges(doubleBufferedMatrix Matrix,int naflag, int finite, double *r
       colsdone[BufferContents[j]] = 1;
     }
     
-    /* now read in what we need to read in */
+    /* now read in what we need to read in, straight from the files if the values are integers */
+    narrow = dbm_NarrowScratch(Matrix);
     for (j=0; j < Matrix->cols; j++){
       if (colsdone[j] == 0){
-	dbm_singlecolRange(Matrix,j,naflag,finite,results);
+	if (dbm_NarrowSummary(Matrix,j,narrow,&summary)){
+	  dbm_singlecolRange(Matrix,j,naflag,finite,results);
+	} else {
+	  if (summary.na && !naflag){
+	    results[j*2] = R_NaReal;
+	    results[j*2 + 1] = R_NaReal;
+	  } else {
+	    results[j*2] = (summary.n > 0) ? (double)summary.min : R_PosInf;
+	    results[j*2 + 1] = (summary.n > 0) ? (double)summary.max : R_NegInf;
+	  }
+	}
       }
     }
+    if (narrow != NULL){
+      Free(narrow);
+    }
   } else {
     for (j=0; j < Matrix->cols; j++){
       dbm_singlecolRange(Matrix,j,naflag,finite,results);
@@ -3548,46 +9189,57 @@ void dbm_colRanges(doubleBufferedMatrix Matrix,int naflag, int finite, double *r
 
 
 
-int dbm_memoryInUse(doubleBufferedMatrix Matrix){
+double dbm_memoryInUseBytes(doubleBufferedMatrix Matrix){
 
 
-  int i;
-  int object_size =0;
+  int i, nslots;
+  double object_size =0;
 
   /* this is the size of the storage object itself */
-  object_size+= 10*sizeof(int) + 3*sizeof(double**) + 2*sizeof(char *) + sizeof(int *) + sizeof(char **);
+  object_size+= sizeof(struct _double_buffered_matrix);
 
   /* Now start adding in things that are of variable size and stored in the object */
 
-  /* first deal with the column buffer */
+  /* first deal with the column buffer (when memory mapped this holds no data of its own) */
   
-  if (Matrix->cols < Matrix->max_cols){
-    object_size+= Matrix->cols*sizeof(double *);
-    object_size+= Matrix->cols*Matrix->rows*sizeof(double);
-    object_size+= Matrix->cols*sizeof(int);
-  } else {
-    object_size+= Matrix->max_cols*sizeof(double *);
-    object_size+= Matrix->max_cols*Matrix->rows*sizeof(double);
-    object_size+= Matrix->max_cols*sizeof(int);
+  nslots = (Matrix->cols < Matrix->max_cols) ? Matrix->cols : Matrix->max_cols;
+  object_size+= (double)nslots*(sizeof(double *) + 4*sizeof(int) + sizeof(char));
+  if (!Matrix->memory_mapped){
+    object_size+= (double)nslots*Matrix->rows*sizeof(double);
+  }
+
+  /* the per column arrays */
+  object_size+= (double)Matrix->col_capacity*(sizeof(int) + sizeof(char));
+  if (Matrix->col_ghost != NULL){
+    object_size+= (double)Matrix->col_capacity*(2*sizeof(int) + sizeof(char));
   }
 
   /* Now the row buffer */
   if (!Matrix->colmode){
-    object_size+= Matrix->cols*sizeof(double *);
-    if (Matrix->rows < Matrix->max_rows){
-      object_size+= Matrix->rows*Matrix->max_rows*sizeof(double);
-    } else {
-      object_size+= Matrix->cols*Matrix->max_rows*sizeof(double);
-    }
+    object_size+= (double)Matrix->col_capacity*(sizeof(double *) + 2*sizeof(int));
+    object_size+= (double)Matrix->cols*Matrix->max_rows*sizeof(double);
+  }
+
+  /* prefetched columns */
+  if (Matrix->prefetch != NULL){
+    object_size+= Matrix->prefetch_depth*(sizeof(dbm_prefetch_entry) + (double)Matrix->rows*sizeof(double));
+  }
+
+  /* columns held for the write-behind thread */
+  if (Matrix->writebehind != NULL){
+    object_size+= Matrix->writebehind_depth*(sizeof(dbm_prefetch_entry) + (double)Matrix->rows*sizeof(double));
   }
   
   
   /* the strings */
   object_size+=strlen(Matrix->fileprefix) + 1;
   object_size+=strlen(Matrix->filedirectory) + 1;
+  for (i=0; i < Matrix->ndirectories; i++){
+    object_size+=sizeof(char *) + strlen(Matrix->directories[i]) + 1;
+  }
   
-  object_size+= Matrix->cols*sizeof(char *);
-  for (i=0; i < Matrix->cols; i++){
+  object_size+= dbm_NumFiles(Matrix)*sizeof(char *);
+  for (i=0; i < dbm_NumFiles(Matrix); i++){
     object_size+=strlen(Matrix->filenames[i]) +1;
   }
   
@@ -3602,10 +9254,23 @@ int dbm_memoryInUse(doubleBufferedMatrix Matrix){
 }
 
 
+/* as dbm_memoryInUseBytes, limited to INT_MAX. Kept as an int for code built against earlier versions */
+
+int dbm_memoryInUse(doubleBufferedMatrix Matrix){
+
+  double object_size = dbm_memoryInUseBytes(Matrix);
+
+  if (object_size > INT_MAX){
+    return INT_MAX;
+  }
+  return (int)object_size;
+}
+
+
 
 double dbm_fileSpaceInUse(doubleBufferedMatrix Matrix){
   
-  return (double)(Matrix->rows)*(double)Matrix->cols*(double)sizeof(double);
+  return (double)(Matrix->rows)*(double)Matrix->cols*(double)dbm_ElementSize(Matrix);
 
 }
 
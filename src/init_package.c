@@ -23,6 +23,10 @@ void R_init_BufferedMatrix(){
 
   R_RegisterCCallable("BufferedMatrix", "dbm_setRows", (DL_FUNC)dbm_setRows);
   R_RegisterCCallable("BufferedMatrix", "dbm_AddColumn",(DL_FUNC)dbm_AddColumn);
+  R_RegisterCCallable("BufferedMatrix", "dbm_AddColumns",(DL_FUNC)dbm_AddColumns);
+  R_RegisterCCallable("BufferedMatrix", "dbm_AppendColumn",(DL_FUNC)dbm_AppendColumn);
+  R_RegisterCCallable("BufferedMatrix", "dbm_AdoptFiles",(DL_FUNC)dbm_AdoptFiles);
+  R_RegisterCCallable("BufferedMatrix", "dbm_ExportColumns",(DL_FUNC)dbm_ExportColumns);
   R_RegisterCCallable("BufferedMatrix", "dbm_ResizeColBuffer", (DL_FUNC)dbm_ResizeColBuffer);
   R_RegisterCCallable("BufferedMatrix", "dbm_ResizeRowBuffer", (DL_FUNC)dbm_ResizeRowBuffer);
   R_RegisterCCallable("BufferedMatrix", "dbm_ResizeBuffer",(DL_FUNC) dbm_ResizeBuffer);
@@ -40,6 +44,39 @@ void R_init_BufferedMatrix(){
   R_RegisterCCallable("BufferedMatrix", "dbm_getCols", (DL_FUNC)dbm_getCols);
   R_RegisterCCallable("BufferedMatrix", "dbm_getBufferCols", (DL_FUNC)dbm_getBufferCols);
   R_RegisterCCallable("BufferedMatrix", "dbm_getBufferRows", (DL_FUNC)dbm_getBufferRows);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setBufferBytes", (DL_FUNC)dbm_setBufferBytes);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getBufferBytes", (DL_FUNC)dbm_getBufferBytes);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setSharedBuffer", (DL_FUNC)dbm_setSharedBuffer);
+  R_RegisterCCallable("BufferedMatrix", "dbm_isSharedBuffer", (DL_FUNC)dbm_isSharedBuffer);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setSharedBufferBytes", (DL_FUNC)dbm_setSharedBufferBytes);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getSharedBufferBytes", (DL_FUNC)dbm_getSharedBufferBytes);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getSharedBufferInUse", (DL_FUNC)dbm_getSharedBufferInUse);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setMaxOpenFiles", (DL_FUNC)dbm_setMaxOpenFiles);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getMaxOpenFiles", (DL_FUNC)dbm_getMaxOpenFiles);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setColumnsPerFile", (DL_FUNC)dbm_setColumnsPerFile);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getColumnsPerFile", (DL_FUNC)dbm_getColumnsPerFile);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setMemoryMapped", (DL_FUNC)dbm_setMemoryMapped);
+  R_RegisterCCallable("BufferedMatrix", "dbm_isMemoryMapped", (DL_FUNC)dbm_isMemoryMapped);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setDirectIO", (DL_FUNC)dbm_setDirectIO);
+  R_RegisterCCallable("BufferedMatrix", "dbm_isDirectIO", (DL_FUNC)dbm_isDirectIO);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setPersistent", (DL_FUNC)dbm_setPersistent);
+  R_RegisterCCallable("BufferedMatrix", "dbm_isPersistent", (DL_FUNC)dbm_isPersistent);
+  R_RegisterCCallable("BufferedMatrix", "dbm_Flush", (DL_FUNC)dbm_Flush);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setTileRows", (DL_FUNC)dbm_setTileRows);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getTileRows", (DL_FUNC)dbm_getTileRows);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setStorageType", (DL_FUNC)dbm_setStorageType);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getStorageType", (DL_FUNC)dbm_getStorageType);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setPrefetchColumns", (DL_FUNC)dbm_setPrefetchColumns);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getPrefetchColumns", (DL_FUNC)dbm_getPrefetchColumns);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setWriteBehindColumns", (DL_FUNC)dbm_setWriteBehindColumns);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getWriteBehindColumns", (DL_FUNC)dbm_getWriteBehindColumns);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setIOThreads", (DL_FUNC)dbm_setIOThreads);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getIOThreads", (DL_FUNC)dbm_getIOThreads);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setEvictionPolicy", (DL_FUNC)dbm_setEvictionPolicy);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getEvictionPolicy", (DL_FUNC)dbm_getEvictionPolicy);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getColumnHits", (DL_FUNC)dbm_getColumnHits);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getColumnMisses", (DL_FUNC)dbm_getColumnMisses);
+  R_RegisterCCallable("BufferedMatrix", "dbm_resetColumnStats", (DL_FUNC)dbm_resetColumnStats);
   R_RegisterCCallable("BufferedMatrix", "dbm_getValueColumn", (DL_FUNC)dbm_getValueColumn);
   R_RegisterCCallable("BufferedMatrix", "dbm_getValueRow", (DL_FUNC)dbm_getValueRow);
   R_RegisterCCallable("BufferedMatrix", "dbm_setValueColumn", (DL_FUNC)dbm_setValueColumn);
@@ -47,7 +84,11 @@ void R_init_BufferedMatrix(){
   R_RegisterCCallable("BufferedMatrix", "dbm_getPrefix", (DL_FUNC)dbm_getPrefix);
   R_RegisterCCallable("BufferedMatrix", "dbm_getDirectory", (DL_FUNC)dbm_getDirectory);
   R_RegisterCCallable("BufferedMatrix", "dbm_getFileName", (DL_FUNC)dbm_getFileName);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setDirectories", (DL_FUNC)dbm_setDirectories);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getNumDirectories", (DL_FUNC)dbm_getNumDirectories);
+  R_RegisterCCallable("BufferedMatrix", "dbm_getStripeDirectory", (DL_FUNC)dbm_getStripeDirectory);
   R_RegisterCCallable("BufferedMatrix", "dbm_setNewDirectory", (DL_FUNC)dbm_setNewDirectory);
+  R_RegisterCCallable("BufferedMatrix", "dbm_setNewDirectoryProgress", (DL_FUNC)dbm_setNewDirectoryProgress);
   R_RegisterCCallable("BufferedMatrix", "dbm_copyValues", (DL_FUNC)dbm_copyValues);
   R_RegisterCCallable("BufferedMatrix", "dbm_ewApply", (DL_FUNC)dbm_ewApply);
   R_RegisterCCallable("BufferedMatrix", "dbm_max", (DL_FUNC)dbm_max);
@@ -70,4 +111,5 @@ void R_init_BufferedMatrix(){
   R_RegisterCCallable("BufferedMatrix", "dbm_colRanges", (DL_FUNC)dbm_colRanges);
   R_RegisterCCallable("BufferedMatrix", "dbm_fileSpaceInUse", (DL_FUNC)dbm_fileSpaceInUse);
   R_RegisterCCallable("BufferedMatrix", "dbm_memoryInUse", (DL_FUNC)dbm_memoryInUse);
+  R_RegisterCCallable("BufferedMatrix", "dbm_memoryInUseBytes", (DL_FUNC)dbm_memoryInUseBytes);
 }